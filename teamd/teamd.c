@@ -30,6 +30,7 @@
 #include <inttypes.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/select.h>
 #include <linux/netdevice.h>
 #include <sys/syslog.h>
@@ -51,6 +52,7 @@
 #include "teamd_dbus.h"
 #include "teamd_zmq.h"
 #include "teamd_phys_port_check.h"
+#include "teamd_realtime.h"
 
 enum teamd_exit_code {
 	TEAMD_EXIT_SUCCESS,
@@ -92,6 +94,43 @@ static void libteam_log_daemon(struct team_handle *th, int priority,
 
 static char **__g_pid_file;
 
+static struct teamd_context *teamd_get_next_instance(struct teamd_context *ctx,
+						     struct teamd_context *inst)
+{
+	if (!inst)
+		return ctx;
+	if (inst == ctx)
+		inst = NULL;
+	return list_get_next_node_entry(&ctx->instance_list, inst,
+					instance_item);
+}
+
+/* Iterates primary context and all contexts sharing its run loop */
+#define teamd_for_each_instance(inst, ctx)				\
+	for (inst = teamd_get_next_instance(ctx, NULL); inst;		\
+	     inst = teamd_get_next_instance(ctx, inst))
+
+static int teamd_instance_add(struct teamd_context *ctx,
+			      const char *config_file)
+{
+	struct teamd_context *inst;
+
+	inst = myzalloc(sizeof(*inst));
+	if (!inst)
+		return -ENOMEM;
+	inst->config_file = realpath(config_file, NULL);
+	if (!inst->config_file) {
+		fprintf(stderr, "Failed to get absolute path of \"%s\": %s\n",
+			config_file, strerror(errno));
+		free(inst);
+		return -errno;
+	}
+	list_init(&inst->instance_list);
+	inst->primary = ctx;
+	list_add_tail(&ctx->instance_list, &inst->instance_item);
+	return 0;
+}
+
 static void print_help(const struct teamd_context *ctx) {
 	int i;
 
@@ -116,7 +155,10 @@ static void print_help(const struct teamd_context *ctx) {
             "    -D --dbus-enable         Enable D-Bus interface\n"
             "    -Z --zmq-enable=ADDRESS  Enable ZeroMQ interface\n"
             "    -U --usock-enable        Enable UNIX domain socket interface\n"
-            "    -u --usock-disable       Disable UNIX domain socket interface\n",
+            "    -u --usock-disable       Disable UNIX domain socket interface\n"
+            "    -R --realtime            Lock memory and prefault it on start\n"
+            "    -M --multi-config=FILE   Manage one more team device configured\n"
+            "                             in FILE, may be used repeatedly\n",
             ctx->argv0);
 	printf("Available runners: ");
 	for (i = 0; i < TEAMD_RUNNER_LIST_SIZE; i++) {
@@ -149,10 +191,12 @@ static int parse_command_line(struct teamd_context *ctx,
 		{ "zmq-enable",		required_argument,	NULL, 'Z' },
 		{ "usock-enable",	no_argument,		NULL, 'U' },
 		{ "usock-disable",	no_argument,		NULL, 'u' },
+		{ "realtime",		no_argument,		NULL, 'R' },
+		{ "multi-config",	required_argument,	NULL, 'M' },
 		{ NULL, 0, NULL, 0 }
 	};
 
-	while ((opt = getopt_long(argc, argv, "hdkevf:c:p:groNt:nDZ:Uu",
+	while ((opt = getopt_long(argc, argv, "hdkevf:c:p:groNt:nDZ:UuRM:",
 				  long_options, NULL)) >= 0) {
 
 		switch(opt) {
@@ -230,6 +274,13 @@ static int parse_command_line(struct teamd_context *ctx,
 		case 'u':
 			ctx->usock.enabled = false;
 			break;
+		case 'R':
+			ctx->realtime = true;
+			break;
+		case 'M':
+			if (teamd_instance_add(ctx, optarg))
+				return -1;
+			break;
 		default:
 			return -1;
 		}
@@ -276,8 +327,10 @@ struct teamd_loop_callback {
 	teamd_loop_callback_func_t func;
 	int fd;
 	int fd_event;
+	enum teamd_loop_prio prio;
 	bool is_period;
 	bool enabled;
+	bool yield_unsafe; /* must not be run from teamd_run_loop_yield() */
 };
 
 static void teamd_run_loop_set_fds(struct list_item *lcb_list,
@@ -299,41 +352,184 @@ static void teamd_run_loop_set_fds(struct list_item *lcb_list,
 	}
 }
 
+static bool teamd_run_loop_lcb_ready(struct teamd_loop_callback *lcb,
+				     fd_set *fds)
+{
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		if ((lcb->fd_event & (1 << i)) && FD_ISSET(lcb->fd, &fds[i]))
+			return true;
+	}
+	return false;
+}
+
+/* Time control and background callbacks may spend in one loop iteration */
+#define TEAMD_LOOP_BUDGET_MS 10
+
+/* Max time protocol callbacks wait for long running control callback */
+#define TEAMD_LOOP_YIELD_MS 5
+
+static bool teamd_run_loop_time_elapsed(struct timespec *start, int ms)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 +
+	       (now.tv_nsec - start->tv_nsec) / 1000000 >= ms;
+}
+
+static int teamd_run_loop_lcb_dispatch(struct teamd_context *ctx,
+				       struct teamd_loop_callback *lcb,
+				       fd_set *fds)
+{
+	int i;
+	int events;
+	int err;
+
+	for (i = 0; i < 3; i++) {
+		if (!(lcb->fd_event & (1 << i)))
+			continue;
+		events = 0;
+		if (FD_ISSET(lcb->fd, &fds[i]))
+			events |= (1 << i);
+		if (!events)
+			continue;
+		if (lcb->is_period) {
+			err = handle_period_fd(lcb->fd);
+			if (err)
+				return err;
+		}
+		err = lcb->func(ctx, events, lcb->priv);
+		if (err) {
+			teamd_log_warn("Loop callback failed with: %s",
+				       strerror(-err));
+			teamd_log_dbg("Failed loop callback: %s, %p",
+				      lcb->name, lcb->priv);
+		}
+	}
+	return 0;
+}
+
+/* Control-plane budget of one loop iteration, shared by all team devices */
+struct teamd_loop_budget {
+	struct timespec start;
+	bool started;
+};
+
 static int teamd_run_loop_do_callbacks(struct list_item *lcb_list, fd_set *fds,
-				       struct teamd_context *ctx)
+				       struct teamd_context *ctx,
+				       bool control_pass,
+				       struct teamd_loop_budget *budget)
 {
 	struct teamd_loop_callback *lcb;
 	struct teamd_loop_callback *tmp;
-	int i;
-	int events;
+	bool control;
 	int err;
 
+	/*
+	 * Callback list is sorted by priority class. Protocol and link watch
+	 * callbacks of all team devices are processed in the first pass,
+	 * control and background ones in the second. Once the control-plane
+	 * budget is spent, leave the rest for the next iteration. Their fds
+	 * stay ready so select() returns right away, but anything more
+	 * important that became ready meanwhile gets processed before them.
+	 */
 	list_for_each_node_entry_safe(lcb, tmp, lcb_list, list) {
-		for (i = 0; i < 3; i++) {
-			if (!(lcb->fd_event & (1 << i)))
-				continue;
-			events = 0;
-			if (FD_ISSET(lcb->fd, &fds[i]))
-				events |= (1 << i);
-			if (!events)
-				continue;
-			if (lcb->is_period) {
-				err = handle_period_fd(lcb->fd);
-				if (err)
-					return err;
-			}
-			err = lcb->func(ctx, events, lcb->priv);
-			if (err) {
-				teamd_log_warn("Loop callback failed with: %s",
-					       strerror(-err));
-				teamd_log_dbg("Failed loop callback: %s, %p",
-					      lcb->name, lcb->priv);
+		control = lcb->prio >= TEAMD_LOOP_PRIO_CONTROL;
+		if (control != control_pass)
+			continue;
+		if (control && teamd_run_loop_lcb_ready(lcb, fds)) {
+			if (!budget->started) {
+				clock_gettime(CLOCK_MONOTONIC, &budget->start);
+				budget->started = true;
+			} else if (teamd_run_loop_time_elapsed(&budget->start,
+							       TEAMD_LOOP_BUDGET_MS)) {
+				teamd_log_dbgx(ctx, 2, "Loop budget exhausted, deferring callback: %s, %p",
+					       lcb->name, lcb->priv);
+				return 0;
 			}
+			clock_gettime(CLOCK_MONOTONIC,
+				      &ctx->run_loop.yield.last);
 		}
+		ctx->run_loop.yield.allowed = control;
+		err = teamd_run_loop_lcb_dispatch(ctx, lcb, fds);
+		ctx->run_loop.yield.allowed = false;
+		if (err)
+			return err;
 	}
 	return 0;
 }
 
+static bool teamd_run_loop_lcb_yieldable(struct teamd_loop_callback *lcb)
+{
+	return lcb->enabled && !lcb->yield_unsafe &&
+	       lcb->prio < TEAMD_LOOP_PRIO_CONTROL;
+}
+
+/*
+ * Long running control-plane operations (like state dump of team with
+ * many ports) call this periodically. In case the control callback has
+ * been running for a while, process pending protocol and link watch
+ * callbacks right away so LACPDUs and probes are not delayed by it.
+ *
+ * Netlink event callback is never run from here as it may add or remove
+ * ports. The caller therefore only has to expect port and runner state
+ * to change, not the lists it might be iterating.
+ */
+void teamd_run_loop_yield(struct teamd_context *ctx)
+{
+	struct teamd_loop_callback *lcb;
+	struct teamd_loop_callback *tmp;
+	struct timeval tv;
+	fd_set fds[3];
+	int fdmax = 0;
+	int ret;
+	int i;
+
+	if (!ctx->run_loop.yield.allowed || ctx->run_loop.yield.in_progress ||
+	    !teamd_run_loop_time_elapsed(&ctx->run_loop.yield.last,
+					 TEAMD_LOOP_YIELD_MS))
+		return;
+
+	for (i = 0; i < 3; i++)
+		FD_ZERO(&fds[i]);
+	list_for_each_node_entry(lcb, &ctx->run_loop.callback_list, list) {
+		if (!teamd_run_loop_lcb_yieldable(lcb))
+			continue;
+		for (i = 0; i < 3; i++) {
+			if (lcb->fd_event & (1 << i)) {
+				FD_SET(lcb->fd, &fds[i]);
+				if (lcb->fd >= fdmax)
+					fdmax = lcb->fd + 1;
+			}
+		}
+	}
+	do {
+		memset(&tv, 0, sizeof(tv));
+		ret = select(fdmax, &fds[0], &fds[1], &fds[2], &tv);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return;
+
+	ctx->run_loop.yield.in_progress = true;
+	list_for_each_node_entry_safe(lcb, tmp, &ctx->run_loop.callback_list,
+				      list) {
+		if (lcb->prio >= TEAMD_LOOP_PRIO_CONTROL)
+			break;
+		if (!teamd_run_loop_lcb_yieldable(lcb) ||
+		    !teamd_run_loop_lcb_ready(lcb, fds))
+			continue;
+		teamd_log_dbgx(ctx, 2, "Running callback from yield: %s, %p",
+			       lcb->name, lcb->priv);
+		if (teamd_run_loop_lcb_dispatch(ctx, lcb, fds))
+			break;
+	}
+	teamd_workq_run_after_dispatch(ctx);
+	ctx->run_loop.yield.in_progress = false;
+	clock_gettime(CLOCK_MONOTONIC, &ctx->run_loop.yield.last);
+}
+
 static int teamd_flush_ports(struct teamd_context *ctx)
 {
 	if (!ctx->no_quit_destroy)
@@ -343,69 +539,215 @@ static int teamd_flush_ports(struct teamd_context *ctx)
 	return 0;
 }
 
+static int teamd_run_loop_select(fd_set *fds, int fdmax)
+{
+	while (select(fdmax, &fds[0], &fds[1], &fds[2], NULL) < 0) {
+		if (errno == EINTR)
+			continue;
+
+		teamd_log_err("select() failed.");
+		return -errno;
+	}
+	return 0;
+}
+
+static void teamd_team_fini(struct teamd_context *ctx);
+static void teamd_fini(struct teamd_context *ctx);
+static void teamd_context_fini(struct teamd_context *ctx);
+
+/* Number of team devices which are still being managed */
+static unsigned int teamd_run_loop_live_count(struct teamd_context *ctx)
+{
+	struct teamd_context *inst;
+	unsigned int count = 0;
+
+	teamd_for_each_instance(inst, ctx)
+		if (!inst->run_loop.retired)
+			count++;
+	return count;
+}
+
+/*
+ * Team device is done, either it quit or its callbacks failed. Tear down
+ * just this one, the others stay. Primary context owns the loop itself,
+ * signals and PID file, so only its team part goes away now and the rest
+ * stays until the process exits.
+ */
+static void teamd_run_loop_instance_done(struct teamd_context *ctx,
+					 struct teamd_context *inst)
+{
+	teamd_log_info("%s: Team device is done.", inst->team_devname);
+	if (inst->run_loop.err && !ctx->run_loop.exit_err)
+		ctx->run_loop.exit_err = inst->run_loop.err;
+	/* Done without waiting, let port objects and their privs go */
+	teamd_port_obj_remove_all(inst);
+	if (inst == ctx) {
+		teamd_team_fini(ctx);
+		ctx->run_loop.retired = true;
+		return;
+	}
+	list_del(&inst->instance_item);
+	teamd_fini(inst);
+	teamd_config_free(inst);
+	teamd_context_fini(inst);
+}
+
+static void teamd_run_loop_reap(struct teamd_context *ctx)
+{
+	struct teamd_context *inst;
+	struct teamd_context *tmp;
+
+	if (!ctx->run_loop.retired && ctx->run_loop.quit_in_progress &&
+	    !teamd_has_ports(ctx))
+		teamd_run_loop_instance_done(ctx, ctx);
+	list_for_each_node_entry_safe(inst, tmp, &ctx->instance_list,
+				      instance_item) {
+		if (inst->run_loop.quit_in_progress && !teamd_has_ports(inst))
+			teamd_run_loop_instance_done(ctx, inst);
+	}
+}
+
+/* Processes control pipe byte, sets skip in case callbacks should wait */
+static int teamd_run_loop_ctrl(struct teamd_context *ctx,
+			       struct teamd_context *inst,
+			       fd_set *fds, bool *skip)
+{
+	int ctrl_fd = inst->run_loop.ctrl_pipe_r;
+	char ctrl_byte;
+	int err;
+
+	*skip = false;
+	if (!FD_ISSET(ctrl_fd, &fds[0]))
+		return 0;
+
+	err = read(ctrl_fd, &ctrl_byte, 1);
+	if (err != -1) {
+		if (inst->run_loop.retired)
+			return 0;
+		switch(ctrl_byte) {
+		case 'q':
+			if (inst->run_loop.quit_in_progress) {
+				/* Repeated quit, do not wait for ports */
+				if (teamd_run_loop_live_count(ctx) == 1)
+					return -EBUSY;
+				inst->run_loop.abort = true;
+				break;
+			}
+			err = teamd_flush_ports(inst);
+			if (err)
+				return err;
+			inst->run_loop.quit_in_progress = true;
+			*skip = true;
+			break;
+		case 'r':
+			*skip = true;
+			break;
+		}
+	} else if (errno == EINTR || errno == EAGAIN) {
+		*skip = true;
+	} else {
+		teamd_log_err("read() failed.");
+		return -errno;
+	}
+	return 0;
+}
+
+/*
+ * Failure of one team device callbacks ends just that device, unless it
+ * is the last one managed.
+ */
+static int teamd_run_loop_inst_err(struct teamd_context *ctx,
+				   struct teamd_context *inst, int err)
+{
+	if (teamd_run_loop_live_count(ctx) == 1)
+		return err;
+	teamd_log_err("%s: Loop callbacks failed: %s", inst->team_devname,
+		      strerror(-err));
+	inst->run_loop.err = err;
+	inst->run_loop.abort = true;
+	return 0;
+}
+
 static int teamd_run_loop_run(struct teamd_context *ctx)
 {
+	struct teamd_context *inst;
+	struct teamd_context *tmp;
+	struct teamd_loop_budget budget;
 	int err;
-	int ctrl_fd = ctx->run_loop.ctrl_pipe_r;
 	fd_set fds[3];
 	int fdmax;
-	char ctrl_byte;
+	bool skip;
 	int i;
-	bool quit_in_progress = false;
 
 	/*
 	 * To process all things correctly during cleanup, on quit command
 	 * received via control pipe ('q') do flush all existing ports.
-	 * After that wait until all ports are gone and return.
+	 * After that wait until all ports are gone and tear the team device
+	 * down.
+	 *
+	 * All team devices managed by this process share this loop, fds of
+	 * all their callbacks are waited for at once. Return once there is
+	 * no team device left.
 	 */
 
 	while (true) {
-		if (quit_in_progress && !teamd_has_ports(ctx))
-			return ctx->run_loop.err;
+		teamd_run_loop_reap(ctx);
+		if (!teamd_run_loop_live_count(ctx))
+			return ctx->run_loop.exit_err;
 
 		for (i = 0; i < 3; i++)
 			FD_ZERO(&fds[i]);
-		FD_SET(ctrl_fd, &fds[0]);
-		fdmax = ctrl_fd + 1;
-
-		teamd_run_loop_set_fds(&ctx->run_loop.callback_list,
-				       fds, &fdmax);
+		fdmax = 0;
+		teamd_for_each_instance(inst, ctx) {
+			/* Whatever got queued since, control callbacks included */
+			teamd_workq_run_after_dispatch(inst);
+			FD_SET(inst->run_loop.ctrl_pipe_r, &fds[0]);
+			if (inst->run_loop.ctrl_pipe_r >= fdmax)
+				fdmax = inst->run_loop.ctrl_pipe_r + 1;
+			teamd_run_loop_set_fds(&inst->run_loop.callback_list,
+					       fds, &fdmax);
+		}
 
-		while (select(fdmax, &fds[0], &fds[1], &fds[2], NULL) < 0) {
-			if (errno == EINTR)
-				continue;
+		err = teamd_run_loop_select(fds, fdmax);
+		if (err)
+			return err;
 
-			teamd_log_err("select() failed.");
-			return -errno;
+		teamd_for_each_instance(inst, ctx) {
+			err = teamd_run_loop_ctrl(ctx, inst, fds, &skip);
+			if (err)
+				return err;
+			inst->run_loop.skip = skip;
 		}
 
-		if (FD_ISSET(ctrl_fd, &fds[0])) {
-			err = read(ctrl_fd, &ctrl_byte, 1);
-			if (err != -1) {
-				switch(ctrl_byte) {
-				case 'q':
-					if (quit_in_progress)
-						return -EBUSY;
-					err = teamd_flush_ports(ctx);
+		memset(&budget, 0, sizeof(budget));
+		for (i = 0; i < 2; i++) {
+			teamd_for_each_instance(inst, ctx) {
+				if (inst->run_loop.skip || inst->run_loop.abort)
+					continue;
+				err = teamd_run_loop_do_callbacks(&inst->run_loop.callback_list,
+								  fds, inst, i,
+								  &budget);
+				if (err) {
+					err = teamd_run_loop_inst_err(ctx, inst,
+								      err);
 					if (err)
 						return err;
-					quit_in_progress = true;
-					continue;
-				case 'r':
-					continue;
 				}
-			} else if (errno == EINTR || errno == EAGAIN) {
-				continue;
-			} else {
-				teamd_log_err("read() failed.");
-				return -errno;
+				/*
+				 * Send out what protocol and link watch
+				 * callbacks queued before control ones run.
+				 */
+				if (!i)
+					teamd_workq_run_after_dispatch(inst);
 			}
 		}
 
-		err = teamd_run_loop_do_callbacks(&ctx->run_loop.callback_list,
-						  fds, ctx);
-		if (err)
-			return err;
+		if (ctx->run_loop.abort && !ctx->run_loop.retired)
+			teamd_run_loop_instance_done(ctx, ctx);
+		list_for_each_node_entry_safe(inst, tmp, &ctx->instance_list,
+					      instance_item)
+			if (inst->run_loop.abort)
+				teamd_run_loop_instance_done(ctx, inst);
 	}
 	return 0;
 }
@@ -480,10 +822,30 @@ static struct teamd_loop_callback *get_lcb_multi(struct teamd_context *ctx,
 	     lcb = tmp,							\
 	     tmp = get_lcb_multi(ctx, cb_name, priv, lcb))
 
+/*
+ * Keep the list sorted by priority class. Within the class, add the
+ * callback either as the first or as the last one.
+ */
+static void teamd_loop_callback_list_add(struct list_item *lcb_list,
+					 struct teamd_loop_callback *new_lcb,
+					 bool tail)
+{
+	struct teamd_loop_callback *lcb;
+
+	list_for_each_node_entry(lcb, lcb_list, list) {
+		if (lcb->prio > new_lcb->prio ||
+		    (!tail && lcb->prio == new_lcb->prio))
+			break;
+	}
+	/* Insert in front of lcb, or at the tail if loop went through */
+	list_add_tail(&lcb->list, &new_lcb->list);
+}
+
 static int __teamd_loop_callback_fd_add(struct teamd_context *ctx,
 					const char *cb_name, void *priv,
 					teamd_loop_callback_func_t func,
-					int fd, int fd_event, bool tail)
+					int fd, int fd_event,
+					enum teamd_loop_prio prio, bool tail)
 {
 	int err;
 	struct teamd_loop_callback *lcb;
@@ -509,10 +871,8 @@ static int __teamd_loop_callback_fd_add(struct teamd_context *ctx,
 	lcb->func = func;
 	lcb->fd = fd;
 	lcb->fd_event = fd_event & TEAMD_LOOP_FD_EVENT_MASK;
-	if (tail)
-		list_add_tail(&ctx->run_loop.callback_list, &lcb->list);
-	else
-		list_add(&ctx->run_loop.callback_list, &lcb->list);
+	lcb->prio = prio;
+	teamd_loop_callback_list_add(&ctx->run_loop.callback_list, lcb, tail);
 	teamd_log_dbg("Added loop callback: %s, %p", lcb->name, lcb->priv);
 	return 0;
 
@@ -524,19 +884,32 @@ lcb_free:
 int teamd_loop_callback_fd_add(struct teamd_context *ctx,
 			       const char *cb_name, void *priv,
 			       teamd_loop_callback_func_t func,
-			       int fd, int fd_event)
+			       int fd, int fd_event,
+			       enum teamd_loop_prio prio)
 {
 	return __teamd_loop_callback_fd_add(ctx, cb_name, priv, func,
-					    fd, fd_event, false);
+					    fd, fd_event, prio, false);
 }
 
 int teamd_loop_callback_fd_add_tail(struct teamd_context *ctx,
 				    const char *cb_name, void *priv,
 				    teamd_loop_callback_func_t func,
-				    int fd, int fd_event)
+				    int fd, int fd_event,
+				    enum teamd_loop_prio prio)
 {
 	return __teamd_loop_callback_fd_add(ctx, cb_name, priv, func,
-					    fd, fd_event, true);
+					    fd, fd_event, prio, true);
+}
+
+/*
+ * Monotonic time used by timers of the loop and the work queue. Kept as
+ * a single place to switch time source.
+ */
+int teamd_clock_gettime(struct teamd_context *ctx, struct timespec *ts)
+{
+	if (clock_gettime(CLOCK_MONOTONIC, ts))
+		return -errno;
+	return 0;
 }
 
 static int __timerfd_reset(int fd, struct timespec *interval,
@@ -562,7 +935,8 @@ int teamd_loop_callback_timer_add_set(struct teamd_context *ctx,
 				      const char *cb_name, void *priv,
 				      teamd_loop_callback_func_t func,
 				      struct timespec *interval,
-				      struct timespec *initial)
+				      struct timespec *initial,
+				      enum teamd_loop_prio prio)
 {
 	int err;
 	int fd;
@@ -580,7 +954,7 @@ int teamd_loop_callback_timer_add_set(struct teamd_context *ctx,
 		}
 	}
 	err = teamd_loop_callback_fd_add(ctx, cb_name, priv, func, fd,
-					 TEAMD_LOOP_FD_EVENT_READ);
+					 TEAMD_LOOP_FD_EVENT_READ, prio);
 	if (err) {
 		close(fd);
 		return err;
@@ -591,10 +965,11 @@ int teamd_loop_callback_timer_add_set(struct teamd_context *ctx,
 
 int teamd_loop_callback_timer_add(struct teamd_context *ctx,
 				  const char *cb_name, void *priv,
-				  teamd_loop_callback_func_t func)
+				  teamd_loop_callback_func_t func,
+				  enum teamd_loop_prio prio)
 {
 	return teamd_loop_callback_timer_add_set(ctx, cb_name, priv, func,
-						 NULL, NULL);
+						 NULL, NULL, prio);
 }
 
 int teamd_loop_callback_timer_set(struct teamd_context *ctx,
@@ -677,6 +1052,7 @@ int teamd_loop_callback_disable(struct teamd_context *ctx, const char *cb_name,
 static int callback_daemon_signal(struct teamd_context *ctx, int events,
 				  void *priv)
 {
+	struct teamd_context *inst;
 	int sig;
 
 	/* Get signal */
@@ -685,13 +1061,15 @@ static int callback_daemon_signal(struct teamd_context *ctx, int events,
 		return -EINVAL;
 	}
 
-	/* Dispatch signal */
+	/* Dispatch signal, quit all team devices managed by this process */
 	switch (sig) {
 	case SIGINT:
 	case SIGQUIT:
 	case SIGTERM:
 		teamd_log_warn("Got SIGINT, SIGQUIT or SIGTERM.");
-		teamd_run_loop_quit(ctx, 0);
+		teamd_for_each_instance(inst, ctx)
+			if (!inst->run_loop.retired)
+				teamd_run_loop_quit(inst, 0);
 		break;
 	}
 	return 0;
@@ -718,25 +1096,34 @@ static int teamd_run_loop_init(struct teamd_context *ctx)
 	ctx->run_loop.ctrl_pipe_r = fds[0];
 	ctx->run_loop.ctrl_pipe_w = fds[1];
 
+	/* Loop is run by primary context, signals are handled there */
+	if (ctx->primary)
+		goto add_libteam_callback;
+
 	err = teamd_loop_callback_fd_add(ctx, DAEMON_CB_NAME, ctx,
 					 callback_daemon_signal,
 					 daemon_signal_fd(),
-					 TEAMD_LOOP_FD_EVENT_READ);
+					 TEAMD_LOOP_FD_EVENT_READ,
+					 TEAMD_LOOP_PRIO_CONTROL);
 	if (err) {
 		teamd_log_err("Failed to add daemon loop callback");
 		goto close_pipe;
 	}
+	teamd_loop_callback_enable(ctx, DAEMON_CB_NAME, ctx);
 
+add_libteam_callback:
 	err = teamd_loop_callback_fd_add(ctx, LIBTEAM_EVENTS_CB_NAME, ctx,
 					 callback_libteam_event,
 					 team_get_event_fd(ctx->th),
-					 TEAMD_LOOP_FD_EVENT_READ);
+					 TEAMD_LOOP_FD_EVENT_READ,
+					 TEAMD_LOOP_PRIO_LINK_WATCH);
 	if (err) {
 		teamd_log_err("Failed to add libteam event loop callback");
 		goto del_daemon_callback;
 	}
 
-	teamd_loop_callback_enable(ctx, DAEMON_CB_NAME, ctx);
+	get_lcb(ctx, LIBTEAM_EVENTS_CB_NAME, ctx)->yield_unsafe = true;
+
 	teamd_loop_callback_enable(ctx, LIBTEAM_EVENTS_CB_NAME, ctx);
 
 	return 0;
@@ -1415,7 +1802,8 @@ team_free:
 	return err;
 }
 
-static void teamd_fini(struct teamd_context *ctx)
+/* Tears down all but the run loop itself */
+static void teamd_team_fini(struct teamd_context *ctx)
 {
 	teamd_zmq_fini(ctx);
 	teamd_dbus_fini(ctx);
@@ -1431,10 +1819,48 @@ static void teamd_fini(struct teamd_context *ctx)
 	teamd_events_fini(ctx);
 	teamd_unregister_default_handlers(ctx);
 	teamd_workq_fini(ctx);
-	teamd_run_loop_fini(ctx);
+	teamd_loop_callback_del(ctx, LIBTEAM_EVENTS_CB_NAME, NULL);
 	if (!ctx->no_quit_destroy)
 		team_destroy(ctx->th);
 	team_free(ctx->th);
+	ctx->th = NULL;
+}
+
+static void teamd_fini(struct teamd_context *ctx)
+{
+	if (!ctx->run_loop.retired)
+		teamd_team_fini(ctx);
+	teamd_run_loop_fini(ctx);
+}
+
+static int teamd_instances_start(struct teamd_context *ctx)
+{
+	struct teamd_context *inst;
+	int err;
+
+	list_for_each_node_entry(inst, &ctx->instance_list, instance_item) {
+		err = teamd_init(inst);
+		if (err) {
+			teamd_log_err("%s: teamd_init() failed.",
+				      inst->team_devname);
+			goto rollback;
+		}
+	}
+	return 0;
+
+rollback:
+	list_for_each_node_entry_continue_reverse(inst, &ctx->instance_list,
+						  instance_item)
+		teamd_fini(inst);
+	return err;
+}
+
+static void teamd_instances_stop(struct teamd_context *ctx)
+{
+	struct teamd_context *inst;
+
+	list_for_each_node_entry(inst, &ctx->instance_list, instance_item)
+		teamd_fini(inst);
 }
 
 static int teamd_start(struct teamd_context *ctx, enum teamd_exit_code *p_ret)
@@ -1516,6 +1942,19 @@ static int teamd_start(struct teamd_context *ctx, enum teamd_exit_code *p_ret)
 		daemon_retval_send(-err);
 		goto signal_done;
 	}
+
+	err = teamd_instances_start(ctx);
+	if (err) {
+		daemon_retval_send(-err);
+		goto teamd_fini;
+	}
+
+	err = teamd_realtime_init(ctx);
+	if (err) {
+		teamd_log_err("Failed to init real-time mode.");
+		daemon_retval_send(-err);
+		goto instances_stop;
+	}
 	*p_ret = TEAMD_EXIT_RUNTIME_FAILURE;
 
 	daemon_retval_send(0);
@@ -1526,6 +1965,10 @@ static int teamd_start(struct teamd_context *ctx, enum teamd_exit_code *p_ret)
 
 	teamd_log_info("Exiting...");
 
+	teamd_realtime_fini(ctx);
+instances_stop:
+	teamd_instances_stop(ctx);
+teamd_fini:
 	teamd_fini(ctx);
 
 signal_done:
@@ -1640,6 +2083,50 @@ static void teamd_init_debug_level(struct teamd_context *ctx)
 	daemon_set_verbosity(LOG_DEBUG);
 }
 
+static int teamd_instances_init(struct teamd_context *ctx)
+{
+	struct teamd_context *inst;
+	struct teamd_context *other;
+	int err;
+
+	list_for_each_node_entry(inst, &ctx->instance_list, instance_item) {
+		inst->cmd = ctx->cmd;
+		inst->debug = ctx->debug;
+		inst->force_recreate = ctx->force_recreate;
+		inst->take_over = ctx->take_over;
+		inst->no_quit_destroy = ctx->no_quit_destroy;
+		inst->init_no_ports = ctx->init_no_ports;
+		inst->argv0 = ctx->argv0;
+#ifdef ENABLE_DBUS
+		inst->dbus.enabled = ctx->dbus.enabled;
+#endif
+		/* ZeroMQ address can be bound only once, primary has it */
+		inst->usock.enabled = ctx->usock.enabled;
+
+		err = teamd_config_load(inst);
+		if (err) {
+			teamd_log_err("Failed to load config \"%s\".",
+				      inst->config_file);
+			return err;
+		}
+		err = teamd_get_devname(inst, false);
+		if (err)
+			return err;
+		teamd_for_each_instance(other, ctx) {
+			if (other == inst)
+				break;
+			if (!strcmp(other->team_devname, inst->team_devname)) {
+				teamd_log_err("Team device \"%s\" specified more than once.",
+					      inst->team_devname);
+				return -EEXIST;
+			}
+		}
+		teamd_log_dbg("Using config file \"%s\" for team device \"%s\"",
+			      inst->config_file, inst->team_devname);
+	}
+	return 0;
+}
+
 static int teamd_context_init(struct teamd_context **pctx)
 {
 	struct teamd_context *ctx;
@@ -1649,6 +2136,7 @@ static int teamd_context_init(struct teamd_context **pctx)
 		return -ENOMEM;
 	*pctx = ctx;
 	__g_pid_file = &ctx->pid_file;
+	list_init(&ctx->instance_list);
 
 	/* Enable usock by default */
 	ctx->usock.enabled = true;
@@ -1657,6 +2145,15 @@ static int teamd_context_init(struct teamd_context **pctx)
 
 static void teamd_context_fini(struct teamd_context *ctx)
 {
+	struct teamd_context *inst;
+	struct teamd_context *tmp;
+
+	list_for_each_node_entry_safe(inst, tmp, &ctx->instance_list,
+				      instance_item) {
+		list_del(&inst->instance_item);
+		teamd_config_free(inst);
+		teamd_context_fini(inst);
+	}
 	free(ctx->ident);
 	free(ctx->team_devname);
 	free(ctx->config_text);
@@ -1719,6 +2216,12 @@ int main(int argc, char **argv)
 	if (err)
 		goto config_free;
 
+	if (ctx->cmd == DAEMON_CMD_RUN) {
+		err = teamd_instances_init(ctx);
+		if (err)
+			goto config_free;
+	}
+
 	daemon_log_ident = ctx->ident;
 	daemon_pid_file_proc = teamd_pid_file_proc;
 
@@ -46,14 +46,30 @@
 #include <zmq.h>
 #endif
 
-#define teamd_log_err(args...) daemon_log(LOG_ERR, ##args)
-#define teamd_log_warn(args...) daemon_log(LOG_WARNING, ##args)
-#define teamd_log_info(args...) daemon_log(LOG_INFO, ##args)
-#define teamd_log_dbg(args...) daemon_log(LOG_DEBUG, ##args)
+#ifdef ENABLE_RT_ALLOC_CHECK
+extern unsigned int teamd_rt_noalloc_depth;
+
+/* syslog formats messages into allocated buffer, that is not checked */
+#define teamd_daemon_log(prio, args...)					\
+	do {								\
+		unsigned int __rt_depth = teamd_rt_noalloc_depth;	\
+									\
+		teamd_rt_noalloc_depth = 0;				\
+		daemon_log(prio, ##args);				\
+		teamd_rt_noalloc_depth = __rt_depth;			\
+	} while (0)
+#else
+#define teamd_daemon_log(prio, args...) daemon_log(prio, ##args)
+#endif
+
+#define teamd_log_err(args...) teamd_daemon_log(LOG_ERR, ##args)
+#define teamd_log_warn(args...) teamd_daemon_log(LOG_WARNING, ##args)
+#define teamd_log_info(args...) teamd_daemon_log(LOG_INFO, ##args)
+#define teamd_log_dbg(args...) teamd_daemon_log(LOG_DEBUG, ##args)
 
 #define teamd_log_dbgx(ctx, val, args...)	\
 	if (val <= ctx->debug)			\
-		daemon_log(LOG_DEBUG, ##args)
+		teamd_daemon_log(LOG_DEBUG, ##args)
 
 static inline void TEAMD_BUG(void)
 {
@@ -92,6 +108,7 @@ enum teamd_command {
 
 struct teamd_runner;
 struct teamd_context;
+struct lw_resolver;
 
 struct teamd_context {
 	enum teamd_command		cmd;
@@ -102,6 +119,7 @@ struct teamd_context {
 	bool				no_quit_destroy;
 	bool				init_no_ports;
 	bool				pre_add_ports;
+	bool				realtime;
 	char *				config_file;
 	char *				config_text;
 	json_t *			config_json;
@@ -109,6 +127,9 @@ struct teamd_context {
 	char *				team_devname;
 	char *				ident;
 	char *				argv0;
+	struct teamd_context *		primary; /* NULL if this is primary */
+	struct list_item		instance_list;
+	struct list_item		instance_item;
 	struct team_handle *		th;
 	const struct teamd_runner *	runner;
 	void *				runner_priv;
@@ -118,6 +139,10 @@ struct teamd_context {
 	struct list_item		event_watch_list;
 	struct list_item		state_ops_list;
 	struct list_item		state_val_list;
+	struct list_item		lw_rx_ring_list;
+	struct list_item		lw_tx_batch_list;
+	struct list_item		lw_xsk_list;
+	struct lw_resolver *		lw_resolver;
 	uint32_t			ifindex;
 	struct team_ifinfo *		ifinfo;
 	char *				hwaddr;
@@ -128,6 +153,16 @@ struct teamd_context {
 		int				ctrl_pipe_r;
 		int				ctrl_pipe_w;
 		int				err;
+		int				exit_err; /* of done instances */
+		bool				quit_in_progress;
+		bool				abort; /* done without waiting */
+		bool				retired; /* team part is gone */
+		bool				skip; /* in current iteration */
+		struct {
+			bool			allowed;
+			bool			in_progress;
+			struct timespec		last;
+		} yield;
 	} run_loop;
 #ifdef ENABLE_DBUS
 	struct {
@@ -151,8 +186,11 @@ struct teamd_context {
 	} usock;
 	struct {
 		struct list_item	work_list;
-		int			pipe_r;
-		int			pipe_w;
+		struct list_item	delayed_list;
+		struct list_item	after_dispatch_list;
+		int			efd;
+		bool			timer_armed;
+		struct timespec		timer_expires;
 	} workq;
 };
 
@@ -182,6 +220,8 @@ struct teamd_event_watch_ops {
 			      struct teamd_port *tdport, void *priv);
 	int (*port_link_changed)(struct teamd_context *ctx,
 				 struct teamd_port *tdport, void *priv);
+	int (*port_health_changed)(struct teamd_context *ctx,
+				   struct teamd_port *tdport, void *priv);
 	int (*port_hwaddr_changed)(struct teamd_context *ctx,
 				   struct teamd_port *tdport, void *priv);
 	int (*port_ifname_changed)(struct teamd_context *ctx,
@@ -199,6 +239,8 @@ int teamd_event_port_changed(struct teamd_context *ctx,
 			     struct teamd_port *tdport);
 int teamd_event_port_link_changed(struct teamd_context *ctx,
 				  struct teamd_port *tdport);
+int teamd_event_port_health_changed(struct teamd_context *ctx,
+				    struct teamd_port *tdport);
 int teamd_event_option_changed(struct teamd_context *ctx,
 			       struct team_option *option);
 int teamd_event_ifinfo_hwaddr_changed(struct teamd_context *ctx,
@@ -222,25 +264,41 @@ void teamd_event_watch_unregister(struct teamd_context *ctx,
 					 TEAMD_LOOP_FD_EVENT_WRITE | \
 					 TEAMD_LOOP_FD_EVENT_EXCEPTION)
 
+/*
+ * Callbacks are dispatched in order of their priority class. Callbacks of
+ * control and background classes share a per-iteration time budget, rest
+ * of ready ones is deferred to the next iteration once it is exhausted.
+ */
+enum teamd_loop_prio {
+	TEAMD_LOOP_PRIO_PROTOCOL,	/* runner protocol traffic */
+	TEAMD_LOOP_PRIO_LINK_WATCH,	/* link watchers, netlink events */
+	TEAMD_LOOP_PRIO_CONTROL,	/* usock, D-Bus, ZMQ, signals */
+	TEAMD_LOOP_PRIO_BACKGROUND,	/* workq */
+};
+
 typedef int (*teamd_loop_callback_func_t)(struct teamd_context *ctx,
 					  int events, void *priv);
 
 int teamd_loop_callback_fd_add(struct teamd_context *ctx,
 			       const char *cb_name, void *priv,
 			       teamd_loop_callback_func_t func,
-			       int fd, int fd_event);
+			       int fd, int fd_event,
+			       enum teamd_loop_prio prio);
 int teamd_loop_callback_fd_add_tail(struct teamd_context *ctx,
 				    const char *cb_name, void *priv,
 				    teamd_loop_callback_func_t func,
-				    int fd, int fd_event);
+				    int fd, int fd_event,
+				    enum teamd_loop_prio prio);
 int teamd_loop_callback_timer_add_set(struct teamd_context *ctx,
 				      const char *cb_name, void *priv,
 				      teamd_loop_callback_func_t func,
 				      struct timespec *interval,
-				      struct timespec *initial);
+				      struct timespec *initial,
+				      enum teamd_loop_prio prio);
 int teamd_loop_callback_timer_add(struct teamd_context *ctx,
 				  const char *cb_name, void *priv,
-				  teamd_loop_callback_func_t func);
+				  teamd_loop_callback_func_t func,
+				  enum teamd_loop_prio prio);
 int teamd_loop_callback_timer_set(struct teamd_context *ctx,
 				  const char *cb_name, void *priv,
 				  struct timespec *interval,
@@ -253,6 +311,10 @@ int teamd_loop_callback_disable(struct teamd_context *ctx, const char *cb_name,
 				void *priv);
 void teamd_run_loop_quit(struct teamd_context *ctx, int err);
 void teamd_run_loop_restart(struct teamd_context *ctx);
+void teamd_run_loop_yield(struct teamd_context *ctx);
+
+/* Monotonic time as seen by loop timers */
+int teamd_clock_gettime(struct teamd_context *ctx, struct timespec *ts);
 
 int teamd_change_debug_level(struct teamd_context *ctx, unsigned int new_debug);
 
@@ -327,6 +389,8 @@ static inline bool teamd_port_present(struct teamd_context *ctx,
 
 bool teamd_link_watch_port_up(struct teamd_context *ctx,
 			      struct teamd_port *tdport);
+unsigned int teamd_link_watch_port_health(struct teamd_context *ctx,
+					  struct teamd_port *tdport);
 void teamd_link_watches_set_forced_active(struct teamd_context *ctx,
 					  bool forced_active);
 int teamd_link_watch_init(struct teamd_context *ctx);
@@ -346,6 +410,13 @@ int teamd_balancer_port_added(struct teamd_balancer *tb,
 void teamd_balancer_port_removed(struct teamd_balancer *tb,
 				 struct teamd_port *tdport);
 
+struct teamd_peer_notify;
+int teamd_peer_notify_init(struct teamd_context *ctx,
+			   struct teamd_peer_notify **ppn);
+void teamd_peer_notify_fini(struct teamd_peer_notify *pn);
+int teamd_peer_notify_start(struct teamd_peer_notify *pn,
+			    struct teamd_port *tdport, const char *hwaddr);
+
 int teamd_hash_func_set(struct teamd_context *ctx);
 
 int teamd_packet_sock_open(int *sock_p, const uint32_t ifindex,
@@ -358,6 +429,9 @@ int teamd_sendto(int sockfd, const void *buf, size_t len, int flags,
 		 const struct sockaddr *dest_addr, socklen_t addrlen);
 int teamd_recvfrom(int sockfd, void *buf, size_t len, int flags,
 		   struct sockaddr *src_addr, socklen_t addrlen);
+int teamd_recvfrom_ts(int sockfd, void *buf, size_t len, int flags,
+		      struct sockaddr *src_addr, socklen_t addrlen,
+		      struct timespec *ts);
 
 /* Various helpers */
 static inline void ms_to_timespec(struct timespec *ts, int ms)
@@ -376,6 +450,25 @@ static inline bool timespec_is_zero(struct timespec *ts)
 	return !ts->tv_sec && !ts->tv_nsec;
 }
 
+static inline void timespec_add(struct timespec *ts, struct timespec *add)
+{
+	ts->tv_sec += add->tv_sec;
+	ts->tv_nsec += add->tv_nsec;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+static inline int timespec_cmp(struct timespec *ts1, struct timespec *ts2)
+{
+	if (ts1->tv_sec != ts2->tv_sec)
+		return ts1->tv_sec < ts2->tv_sec ? -1 : 1;
+	if (ts1->tv_nsec != ts2->tv_nsec)
+		return ts1->tv_nsec < ts2->tv_nsec ? -1 : 1;
+	return 0;
+}
+
 #define TEAMD_ENOENT(err) (err == -ENOENT || err == -ENODEV)
 
 #endif /* _TEAMD_H_ */
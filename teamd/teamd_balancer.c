@@ -50,6 +50,7 @@ struct tb_port_info {
 	struct {
 		uint64_t bytes;
 		bool unusable;
+		unsigned int health;
 	} rebalance;
 };
 
@@ -59,6 +60,8 @@ struct teamd_balancer {
 	struct teamd_context *ctx;
 	bool tx_balancing_enabled;
 	uint32_t balancing_interval;
+	bool health_weighting;
+	unsigned int min_health;
 	struct tb_hash_info hash_info[HASH_COUNT];
 	struct list_item port_info_list;
 };
@@ -133,11 +136,16 @@ static struct tb_port_info *tb_get_least_loaded_port(struct teamd_balancer *tb)
 	struct tb_port_info *tbpi;
 	struct tb_port_info *best_tbpi = NULL;
 
+	/*
+	 * Load is compared relative to port health, so port with health 50
+	 * ends up with about half of the traffic of healthy one.
+	 */
 	list_for_each_node_entry(tbpi, &tb->port_info_list, list) {
 		if (tbpi->rebalance.unusable)
 			continue;
 		if (!best_tbpi ||
-		    tbpi->rebalance.bytes < best_tbpi->rebalance.bytes)
+		    tbpi->rebalance.bytes * best_tbpi->rebalance.health <
+		    best_tbpi->rebalance.bytes * tbpi->rebalance.health)
 			best_tbpi = tbpi;
 	}
 	return best_tbpi;
@@ -168,6 +176,16 @@ static void tb_clear_rebalance_data(struct teamd_balancer *tb)
 	list_for_each_node_entry(tbpi, &tb->port_info_list, list) {
 		tbpi->rebalance.bytes = 0;
 		tbpi->rebalance.unusable = false;
+		tbpi->rebalance.health = 100;
+		if (!tb->health_weighting && !tb->min_health)
+			continue;
+		tbpi->rebalance.health =
+			teamd_link_watch_port_health(tb->ctx, tbpi->tdport);
+		if (!tbpi->rebalance.health ||
+		    tbpi->rebalance.health < tb->min_health)
+			tbpi->rebalance.unusable = true;
+		else if (!tb->health_weighting)
+			tbpi->rebalance.health = 100;
 	}
 	for (i = 0; i < HASH_COUNT; i++) {
 		tb->hash_info[i].rebalance.processed = false;
@@ -353,6 +371,29 @@ static uint32_t tb_get_balancing_interval(struct teamd_context *ctx)
 	return balancing_interval;
 }
 
+static int tb_load_health_options(struct teamd_context *ctx,
+				  struct teamd_balancer *tb)
+{
+	int err;
+	int tmp;
+
+	err = teamd_config_bool_get(ctx, &tb->health_weighting,
+				    "$.runner.tx_balancer.health_weighting");
+	if (err)
+		tb->health_weighting = false;
+
+	err = teamd_config_int_get(ctx, &tmp,
+				   "$.runner.tx_balancer.min_health");
+	if (err)
+		tmp = 0;
+	if (tmp < 0 || tmp > 100) {
+		teamd_log_err("\"runner.tx_balancer.min_health\" must be in range 0-100.");
+		return -EINVAL;
+	}
+	tb->min_health = tmp;
+	return 0;
+}
+
 static int tb_set_lb_tx_method(struct team_handle *th,
 			       struct teamd_balancer *tb)
 {
@@ -398,6 +439,9 @@ int teamd_balancer_init(struct teamd_context *ctx, struct teamd_balancer **ptb)
 
 	tb->tx_balancing_enabled = tb_get_enable_tx_balancing(ctx);
 	tb->balancing_interval = tb_get_balancing_interval(ctx);
+	err = tb_load_health_options(ctx, tb);
+	if (err)
+		goto err_load_health_options;
 
 	err = tb_set_lb_tx_method(ctx->th, tb);
 	if (err) {
@@ -426,6 +470,7 @@ int teamd_balancer_init(struct teamd_context *ctx, struct teamd_balancer **ptb)
 	*ptb = tb;
 	return 0;
 
+err_load_health_options:
 err_set_lb_tx_method:
 err_set_lb_stats_refresh_interval:
 err_change_handler_register:
@@ -185,3 +185,50 @@ rerecv:
 	}
 	return ret;
 }
+
+/*
+ * Same as teamd_recvfrom(), in addition kernel receive timestamp is
+ * stored into ts in case socket has SO_TIMESTAMPNS enabled. Otherwise ts
+ * is zeroed.
+ */
+int teamd_recvfrom_ts(int sockfd, void *buf, size_t len, int flags,
+		      struct sockaddr *src_addr, socklen_t addrlen,
+		      struct timespec *ts)
+{
+	char control[CMSG_SPACE(sizeof(struct timespec))];
+	struct iovec iov = {
+		.iov_base = buf,
+		.iov_len = len,
+	};
+	struct msghdr msg = {
+		.msg_name = src_addr,
+		.msg_namelen = addrlen,
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control,
+		.msg_controllen = sizeof(control),
+	};
+	struct cmsghdr *cmsg;
+	ssize_t ret;
+
+rerecv:
+	ret = recvmsg(sockfd, &msg, flags);
+	if (ret == -1) {
+		switch(errno) {
+		case EINTR:
+			goto rerecv;
+		case ENETDOWN:
+			return 0;
+		default:
+			teamd_log_err("recvmsg failed.");
+			return -errno;
+		}
+	}
+	memset(ts, 0, sizeof(*ts));
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_TIMESTAMPNS)
+			memcpy(ts, CMSG_DATA(cmsg), sizeof(*ts));
+	}
+	return ret;
+}
@@ -94,6 +94,22 @@ int teamd_event_port_link_changed(struct teamd_context *ctx,
 	return 0;
 }
 
+int teamd_event_port_health_changed(struct teamd_context *ctx,
+				    struct teamd_port *tdport)
+{
+	struct event_watch_item *watch;
+	int err;
+
+	list_for_each_node_entry(watch, &ctx->event_watch_list, list) {
+		if (!watch->ops->port_health_changed)
+			continue;
+		err = watch->ops->port_health_changed(ctx, tdport, watch->priv);
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
 int teamd_event_option_changed(struct teamd_context *ctx,
 			       struct team_option *option)
 {
@@ -31,12 +31,15 @@
 
 #include "teamd.h"
 #include "teamd_config.h"
+#include "teamd_realtime.h"
 #include "teamd_link_watch.h"
 
 extern const struct teamd_link_watch teamd_link_watch_ethtool;
 extern const struct teamd_link_watch teamd_link_watch_arp_ping;
 extern const struct teamd_link_watch teamd_link_watch_nsnap;
+extern const struct teamd_link_watch teamd_link_watch_icmp_ping;
 extern const struct teamd_link_watch teamd_link_watch_tipc;
+extern const struct teamd_link_watch teamd_link_watch_bfd;
 
 int __set_sockaddr(struct sockaddr *sa, socklen_t sa_len, sa_family_t family,
 		   const char *hostname)
@@ -78,21 +81,240 @@ char *__str_sockaddr(struct sockaddr *sa, socklen_t sa_len, sa_family_t family,
 	return buf;
 }
 
+/*
+ * Link flap damping, the same way as BGP route flap damping (RFC 2439)
+ * does it. Every time link goes down, penalty is increased. Penalty
+ * decays exponentially with given half-life. Once it exceeds suppress
+ * threshold, link is reported down until the penalty decays below reuse
+ * threshold.
+ */
+#define LW_DAMPING_CB_NAME "lw_damping"
+
+#define LW_DAMPING_DEFAULT_FLAP_PENALTY 1000
+#define LW_DAMPING_DEFAULT_SUPPRESS 2000
+#define LW_DAMPING_DEFAULT_REUSE 750
+#define LW_DAMPING_DEFAULT_HALF_LIFE 15000
+#define LW_DAMPING_MIN_CHECK_INTERVAL 100
+
+/*
+ * Decay is exact at every half-life and linear in between, which is
+ * precise enough here and avoids libm.
+ */
+static unsigned int lw_damping_penalty_get(struct lw_damping *damping,
+					   struct timespec *now)
+{
+	uint64_t elapsed;
+	uint64_t shift;
+	uint64_t penalty;
+
+	elapsed = (now->tv_sec - damping->updated.tv_sec) * 1000 +
+		  (now->tv_nsec - damping->updated.tv_nsec) / 1000000;
+	shift = elapsed / damping->half_life;
+	if (shift >= 32)
+		return 0;
+	penalty = damping->penalty >> shift;
+	penalty -= penalty / 2 * (elapsed % damping->half_life) /
+		   damping->half_life;
+	return penalty;
+}
+
+static void lw_damping_penalty_update(struct teamd_context *ctx,
+				      struct lw_damping *damping)
+{
+	struct timespec now;
+
+	teamd_clock_gettime(ctx, &now);
+	damping->penalty = lw_damping_penalty_get(damping, &now);
+	damping->updated = now;
+}
+
+static int lw_damping_flap(struct teamd_context *ctx,
+			   struct lw_common_port_priv *common_ppriv)
+{
+	struct lw_damping *damping = &common_ppriv->damping;
+	int err;
+
+	lw_damping_penalty_update(ctx, damping);
+	damping->penalty += damping->flap_penalty;
+	if (damping->penalty > damping->max_penalty)
+		damping->penalty = damping->max_penalty;
+	if (damping->suppressed || damping->penalty < damping->suppress)
+		return 0;
+
+	err = teamd_loop_callback_timer_set(ctx, LW_DAMPING_CB_NAME,
+					    common_ppriv,
+					    &damping->check_interval,
+					    &damping->check_interval);
+	if (err)
+		return err;
+	teamd_loop_callback_enable(ctx, LW_DAMPING_CB_NAME, common_ppriv);
+	damping->suppressed = true;
+	return 0;
+}
+
+static int lw_damping_callback(struct teamd_context *ctx, int events,
+			       void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_damping *damping = &common_ppriv->damping;
+	struct teamd_port *tdport = common_ppriv->tdport;
+
+	lw_damping_penalty_update(ctx, damping);
+	if (damping->penalty >= damping->reuse)
+		return 0;
+	teamd_loop_callback_disable(ctx, LW_DAMPING_CB_NAME, common_ppriv);
+	damping->suppressed = false;
+	teamd_log_info("%s: %s-link is not suppressed anymore, link is %s.",
+		       tdport->ifname, common_ppriv->link_watch->name,
+		       common_ppriv->link_up ? "up" : "down");
+	if (!common_ppriv->link_up)
+		return 0;
+	return teamd_event_port_link_changed(ctx, tdport);
+}
+
+static int lw_damping_load_options(struct teamd_context *ctx,
+				   struct lw_common_port_priv *common_ppriv)
+{
+	struct teamd_config_path_cookie *cpcookie = common_ppriv->cpcookie;
+	struct lw_damping *damping = &common_ppriv->damping;
+	int tmp;
+	int err;
+
+	if (!teamd_config_path_exists(ctx, "@.damping", cpcookie))
+		return 0;
+
+	err = teamd_config_int_get(ctx, &tmp, "@.damping.penalty", cpcookie);
+	if (err)
+		tmp = LW_DAMPING_DEFAULT_FLAP_PENALTY;
+	if (tmp <= 0) {
+		teamd_log_err("\"damping.penalty\" must be positive number.");
+		return -EINVAL;
+	}
+	damping->flap_penalty = tmp;
+
+	err = teamd_config_int_get(ctx, &tmp, "@.damping.suppress", cpcookie);
+	if (err)
+		tmp = LW_DAMPING_DEFAULT_SUPPRESS;
+	if (tmp <= 0) {
+		teamd_log_err("\"damping.suppress\" must be positive number.");
+		return -EINVAL;
+	}
+	damping->suppress = tmp;
+
+	err = teamd_config_int_get(ctx, &tmp, "@.damping.reuse", cpcookie);
+	if (err)
+		tmp = LW_DAMPING_DEFAULT_REUSE;
+	if (tmp <= 0 || tmp >= damping->suppress) {
+		teamd_log_err("\"damping.reuse\" must be positive number lower than \"damping.suppress\".");
+		return -EINVAL;
+	}
+	damping->reuse = tmp;
+
+	err = teamd_config_int_get(ctx, &tmp, "@.damping.half_life", cpcookie);
+	if (err)
+		tmp = LW_DAMPING_DEFAULT_HALF_LIFE;
+	if (tmp <= 0) {
+		teamd_log_err("\"damping.half_life\" must be positive number.");
+		return -EINVAL;
+	}
+	damping->half_life = tmp;
+
+	/* By default link is suppressed for at most 4 half-lives */
+	err = teamd_config_int_get(ctx, &tmp, "@.damping.max_penalty",
+				   cpcookie);
+	if (err)
+		tmp = damping->reuse * 16;
+	if (tmp < damping->suppress) {
+		teamd_log_err("\"damping.max_penalty\" must not be lower than \"damping.suppress\".");
+		return -EINVAL;
+	}
+	damping->max_penalty = tmp;
+
+	tmp = damping->half_life / 16;
+	if (tmp < LW_DAMPING_MIN_CHECK_INTERVAL)
+		tmp = LW_DAMPING_MIN_CHECK_INTERVAL;
+	ms_to_timespec(&damping->check_interval, tmp);
+
+	teamd_log_dbg("%s: damping penalty %u, suppress %u, reuse %u, half_life %u, max_penalty %u.",
+		      common_ppriv->tdport->ifname, damping->flap_penalty,
+		      damping->suppress, damping->reuse, damping->half_life,
+		      damping->max_penalty);
+	teamd_clock_gettime(ctx, &damping->updated);
+	damping->enabled = true;
+	return 0;
+}
+
+static int lw_damping_init(struct teamd_context *ctx,
+			   struct lw_common_port_priv *common_ppriv)
+{
+	int err;
+
+	err = lw_damping_load_options(ctx, common_ppriv);
+	if (err || !common_ppriv->damping.enabled)
+		return err;
+	return teamd_loop_callback_timer_add(ctx, LW_DAMPING_CB_NAME,
+					     common_ppriv, lw_damping_callback,
+					     TEAMD_LOOP_PRIO_LINK_WATCH);
+}
+
+static void lw_damping_fini(struct teamd_context *ctx,
+			    struct lw_common_port_priv *common_ppriv)
+{
+	if (!common_ppriv->damping.enabled)
+		return;
+	teamd_loop_callback_del(ctx, LW_DAMPING_CB_NAME, common_ppriv);
+}
+
+static bool lw_link_up_reported(struct lw_common_port_priv *common_ppriv)
+{
+	return common_ppriv->link_up && !common_ppriv->damping.suppressed;
+}
+
 int teamd_link_watch_check_link_up(struct teamd_context *ctx,
 				   struct teamd_port *tdport,
 				   struct lw_common_port_priv *common_ppriv,
 				   bool new_link_up)
 {
 	const char *lw_name = common_ppriv->link_watch->name;
+	bool was_suppressed = common_ppriv->damping.suppressed;
+	int err = 0;
 
 	if (!teamd_link_watch_link_up_differs(common_ppriv, new_link_up))
 		return 0;
 	common_ppriv->link_up = new_link_up;
-	teamd_log_info("%s: %s-link went %s.", tdport->ifname, lw_name,
-		       new_link_up ? "up" : "down");
+	if (common_ppriv->damping.enabled && !new_link_up) {
+		err = lw_damping_flap(ctx, common_ppriv);
+		if (err)
+			return err;
+	}
+	teamd_log_info("%s: %s-link went %s%s.", tdport->ifname, lw_name,
+		       new_link_up ? "up" : "down",
+		       common_ppriv->damping.suppressed ?
+		       " (suppressed by damping)" : "");
+	/* Suppressed link is already reported down */
+	if (was_suppressed)
+		return 0;
 	return teamd_event_port_link_changed(ctx, tdport);
 }
 
+/*
+ * Link watches providing health_get call this once per interval. Runners
+ * are told in case port health differs from the one reported last time,
+ * so they can act on health thresholds without polling.
+ */
+int teamd_link_watch_check_health(struct teamd_context *ctx,
+				  struct lw_common_port_priv *common_ppriv)
+{
+	struct teamd_port *tdport = common_ppriv->tdport;
+	unsigned int health;
+
+	health = teamd_link_watch_port_health(ctx, tdport);
+	if (health == common_ppriv->port_health)
+		return 0;
+	common_ppriv->port_health = health;
+	return teamd_event_port_health_changed(ctx, tdport);
+}
+
 /*
  * General link watch code
  */
@@ -100,7 +322,9 @@ static const struct teamd_link_watch *teamd_link_watch_list[] = {
 	&teamd_link_watch_ethtool,
 	&teamd_link_watch_arp_ping,
 	&teamd_link_watch_nsnap,
+	&teamd_link_watch_icmp_ping,
 	&teamd_link_watch_tipc,
+	&teamd_link_watch_bfd,
 };
 
 #define TEAMD_LINK_WATCH_LIST_SIZE ARRAY_SIZE(teamd_link_watch_list)
@@ -132,13 +356,39 @@ bool teamd_link_watch_port_up(struct teamd_context *ctx,
 	link = true;
 	teamd_for_each_port_priv_by_creator(common_ppriv, tdport,
 					    LW_PORT_PRIV_CREATOR_PRIV) {
-		link = common_ppriv->link_up;
+		link = lw_link_up_reported(common_ppriv);
 		if (link)
 			return link;
 	}
 	return link;
 }
 
+/*
+ * Port health is the best one of its link watches which report link up,
+ * 0 in case link is down.
+ */
+unsigned int teamd_link_watch_port_health(struct teamd_context *ctx,
+					  struct teamd_port *tdport)
+{
+	struct lw_common_port_priv *common_ppriv;
+	unsigned int health = 0;
+	unsigned int tmp;
+
+	if (!tdport)
+		return 100;
+	teamd_for_each_port_priv_by_creator(common_ppriv, tdport,
+					    LW_PORT_PRIV_CREATOR_PRIV) {
+		if (!lw_link_up_reported(common_ppriv))
+			continue;
+		if (!common_ppriv->link_watch->health_get)
+			return 100;
+		tmp = common_ppriv->link_watch->health_get(common_ppriv);
+		if (tmp > health)
+			health = tmp;
+	}
+	return health;
+}
+
 static int teamd_link_watch_refresh_user_linkup(struct teamd_context *ctx,
 						struct teamd_port *tdport)
 {
@@ -154,8 +404,8 @@ static int teamd_link_watch_refresh_user_linkup(struct teamd_context *ctx,
 					&cur_link);
 	if (!err && link == cur_link)
 		return 0;
-	err = team_set_port_user_linkup(ctx->th, tdport->ifindex,
-					link);
+	err = teamd_rt_alloc_allowed(
+		team_set_port_user_linkup(ctx->th, tdport->ifindex, link));
 	if (err)
 		return err;
 	return 0;
@@ -181,6 +431,49 @@ static int link_watch_state_up_get(struct teamd_context *ctx,
 	return 0;
 }
 
+static int link_watch_state_health_get(struct teamd_context *ctx,
+				       struct team_state_gsc *gsc,
+				       void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+
+	if (!lw_link_up_reported(common_ppriv))
+		gsc->data.int_val = 0;
+	else if (!common_ppriv->link_watch->health_get)
+		gsc->data.int_val = 100;
+	else
+		gsc->data.int_val =
+			common_ppriv->link_watch->health_get(common_ppriv);
+	return 0;
+}
+
+static int link_watch_state_damping_penalty_get(struct teamd_context *ctx,
+						struct team_state_gsc *gsc,
+						void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct timespec now;
+
+	if (!common_ppriv->damping.enabled) {
+		gsc->data.int_val = 0;
+		return 0;
+	}
+	teamd_clock_gettime(ctx, &now);
+	gsc->data.int_val = lw_damping_penalty_get(&common_ppriv->damping,
+						   &now);
+	return 0;
+}
+
+static int link_watch_state_damping_suppressed_get(struct teamd_context *ctx,
+						   struct team_state_gsc *gsc,
+						   void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+
+	gsc->data.bool_val = common_ppriv->damping.suppressed;
+	return 0;
+}
+
 static const struct teamd_state_val link_watch_state_vals[] = {
 	{
 		.subpath = "name",
@@ -192,6 +485,21 @@ static const struct teamd_state_val link_watch_state_vals[] = {
 		.type = TEAMD_STATE_ITEM_TYPE_BOOL,
 		.getter = link_watch_state_up_get,
 	},
+	{
+		.subpath = "health",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = link_watch_state_health_get,
+	},
+	{
+		.subpath = "damping_penalty",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = link_watch_state_damping_penalty_get,
+	},
+	{
+		.subpath = "damping_suppressed",
+		.type = TEAMD_STATE_ITEM_TYPE_BOOL,
+		.getter = link_watch_state_damping_suppressed_get,
+	},
 };
 
 static const struct teamd_state_val link_watch_state_vg = {
@@ -293,10 +601,17 @@ static int link_watch_load_config_one(struct teamd_context *ctx,
 	common_ppriv->cpcookie = cpcookie;
 	common_ppriv->link_up = linkup;
 
-	err = link_watch_state_register(ctx, common_ppriv);
+	err = lw_damping_init(ctx, common_ppriv);
 	if (err)
 		return err;
+	err = link_watch_state_register(ctx, common_ppriv);
+	if (err)
+		goto damping_fini;
 	return 0;
+
+damping_fini:
+	lw_damping_fini(ctx, common_ppriv);
+	return err;
 }
 
 static int link_watch_load_config(struct teamd_context *ctx,
@@ -375,8 +690,10 @@ static void link_watch_event_watch_port_removed(struct teamd_context *ctx,
 	struct lw_common_port_priv *common_ppriv;
 
 	teamd_for_each_port_priv_by_creator(common_ppriv, tdport,
-					    LW_PORT_PRIV_CREATOR_PRIV)
+					    LW_PORT_PRIV_CREATOR_PRIV) {
 		link_watch_state_unregister(ctx, common_ppriv);
+		lw_damping_fini(ctx, common_ppriv);
+	}
 }
 
 static int link_watch_event_watch_port_link_changed(struct teamd_context *ctx,
@@ -448,12 +765,26 @@ static int port_link_state_up_get(struct teamd_context *ctx,
 	return 0;
 }
 
+static int port_link_state_health_get(struct teamd_context *ctx,
+				      struct team_state_gsc *gsc,
+				      void *priv)
+{
+	gsc->data.int_val = teamd_link_watch_port_health(ctx,
+							 gsc->info.tdport);
+	return 0;
+}
+
 static const struct teamd_state_val link_watch_root_state_vals[] = {
 	{
 		.subpath = "up",
 		.type = TEAMD_STATE_ITEM_TYPE_BOOL,
 		.getter = port_link_state_up_get,
 	},
+	{
+		.subpath = "health",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = port_link_state_health_get,
+	},
 };
 
 static const struct teamd_state_val link_watch_root_state_vg = {
@@ -467,6 +798,9 @@ int teamd_link_watch_init(struct teamd_context *ctx)
 {
 	int err;
 
+	list_init(&ctx->lw_rx_ring_list);
+	list_init(&ctx->lw_tx_batch_list);
+	list_init(&ctx->lw_xsk_list);
 	err = teamd_event_watch_register(ctx, &link_watch_port_watch_ops, NULL);
 	if (err) {
 		teamd_log_err("Failed to register event watch.");
@@ -1,12 +1,35 @@
 #ifndef _TEAMD_LINK_WATCH_H_
 #define _TEAMD_LINK_WATCH_H_
 
+#include <time.h>
+#include <netinet/in.h>
 #include "teamd_state.h"
+#include "teamd_workq.h"
+
+struct lw_common_port_priv;
 
 struct teamd_link_watch {
 	const char *name;
 	const struct teamd_state_val state_vg;
 	struct teamd_port_priv port_priv;
+	/*
+	 * Optional, returns link quality 0-100 while link is up. Link watches
+	 * without it are considered to have full health.
+	 */
+	unsigned int (*health_get)(struct lw_common_port_priv *common_ppriv);
+};
+
+struct lw_damping {
+	bool enabled;
+	bool suppressed; /* link is reported down no matter what link_up is */
+	unsigned int penalty; /* as of "updated" time */
+	struct timespec updated;
+	unsigned int flap_penalty;
+	unsigned int suppress;
+	unsigned int reuse;
+	unsigned int max_penalty;
+	unsigned int half_life; /* ms */
+	struct timespec check_interval;
 };
 
 struct lw_common_port_priv {
@@ -16,11 +39,34 @@ struct lw_common_port_priv {
 	struct teamd_port *tdport;
 	bool link_up;
 	bool forced_send;
+	unsigned int port_health; /* as last reported by this link watch */
 	struct teamd_config_path_cookie *cpcookie;
+	struct lw_damping damping;
 };
 
 struct lw_psr_port_priv;
 
+#define LW_TX_BATCH_MSG_LEN 64
+
+/* Probe to be sent, with its destination, as built by send_prepare */
+struct lw_tx_batch_msg {
+	union {
+		struct sockaddr sa;
+		struct sockaddr_ll ll;
+		struct sockaddr_in6 sin6;
+	} addr;
+	socklen_t addr_len;
+	size_t len; /* 0 in case there is nothing to send */
+	char buf[LW_TX_BATCH_MSG_LEN];
+	struct lw_psr_port_priv *psr_ppriv;
+};
+
+/* ICMP or ICMPv6 (by protocol) echo replies with given identifier */
+struct lw_xsk_match {
+	unsigned short protocol; /* ETH_P_IP or ETH_P_IPV6 */
+	uint16_t echo_id;
+};
+
 struct lw_psr_ops {
 	int (*sock_open)(struct lw_psr_port_priv *psr_ppriv);
 	void (*sock_close)(struct lw_psr_port_priv *psr_ppriv);
@@ -29,6 +75,51 @@ struct lw_psr_ops {
 			    struct lw_psr_port_priv *psr_ppriv);
 	int (*send)(struct lw_psr_port_priv *psr_ppriv);
 	int (*receive)(struct lw_psr_port_priv *psr_ppriv);
+	/* Names shared rx ring and tx batch */
+	const char *proto_name;
+	/* Optional, used when frames are read from shared rx ring */
+	void (*receive_frame)(struct lw_psr_port_priv *psr_ppriv,
+			      const void *buf, size_t len,
+			      const struct sockaddr_ll *ll_from, int vlanid,
+			      const struct timespec *ts);
+	unsigned short rx_ring_protocol;
+	const struct sock_fprog *rx_ring_fprog;
+	/*
+	 * Optional, used when probes are sent in batches. Called for each
+	 * of probe_count probes sent per interval, index tells which one.
+	 */
+	int (*send_prepare)(struct lw_psr_port_priv *psr_ppriv,
+			    struct lw_tx_batch_msg *msg, unsigned int index);
+	int (*tx_batch_sock_open)(int *sock_p);
+	/* Optional, tells which replies AF_XDP program redirects to watcher */
+	void (*xsk_match)(struct lw_psr_port_priv *psr_ppriv,
+			  struct lw_xsk_match *match);
+};
+
+struct lw_rx_ring;
+struct lw_tx_batch;
+struct lw_xsk;
+struct lw_resolver;
+struct lw_resolve_query;
+struct lw_resolve;
+
+/* Called once address is resolved for the first time and on each change */
+typedef int (*lw_resolve_changed_func_t)(struct teamd_context *ctx,
+					 struct lw_resolve *res, bool first);
+
+struct lw_resolve {
+	struct list_item list; /* in list of link watch using it */
+	char *hostname; /* NULL for address literal */
+	int family;
+	void *addr; /* struct in_addr or in6_addr result is stored to */
+	bool resolved;
+	unsigned int interval; /* ms, period of lookups, 0 means once */
+	unsigned int retry; /* ms, delay of next lookup after failure */
+	struct teamd_workq workq;
+	struct lw_resolver *resolver;
+	struct lw_resolve_query *query; /* lookup in progress */
+	lw_resolve_changed_func_t changed;
+	void *priv;
 };
 
 struct lw_psr_port_priv {
@@ -36,10 +127,38 @@ struct lw_psr_port_priv {
 	const struct lw_psr_ops *ops;
 	struct timespec interval;
 	struct timespec init_wait;
+	struct timespec fast_interval; /* zero in case not used */
+	bool fast; /* probing at fast_interval now */
 	unsigned int missed_max;
 	int sock;
+	bool sock_opened;
+	struct teamd_workq sock_workq; /* retries failed socket reopen */
 	unsigned int missed;
 	bool reply_received;
+	struct lw_rx_ring *rx_ring;
+	struct list_item rx_ring_list;
+	unsigned int probe_count; /* probes sent per interval */
+	bool tx_batch_enabled;
+	unsigned int tx_batch_window;
+	struct lw_tx_batch *tx_batch;
+	struct lw_xsk *xsk;
+	struct list_item xsk_list;
+	struct lw_xsk_match xsk_match;
+	struct list_item resolve_list;
+	unsigned int resolve_pending; /* hosts not resolved yet */
+	unsigned int resolve_interval; /* ms */
+	struct {
+		struct timespec sent; /* time the last probe was sent */
+		bool pending; /* its result is not accounted yet */
+		bool replied;
+		unsigned int sent_count;
+		int64_t rtt_last; /* us */
+		int64_t rtt_avg; /* us */
+		int64_t rtt_jitter; /* us */
+		int64_t rtt_min; /* us, slowly follows rtt up */
+		uint64_t loss_history; /* bit set for each probe lost */
+		unsigned int loss_history_len;
+	} probe;
 };
 
 int __set_sockaddr(struct sockaddr *sa, socklen_t sa_len, sa_family_t family,
@@ -57,6 +176,8 @@ int teamd_link_watch_check_link_up(struct teamd_context *ctx,
 				   struct teamd_port *tdport,
 				   struct lw_common_port_priv *common_ppriv,
 				   bool new_link_up);
+int teamd_link_watch_check_health(struct teamd_context *ctx,
+				  struct lw_common_port_priv *common_ppriv);
 
 struct lw_psr_port_priv *
 lw_psr_ppriv_get(struct lw_common_port_priv *common_ppriv);
@@ -67,6 +188,12 @@ void lw_psr_port_removed(struct teamd_context *ctx, struct teamd_port *tdport,
 int lw_psr_state_interval_get(struct teamd_context *ctx,
 			      struct team_state_gsc *gsc,
 			      void *priv);
+int lw_psr_state_fast_interval_get(struct teamd_context *ctx,
+				   struct team_state_gsc *gsc,
+				   void *priv);
+int lw_psr_state_effective_interval_get(struct teamd_context *ctx,
+					struct team_state_gsc *gsc,
+					void *priv);
 int lw_psr_state_init_wait_get(struct teamd_context *ctx,
 			       struct team_state_gsc *gsc,
 			       void *priv);
@@ -76,5 +203,83 @@ int lw_psr_state_missed_max_get(struct teamd_context *ctx,
 int lw_psr_state_missed_get(struct teamd_context *ctx,
 			    struct team_state_gsc *gsc,
 			    void *priv);
+int lw_psr_state_probes_sent_get(struct teamd_context *ctx,
+				 struct team_state_gsc *gsc,
+				 void *priv);
+int lw_psr_state_rtt_last_get(struct teamd_context *ctx,
+			      struct team_state_gsc *gsc,
+			      void *priv);
+int lw_psr_state_rtt_avg_get(struct teamd_context *ctx,
+			     struct team_state_gsc *gsc,
+			     void *priv);
+int lw_psr_state_rtt_jitter_get(struct teamd_context *ctx,
+				struct team_state_gsc *gsc,
+				void *priv);
+int lw_psr_state_loss_percent_get(struct teamd_context *ctx,
+				  struct team_state_gsc *gsc,
+				  void *priv);
+unsigned int lw_psr_health_get(struct lw_common_port_priv *common_ppriv);
+void lw_psr_probe_sent(struct lw_psr_port_priv *psr_ppriv);
+void lw_psr_reply_received(struct lw_psr_port_priv *psr_ppriv,
+			   const struct timespec *ts);
+int lw_psr_resolve(struct teamd_context *ctx,
+		   struct lw_psr_port_priv *psr_ppriv, struct lw_resolve *res,
+		   int family, const char *hostname, void *addr);
+
+bool lw_rx_ring_enabled(struct teamd_context *ctx,
+			struct lw_psr_port_priv *psr_ppriv);
+int lw_rx_ring_subscribe(struct teamd_context *ctx,
+			 struct lw_psr_port_priv *psr_ppriv);
+void lw_rx_ring_unsubscribe(struct teamd_context *ctx,
+			    struct lw_psr_port_priv *psr_ppriv);
+int lw_tx_batch_subscribe(struct teamd_context *ctx,
+			  struct lw_psr_port_priv *psr_ppriv);
+void lw_tx_batch_unsubscribe(struct teamd_context *ctx,
+			     struct lw_psr_port_priv *psr_ppriv);
+int lw_tx_batch_queue(struct teamd_context *ctx,
+		      struct lw_psr_port_priv *psr_ppriv);
+#ifdef HAVE_LINUX_IF_XDP_H
+
+bool lw_xsk_enabled(struct teamd_context *ctx,
+		    struct lw_psr_port_priv *psr_ppriv);
+int lw_xsk_subscribe(struct teamd_context *ctx,
+		     struct lw_psr_port_priv *psr_ppriv);
+void lw_xsk_unsubscribe(struct teamd_context *ctx,
+			struct lw_psr_port_priv *psr_ppriv);
+int lw_xsk_send(struct teamd_context *ctx,
+		struct lw_psr_port_priv *psr_ppriv);
+
+#else
+
+static inline bool lw_xsk_enabled(struct teamd_context *ctx,
+				  struct lw_psr_port_priv *psr_ppriv)
+{
+	return false;
+}
+
+static inline int lw_xsk_subscribe(struct teamd_context *ctx,
+				   struct lw_psr_port_priv *psr_ppriv)
+{
+	return -EOPNOTSUPP;
+}
+
+static inline void lw_xsk_unsubscribe(struct teamd_context *ctx,
+				      struct lw_psr_port_priv *psr_ppriv)
+{
+}
+
+static inline int lw_xsk_send(struct teamd_context *ctx,
+			      struct lw_psr_port_priv *psr_ppriv)
+{
+	return -EOPNOTSUPP;
+}
+
+#endif /* HAVE_LINUX_IF_XDP_H */
+
+int lw_resolve_init(struct teamd_context *ctx, struct lw_resolve *res,
+		    int family, const char *hostname, void *addr,
+		    unsigned int interval, lw_resolve_changed_func_t changed,
+		    void *priv);
+void lw_resolve_fini(struct teamd_context *ctx, struct lw_resolve *res);
 
 #endif
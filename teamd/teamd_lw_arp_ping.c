@@ -29,15 +29,25 @@
 
 /*
  * ARP ping link watch
+ *
+ * More targets may be probed by one watcher. Link is then considered up
+ * in an interval in which at least "quorum" of them replied.
  */
 
+#define LW_AP_MAX_TARGETS 8
+
 struct lw_ap_port_priv {
 	union {
 		struct lw_common_port_priv common;
 		struct lw_psr_port_priv psr;
 	} start; /* must be first */
 	struct in_addr src;
-	struct in_addr dst;
+	struct in_addr dst[LW_AP_MAX_TARGETS];
+	struct lw_resolve src_res;
+	struct lw_resolve dst_res[LW_AP_MAX_TARGETS];
+	unsigned int dst_count;
+	unsigned int quorum;
+	unsigned int replied_mask; /* bit per target replied in interval */
 	bool validate_active;
 	bool validate_inactive;
 	bool send_always;
@@ -51,8 +61,20 @@ lw_ap_ppriv_get(struct lw_psr_port_priv *psr_ppriv)
 	return (struct lw_ap_port_priv *) psr_ppriv;
 }
 
+struct arp_packet {
+	struct arphdr			ah;
+	unsigned char			sender_mac[ETH_ALEN];
+	struct in_addr			sender_ip;
+	unsigned char			target_mac[ETH_ALEN];
+	struct in_addr			target_ip;
+} __attribute__((packed));
+
 #define OFFSET_ARP_OP_CODE					\
 	in_struct_offset(struct arphdr, ar_op)
+#define OFFSET_ARP_SENDER_IP					\
+	in_struct_offset(struct arp_packet, sender_ip)
+#define OFFSET_ARP_TARGET_IP					\
+	in_struct_offset(struct arp_packet, target_ip)
 
 static struct sock_filter arp_rpl_flt[] = {
 	BPF_STMT(BPF_LD + BPF_H + BPF_ABS, OFFSET_ARP_OP_CODE),
@@ -67,54 +89,6 @@ static const struct sock_fprog arp_rpl_fprog = {
 	.filter = arp_rpl_flt,
 };
 
-static struct sock_filter arp_novlan_rpl_flt[] = {
-	BPF_STMT(BPF_LD + BPF_B + BPF_ABS, SKF_AD_OFF + SKF_AD_VLAN_TAG_PRESENT),
-	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0, 0, 4),
-	BPF_STMT(BPF_LD + BPF_H + BPF_ABS, OFFSET_ARP_OP_CODE),
-	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ARPOP_REPLY, 1, 0),
-	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ARPOP_REQUEST, 0, 1),
-	BPF_STMT(BPF_RET + BPF_K, (u_int) -1),
-	BPF_STMT(BPF_RET + BPF_K, 0),
-};
-
-static const struct sock_fprog arp_novlan_rpl_fprog = {
-	.len = ARRAY_SIZE(arp_novlan_rpl_flt),
-	.filter = arp_novlan_rpl_flt,
-};
-
-static struct sock_filter arp_vlan_rpl_flt[] = {
-	BPF_STMT(BPF_LD + BPF_B + BPF_ABS, SKF_AD_OFF + SKF_AD_VLAN_TAG_PRESENT),
-	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0, 6, 0),
-	BPF_STMT(BPF_LD + BPF_B + BPF_ABS, SKF_AD_OFF + SKF_AD_VLAN_TAG),
-	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0xffff, 0, 4), /* 0xffff will be replaced by vland id */
-	BPF_STMT(BPF_LD + BPF_H + BPF_ABS, OFFSET_ARP_OP_CODE),
-	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ARPOP_REPLY, 1, 0),
-	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ARPOP_REQUEST, 0, 1),
-	BPF_STMT(BPF_RET + BPF_K, (u_int) -1),
-	BPF_STMT(BPF_RET + BPF_K, 0),
-};
-
-/* this hack replaces vlanid value in filter code */
-#define SET_FILTER_VLANID(fprog, vlanid) (fprog)->filter[3].k = vlanid
-
-static const struct sock_fprog arp_vlan_rpl_fprog = {
-	.len = ARRAY_SIZE(arp_vlan_rpl_flt),
-	.filter = arp_vlan_rpl_flt,
-};
-
-static int set_in_addr(struct in_addr *addr, const char *hostname)
-{
-	struct sockaddr_in sin;
-	int err;
-
-	err = __set_sockaddr((struct sockaddr *) &sin, sizeof(sin),
-			     AF_INET, hostname);
-	if (err)
-		return err;
-	memcpy(addr, &sin.sin_addr, sizeof(*addr));
-	return 0;
-}
-
 static char *str_in_addr(struct in_addr *addr)
 {
 	struct sockaddr_in sin;
@@ -125,24 +99,107 @@ static char *str_in_addr(struct in_addr *addr)
 			      buf, sizeof(buf));
 }
 
+static void flt_ld(struct sock_filter *flt, unsigned int *pc,
+		   uint16_t size, uint32_t k)
+{
+	flt[*pc] = (struct sock_filter) BPF_STMT(BPF_LD + size + BPF_ABS, k);
+	(*pc)++;
+}
+
+/* Jump targets are absolute instruction indexes here */
+static void flt_jeq(struct sock_filter *flt, unsigned int *pc, uint32_t k,
+		    unsigned int jt, unsigned int jf)
+{
+	flt[*pc] = (struct sock_filter) BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, k,
+						 jt - *pc - 1, jf - *pc - 1);
+	(*pc)++;
+}
+
+#define ARP_FLT_MAX_LEN (14 + 2 * LW_AP_MAX_TARGETS)
+
+/*
+ * Filter is built per watcher. Besides opcode it checks vlan (in case
+ * vlan_check is set) and, in case any target is configured, also sender
+ * and target addresses. That way unrelated ARP traffic on a busy segment
+ * does not wake us up, even if replies are not validated.
+ */
+static unsigned int arp_flt_build(struct lw_ap_port_priv *ap_ppriv,
+				  struct sock_filter *flt, bool vlan_check)
+{
+	bool ip_check = ap_ppriv->dst_count > 0;
+	unsigned int count = ap_ppriv->dst_count;
+	uint32_t src = ntohl(ap_ppriv->src.s_addr);
+	unsigned int ip_start;
+	unsigned int from_src;
+	unsigned int to_src;
+	unsigned int accept;
+	unsigned int drop;
+	unsigned int pc = 0;
+	unsigned int i;
+
+	ip_start = (vlan_check ? (ap_ppriv->vlanid_in_use ? 4 : 2) : 0) + 3;
+	accept = ip_start + (ip_check ? 5 + 2 * count : 0);
+	drop = accept + 1;
+	to_src = ip_start + 2 + count;
+	from_src = to_src + 2;
+
+	if (vlan_check) {
+		flt_ld(flt, &pc, BPF_B, SKF_AD_OFF + SKF_AD_VLAN_TAG_PRESENT);
+		if (ap_ppriv->vlanid_in_use) {
+			flt_jeq(flt, &pc, 0, drop, pc + 1);
+			flt_ld(flt, &pc, BPF_B, SKF_AD_OFF + SKF_AD_VLAN_TAG);
+			flt_jeq(flt, &pc, ap_ppriv->vlanid, pc + 1, drop);
+		} else {
+			flt_jeq(flt, &pc, 0, pc + 1, drop);
+		}
+	}
+	flt_ld(flt, &pc, BPF_H, OFFSET_ARP_OP_CODE);
+	flt_jeq(flt, &pc, ARPOP_REPLY, ip_start, pc + 1);
+	flt_jeq(flt, &pc, ARPOP_REQUEST, ip_start, drop);
+	if (ip_check) {
+		/*
+		 * Same as in lw_ap_target_match(), either direction between
+		 * source and any of targets matches.
+		 */
+		flt_ld(flt, &pc, BPF_W, OFFSET_ARP_SENDER_IP);
+		flt_jeq(flt, &pc, src, from_src, pc + 1);
+		for (i = 0; i < count; i++)
+			flt_jeq(flt, &pc, ntohl(ap_ppriv->dst[i].s_addr),
+				to_src, i == count - 1 ? drop : pc + 1);
+		flt_ld(flt, &pc, BPF_W, OFFSET_ARP_TARGET_IP);
+		flt_jeq(flt, &pc, src, accept, drop);
+		flt_ld(flt, &pc, BPF_W, OFFSET_ARP_TARGET_IP);
+		for (i = 0; i < count; i++)
+			flt_jeq(flt, &pc, ntohl(ap_ppriv->dst[i].s_addr),
+				accept, i == count - 1 ? drop : pc + 1);
+	}
+	flt[pc++] = (struct sock_filter) BPF_STMT(BPF_RET + BPF_K, (u_int) -1);
+	flt[pc++] = (struct sock_filter) BPF_STMT(BPF_RET + BPF_K, 0);
+	return pc;
+}
+
 static int lw_ap_sock_open(struct lw_psr_port_priv *psr_ppriv)
 {
 	struct lw_ap_port_priv *ap_ppriv = lw_ap_ppriv_get(psr_ppriv);
+	struct sock_filter flt[ARP_FLT_MAX_LEN];
+	struct sock_filter alt_flt[ARP_FLT_MAX_LEN];
 	struct sock_fprog fprog;
-	struct sock_filter arp_vlan_rpl_flt[ARRAY_SIZE(arp_vlan_rpl_flt)];
-
-	if (ap_ppriv->vlanid_in_use) {
-		memcpy(&arp_vlan_rpl_flt, arp_vlan_rpl_fprog.filter,
-		       sizeof(arp_vlan_rpl_flt));
-		fprog = arp_vlan_rpl_fprog;
-		fprog.filter = arp_vlan_rpl_flt;
-		SET_FILTER_VLANID(&fprog, ap_ppriv->vlanid);
-	} else {
-		fprog = arp_novlan_rpl_fprog;
-	}
+	struct sock_fprog alt_fprog;
+
+	/* Replies come from shared rx ring, socket is used for send only */
+	if (psr_ppriv->rx_ring)
+		return teamd_packet_sock_open(&psr_ppriv->sock,
+					      psr_ppriv->common.tdport->ifindex,
+					      0, NULL, NULL);
+
+	fprog.filter = flt;
+	fprog.len = arp_flt_build(ap_ppriv, flt, true);
+	/* For kernels which can not look at skb->vlan_tci from BPF */
+	alt_fprog.filter = alt_flt;
+	alt_fprog.len = arp_flt_build(ap_ppriv, alt_flt, false);
 	return teamd_packet_sock_open(&psr_ppriv->sock,
 				      psr_ppriv->common.tdport->ifindex,
-				      htons(ETH_P_ARP), &fprog, &arp_rpl_fprog);
+				      htons(ETH_P_ARP), &fprog, &alt_fprog);
 }
 
 static void lw_ap_sock_close(struct lw_psr_port_priv *psr_ppriv)
@@ -150,6 +207,103 @@ static void lw_ap_sock_close(struct lw_psr_port_priv *psr_ppriv)
 	close(psr_ppriv->sock);
 }
 
+static int lw_ap_load_target(struct teamd_context *ctx,
+			     struct lw_ap_port_priv *ap_ppriv,
+			     const char *host)
+{
+	struct in_addr *dst = &ap_ppriv->dst[ap_ppriv->dst_count];
+	int err;
+
+	err = lw_psr_resolve(ctx, &ap_ppriv->start.psr,
+			     &ap_ppriv->dst_res[ap_ppriv->dst_count],
+			     AF_INET, host, dst);
+	if (err)
+		return err;
+	teamd_log_dbg("target address \"%s\".", str_in_addr(dst));
+	ap_ppriv->dst_count++;
+	return 0;
+}
+
+static int lw_ap_load_quorum(struct teamd_context *ctx,
+			     struct lw_ap_port_priv *ap_ppriv,
+			     struct teamd_config_path_cookie *cpcookie)
+{
+	const char *quorum;
+	int tmp;
+	int err;
+
+	err = teamd_config_string_get(ctx, &quorum, "@.target_quorum",
+				      cpcookie);
+	if (!err) {
+		if (!strcmp(quorum, "any")) {
+			ap_ppriv->quorum = 1;
+		} else if (!strcmp(quorum, "all")) {
+			ap_ppriv->quorum = ap_ppriv->dst_count;
+		} else {
+			teamd_log_err("Unknown \"target_quorum\" value \"%s\".",
+				      quorum);
+			return -EINVAL;
+		}
+	} else {
+		err = teamd_config_int_get(ctx, &tmp, "@.target_quorum",
+					   cpcookie);
+		if (!err) {
+			if (tmp < 1 || tmp > ap_ppriv->dst_count) {
+				teamd_log_err("\"target_quorum\" must be in range 1-%u.",
+					      ap_ppriv->dst_count);
+				return -EINVAL;
+			}
+			ap_ppriv->quorum = tmp;
+		} else {
+			ap_ppriv->quorum = 1;
+		}
+	}
+	teamd_log_dbg("target_quorum \"%u\".", ap_ppriv->quorum);
+	return 0;
+}
+
+static int lw_ap_load_targets(struct teamd_context *ctx,
+			      struct lw_ap_port_priv *ap_ppriv,
+			      struct teamd_config_path_cookie *cpcookie)
+{
+	const char *host;
+	size_t count;
+	int err;
+	int i;
+
+	if (!teamd_config_path_is_arr(ctx, "@.target_host", cpcookie)) {
+		err = teamd_config_string_get(ctx, &host, "@.target_host",
+					      cpcookie);
+		if (err) {
+			teamd_log_err("Failed to get \"target_host\" link-watch option.");
+			return -EINVAL;
+		}
+		err = lw_ap_load_target(ctx, ap_ppriv, host);
+		if (err)
+			return err;
+		return lw_ap_load_quorum(ctx, ap_ppriv, cpcookie);
+	}
+
+	count = teamd_config_arr_size(ctx, "@.target_host", cpcookie);
+	if (!count || count > LW_AP_MAX_TARGETS) {
+		teamd_log_err("\"target_host\" must contain 1-%u hosts.",
+			      LW_AP_MAX_TARGETS);
+		return -EINVAL;
+	}
+	for (i = 0; i < count; i++) {
+		err = teamd_config_string_get(ctx, &host, "@.target_host[%d]",
+					      cpcookie, i);
+		if (err) {
+			teamd_log_err("Failed to get \"target_host\" link-watch option.");
+			return -EINVAL;
+		}
+		err = lw_ap_load_target(ctx, ap_ppriv, host);
+		if (err)
+			return err;
+	}
+	return lw_ap_load_quorum(ctx, ap_ppriv, cpcookie);
+}
+
 static int lw_ap_load_options(struct teamd_context *ctx,
 			      struct teamd_port *tdport,
 			      struct lw_psr_port_priv *psr_ppriv)
@@ -162,7 +316,8 @@ static int lw_ap_load_options(struct teamd_context *ctx,
 
 	err = teamd_config_string_get(ctx, &host, "@.source_host", cpcookie);
 	if (!err) {
-		err = set_in_addr(&ap_ppriv->src, host);
+		err = lw_psr_resolve(ctx, psr_ppriv, &ap_ppriv->src_res,
+				     AF_INET, host, &ap_ppriv->src);
 		if (err)
 			return err;
 	}
@@ -173,15 +328,9 @@ static int lw_ap_load_options(struct teamd_context *ctx,
 	teamd_log_dbg("source address \"%s\".",
 		      str_in_addr(&ap_ppriv->src));
 
-	err = teamd_config_string_get(ctx, &host, "@.target_host", cpcookie);
-	if (err) {
-		teamd_log_err("Failed to get \"target_host\" link-watch option.");
-		return -EINVAL;
-	}
-	err = set_in_addr(&ap_ppriv->dst, host);
+	err = lw_ap_load_targets(ctx, ap_ppriv, cpcookie);
 	if (err)
 		return err;
-	teamd_log_dbg("target address \"%s\".", str_in_addr(&ap_ppriv->dst));
 
 	err = teamd_config_bool_get(ctx, &ap_ppriv->validate_active,
 				    "@.validate_active", cpcookie);
@@ -212,6 +361,7 @@ static int lw_ap_load_options(struct teamd_context *ctx,
 		teamd_log_dbg("vlan id \"%u\".", ap_ppriv->vlanid);
 	}
 
+	psr_ppriv->probe_count = ap_ppriv->dst_count;
 	return 0;
 }
 
@@ -235,14 +385,6 @@ static int __get_port_curr_hwaddr(struct lw_psr_port_priv *psr_ppriv,
 	return 0;
 }
 
-struct arp_packet {
-	struct arphdr			ah;
-	unsigned char			sender_mac[ETH_ALEN];
-	struct in_addr			sender_ip;
-	unsigned char			target_mac[ETH_ALEN];
-	struct in_addr			target_ip;
-} __attribute__((packed));
-
 struct __vlan_hdr {
 	__be16 h_vlan_TCI;
 	__be16 h_vlan_encapsulated_proto;
@@ -253,22 +395,30 @@ struct arp_vlan_packet {
 	struct arp_packet		ap;
 } __attribute__((packed));
 
-static int lw_ap_send(struct lw_psr_port_priv *psr_ppriv)
+static int lw_ap_send_prepare(struct lw_psr_port_priv *psr_ppriv,
+			      struct lw_tx_batch_msg *msg, unsigned int index)
 {
 	struct lw_ap_port_priv *ap_ppriv = lw_ap_ppriv_get(psr_ppriv);
 	int err;
 	struct sockaddr_ll ll_my;
-	struct sockaddr_ll ll_bcast;
+	struct sockaddr_ll *ll_bcast = &msg->addr.ll;
 	struct arp_packet ap;
 
+	/* New interval starts with the first probe */
+	if (!index)
+		ap_ppriv->replied_mask = 0;
+	msg->len = 0;
 	if (!(psr_ppriv->common.forced_send || ap_ppriv->send_always))
 		return 0;
 
 	err = __get_port_curr_hwaddr(psr_ppriv, &ll_my, 0);
 	if (err)
 		return err;
-	ll_bcast = ll_my;
-	memset(ll_bcast.sll_addr, 0xFF, ll_bcast.sll_halen);
+	*ll_bcast = ll_my;
+	memset(ll_bcast->sll_addr, 0xFF, ll_bcast->sll_halen);
+	/* Socket bound without protocol does not provide one */
+	ll_bcast->sll_protocol = htons(ETH_P_ARP);
+	msg->addr_len = sizeof(*ll_bcast);
 
 	memset(&ap, 0, sizeof(ap));
 	ap.ah.ar_hrd = htons(ll_my.sll_hatype);
@@ -279,39 +429,81 @@ static int lw_ap_send(struct lw_psr_port_priv *psr_ppriv)
 
 	memcpy(ap.sender_mac, ll_my.sll_addr, sizeof(ap.sender_mac));
 	ap.sender_ip = ap_ppriv->src;
-	memcpy(ap.target_mac, ll_bcast.sll_addr, sizeof(ap.target_mac));
-	ap.target_ip = ap_ppriv->dst;
+	memcpy(ap.target_mac, ll_bcast->sll_addr, sizeof(ap.target_mac));
+	ap.target_ip = ap_ppriv->dst[index];
 
 	if (ap_ppriv->vlanid_in_use) {
 		struct arp_vlan_packet avp;
 		avp.ap = ap;
 		avp.vlanh.h_vlan_encapsulated_proto = htons(ETH_P_ARP);
 		avp.vlanh.h_vlan_TCI = htons(ap_ppriv->vlanid);
-		ll_bcast.sll_protocol = htons(ETH_P_8021Q);
-		return teamd_sendto(psr_ppriv->sock, &avp, sizeof(avp),
-				    0, (struct sockaddr *) &ll_bcast,
-				    sizeof(ll_bcast));
+		ll_bcast->sll_protocol = htons(ETH_P_8021Q);
+		memcpy(msg->buf, &avp, sizeof(avp));
+		msg->len = sizeof(avp);
 	} else {
-		return teamd_sendto(psr_ppriv->sock, &ap, sizeof(ap),
-				    0, (struct sockaddr *) &ll_bcast,
-				    sizeof(ll_bcast));
+		memcpy(msg->buf, &ap, sizeof(ap));
+		msg->len = sizeof(ap);
 	}
+	return 0;
 }
 
-static int lw_ap_receive(struct lw_psr_port_priv *psr_ppriv)
+static int lw_ap_send(struct lw_psr_port_priv *psr_ppriv)
+{
+	struct lw_ap_port_priv *ap_ppriv = lw_ap_ppriv_get(psr_ppriv);
+	struct lw_tx_batch_msg msg;
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < ap_ppriv->dst_count; i++) {
+		err = lw_ap_send_prepare(psr_ppriv, &msg, i);
+		if (err || !msg.len)
+			return err;
+		err = teamd_sendto(psr_ppriv->sock, msg.buf, msg.len, 0,
+				   &msg.addr.sa, msg.addr_len);
+		if (err)
+			return err;
+		lw_psr_probe_sent(psr_ppriv);
+	}
+	return 0;
+}
+
+static int lw_ap_tx_batch_sock_open(int *sock_p)
+{
+	/* Not bound, destination port is given by each message */
+	*sock_p = socket(PF_PACKET, SOCK_DGRAM, 0);
+	if (*sock_p == -1) {
+		teamd_log_err("Failed to create packet socket.");
+		return -errno;
+	}
+	return 0;
+}
+
+/* Returns index of target the packet is exchanged with, -1 if none */
+static int lw_ap_target_match(struct lw_ap_port_priv *ap_ppriv,
+			      const struct arp_packet *ap)
+{
+	unsigned int i;
+
+	for (i = 0; i < ap_ppriv->dst_count; i++) {
+		if ((ap_ppriv->src.s_addr == ap->target_ip.s_addr &&
+		     ap_ppriv->dst[i].s_addr == ap->sender_ip.s_addr) ||
+		    (ap_ppriv->dst[i].s_addr == ap->target_ip.s_addr &&
+		     ap_ppriv->src.s_addr == ap->sender_ip.s_addr))
+			return i;
+	}
+	return -1;
+}
+
+static int __lw_ap_receive(struct lw_psr_port_priv *psr_ppriv,
+			   const struct arp_packet *ap,
+			   const struct timespec *ts)
 {
 	struct lw_common_port_priv *common_ppriv = &psr_ppriv->common;
 	struct lw_ap_port_priv *ap_ppriv = lw_ap_ppriv_get(psr_ppriv);
 	int err;
 	struct sockaddr_ll ll_my;
-	struct sockaddr_ll ll_from;
-	struct arp_packet ap;
 	bool port_enabled;
-
-	err = teamd_recvfrom(psr_ppriv->sock, &ap, sizeof(ap), 0,
-			     (struct sockaddr *) &ll_from, sizeof(ll_from));
-	if (err <= 0)
-		return err;
+	int index;
 
 	err = teamd_port_enabled(common_ppriv->ctx, common_ppriv->tdport,
 				 &port_enabled);
@@ -324,30 +516,79 @@ static int lw_ap_receive(struct lw_psr_port_priv *psr_ppriv)
 		if (err)
 			return err;
 
-		if (ap.ah.ar_hrd != htons(ll_my.sll_hatype) ||
-		    ap.ah.ar_pro != htons(ETH_P_IP) ||
-		    ap.ah.ar_hln != ll_my.sll_halen ||
-		    ap.ah.ar_pln != 4) {
+		if (ap->ah.ar_hrd != htons(ll_my.sll_hatype) ||
+		    ap->ah.ar_pro != htons(ETH_P_IP) ||
+		    ap->ah.ar_hln != ll_my.sll_halen ||
+		    ap->ah.ar_pln != 4) {
 			return 0;
 		}
 
-		if ((ap_ppriv->src.s_addr != ap.target_ip.s_addr ||
-		     ap_ppriv->dst.s_addr != ap.sender_ip.s_addr) &&
-		    (ap_ppriv->dst.s_addr != ap.target_ip.s_addr ||
-		     ap_ppriv->src.s_addr != ap.sender_ip.s_addr))
+		index = lw_ap_target_match(ap_ppriv, ap);
+		if (index < 0)
+			return 0;
+		ap_ppriv->replied_mask |= 1 << index;
+		if (__builtin_popcount(ap_ppriv->replied_mask) <
+		    ap_ppriv->quorum)
 			return 0;
 	}
 
-	psr_ppriv->reply_received = true;
+	/*
+	 * Without validation any ARP packet between source_host and a target
+	 * counts as good reply, filters let no other through.
+	 */
+	lw_psr_reply_received(psr_ppriv, ts);
 	return 0;
 }
 
+static int lw_ap_receive(struct lw_psr_port_priv *psr_ppriv)
+{
+	int err;
+	struct sockaddr_ll ll_from;
+	struct arp_packet ap;
+	struct timespec ts;
+
+	err = teamd_recvfrom_ts(psr_ppriv->sock, &ap, sizeof(ap), 0,
+				(struct sockaddr *) &ll_from, sizeof(ll_from),
+				&ts);
+	if (err <= 0)
+		return err;
+	return __lw_ap_receive(psr_ppriv, &ap, &ts);
+}
+
+static void lw_ap_receive_frame(struct lw_psr_port_priv *psr_ppriv,
+				const void *buf, size_t len,
+				const struct sockaddr_ll *ll_from, int vlanid,
+				const struct timespec *ts)
+{
+	struct lw_ap_port_priv *ap_ppriv = lw_ap_ppriv_get(psr_ppriv);
+	struct arp_packet ap;
+
+	/*
+	 * Ring filter does not look at vlan nor addresses, that is done here
+	 * the same way as socket filter does.
+	 */
+	if (ap_ppriv->vlanid_in_use ? vlanid != ap_ppriv->vlanid : vlanid != -1)
+		return;
+	/* Same as short read from socket, missing bytes are zeroed */
+	memset(&ap, 0, sizeof(ap));
+	memcpy(&ap, buf, len < sizeof(ap) ? len : sizeof(ap));
+	if (ap_ppriv->dst_count && lw_ap_target_match(ap_ppriv, &ap) < 0)
+		return;
+	__lw_ap_receive(psr_ppriv, &ap, ts);
+}
+
 static const struct lw_psr_ops lw_psr_ops_ap = {
 	.sock_open		= lw_ap_sock_open,
 	.sock_close		= lw_ap_sock_close,
 	.load_options		= lw_ap_load_options,
 	.send			= lw_ap_send,
 	.receive		= lw_ap_receive,
+	.receive_frame		= lw_ap_receive_frame,
+	.proto_name		= "arp",
+	.rx_ring_protocol	= ETH_P_ARP,
+	.rx_ring_fprog		= &arp_rpl_fprog,
+	.send_prepare		= lw_ap_send_prepare,
+	.tx_batch_sock_open	= lw_ap_tx_batch_sock_open,
 };
 
 static int lw_ap_port_added(struct teamd_context *ctx,
@@ -381,7 +622,40 @@ static int lw_ap_state_target_host_get(struct teamd_context *ctx,
 	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
 	struct lw_ap_port_priv *ap_ppriv = lw_ap_ppriv_get(psr_ppriv);
 
-	gsc->data.str_val.ptr = str_in_addr(&ap_ppriv->dst);
+	static char buf[LW_AP_MAX_TARGETS * (INET_ADDRSTRLEN + 1)];
+	unsigned int i;
+
+	buf[0] = '\0';
+	for (i = 0; i < ap_ppriv->dst_count; i++) {
+		if (i)
+			strcat(buf, " ");
+		strcat(buf, str_in_addr(&ap_ppriv->dst[i]));
+	}
+	gsc->data.str_val.ptr = buf;
+	return 0;
+}
+
+static int lw_ap_state_target_quorum_get(struct teamd_context *ctx,
+					 struct team_state_gsc *gsc,
+					 void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+	struct lw_ap_port_priv *ap_ppriv = lw_ap_ppriv_get(psr_ppriv);
+
+	gsc->data.int_val = ap_ppriv->quorum;
+	return 0;
+}
+
+static int lw_ap_state_targets_replied_get(struct teamd_context *ctx,
+					   struct team_state_gsc *gsc,
+					   void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+	struct lw_ap_port_priv *ap_ppriv = lw_ap_ppriv_get(psr_ppriv);
+
+	gsc->data.int_val = __builtin_popcount(ap_ppriv->replied_mask);
 	return 0;
 }
 
@@ -432,11 +706,31 @@ static const struct teamd_state_val lw_ap_state_vals[] = {
 		.type = TEAMD_STATE_ITEM_TYPE_STRING,
 		.getter = lw_ap_state_target_host_get,
 	},
+	{
+		.subpath = "target_quorum",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_ap_state_target_quorum_get,
+	},
+	{
+		.subpath = "targets_replied",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_ap_state_targets_replied_get,
+	},
 	{
 		.subpath = "interval",
 		.type = TEAMD_STATE_ITEM_TYPE_INT,
 		.getter = lw_psr_state_interval_get,
 	},
+	{
+		.subpath = "fast_interval",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_fast_interval_get,
+	},
+	{
+		.subpath = "effective_interval",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_effective_interval_get,
+	},
 	{
 		.subpath = "init_wait",
 		.type = TEAMD_STATE_ITEM_TYPE_INT,
@@ -467,6 +761,31 @@ static const struct teamd_state_val lw_ap_state_vals[] = {
 		.type = TEAMD_STATE_ITEM_TYPE_INT,
 		.getter = lw_psr_state_missed_get,
 	},
+	{
+		.subpath = "probes_sent",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_probes_sent_get,
+	},
+	{
+		.subpath = "rtt_last",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_rtt_last_get,
+	},
+	{
+		.subpath = "rtt_avg",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_rtt_avg_get,
+	},
+	{
+		.subpath = "rtt_jitter",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_rtt_jitter_get,
+	},
+	{
+		.subpath = "loss_percent",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_loss_percent_get,
+	},
 };
 
 const struct teamd_link_watch teamd_link_watch_arp_ping = {
@@ -480,4 +799,5 @@ const struct teamd_link_watch teamd_link_watch_arp_ping = {
 		.fini		= lw_psr_port_removed,
 		.priv_size	= sizeof(struct lw_ap_port_priv),
 	},
+	.health_get		= lw_psr_health_get,
 };
@@ -0,0 +1,1005 @@
+/*
+ *   teamd_lw_bfd.c - Team port BFD link watcher
+ *   Copyright (C) 2026 libteam contributors
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <limits.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <linux/if_ether.h>
+#include <netdb.h>
+#include <private/misc.h>
+#include "teamd.h"
+#include "teamd_link_watch.h"
+#include "teamd_config.h"
+#include "teamd_realtime.h"
+
+/*
+ * BFD link watch, RFC 5880 asynchronous mode over single-hop IPv4 UDP
+ * (RFC 5881). No authentication, no echo function, no demand mode.
+ *
+ * Same as with ARP ping, IP stack would not pass packets received on
+ * inactive port to us, so control packets are received by packet socket
+ * bound to the port. They are also sent that way, with IP and UDP
+ * headers built here. Peer hwaddr is learned from its packets, until
+ * then packets are sent to broadcast hwaddr.
+ */
+
+#define BFD_UDP_PORT		3784
+#define BFD_UDP_SRC_PORT_MIN	49152
+#define BFD_VERSION		1
+#define BFD_TTL			255
+#define BFD_SLOW_TX_US		1000000
+#define BFD_SOCK_RETRY_INTERVAL	1000	/* ms */
+
+enum bfd_state {
+	BFD_STATE_ADMIN_DOWN,
+	BFD_STATE_DOWN,
+	BFD_STATE_INIT,
+	BFD_STATE_UP,
+};
+
+static const char *bfd_state_names[] = {
+	[BFD_STATE_ADMIN_DOWN]	= "admin_down",
+	[BFD_STATE_DOWN]	= "down",
+	[BFD_STATE_INIT]	= "init",
+	[BFD_STATE_UP]		= "up",
+};
+
+enum bfd_diag {
+	BFD_DIAG_NONE			= 0,
+	BFD_DIAG_DETECT_EXPIRED		= 1,
+	BFD_DIAG_NEIGHBOR_DOWN		= 3,
+};
+
+#define BFD_FLAG_POLL		0x20
+#define BFD_FLAG_FINAL		0x10
+#define BFD_FLAG_AUTH		0x04
+#define BFD_FLAG_MULTIPOINT	0x01
+
+struct bfd_ctrl {
+	uint8_t		vers_diag;
+	uint8_t		state_flags;
+	uint8_t		detect_mult;
+	uint8_t		length;
+	uint32_t	my_discr;
+	uint32_t	your_discr;
+	uint32_t	desired_min_tx;
+	uint32_t	required_min_rx;
+	uint32_t	required_min_echo_rx;
+} __attribute__((packed));
+
+#define BFD_VERSION_GET(vers_diag) ((vers_diag) >> 5)
+#define BFD_STATE_GET(state_flags) ((state_flags) >> 6)
+
+struct bfd_packet {
+	struct iphdr	iph;
+	struct udphdr	udph;
+	struct bfd_ctrl	ctrl;
+} __attribute__((packed));
+
+struct lw_bfd_port_priv {
+	struct lw_common_port_priv common; /* must be first */
+	struct in_addr src;
+	struct in_addr dst;
+	struct lw_resolve src_res;
+	struct lw_resolve dst_res;
+	unsigned int resolve_pending; /* hosts not resolved yet */
+	unsigned int resolve_interval; /* ms */
+	unsigned int desired_min_tx; /* us */
+	unsigned int required_min_rx; /* us */
+	unsigned int detect_mult;
+	int sock;
+	bool sock_opened;
+	struct teamd_workq sock_workq; /* retries failed socket reopen */
+	unsigned int seed;
+	struct sockaddr_ll ll_peer;
+	bool peer_hwaddr_known;
+	struct {
+		enum bfd_state state;
+		enum bfd_state remote_state;
+		enum bfd_diag diag;
+		uint32_t local_discr;
+		uint32_t remote_discr;
+		uint32_t remote_min_rx; /* us */
+		uint32_t remote_desired_min_tx; /* us */
+		uint8_t remote_detect_mult;
+		bool poll; /* poll sequence in progress */
+	} sess;
+};
+
+static struct lw_bfd_port_priv *
+lw_bfd_ppriv_get(struct lw_common_port_priv *common_ppriv)
+{
+	return (struct lw_bfd_port_priv *) common_ppriv;
+}
+
+static void us_to_timespec(struct timespec *ts, unsigned int us)
+{
+	ts->tv_sec = us / 1000000;
+	ts->tv_nsec = (us % 1000000) * 1000;
+}
+
+static char *str_in_addr(struct in_addr *addr)
+{
+	struct sockaddr_in sin;
+	static char buf[NI_MAXHOST];
+
+	memcpy(&sin.sin_addr, addr, sizeof(*addr));
+	return __str_sockaddr((struct sockaddr *) &sin, sizeof(sin), AF_INET,
+			      buf, sizeof(buf));
+}
+
+#define OFFSET_IP_TTL						\
+	in_struct_offset(struct iphdr, ttl)
+#define OFFSET_IP_PROTOCOL					\
+	in_struct_offset(struct iphdr, protocol)
+#define OFFSET_IP_SADDR						\
+	in_struct_offset(struct iphdr, saddr)
+#define OFFSET_UDP_DEST						\
+	in_struct_offset(struct udphdr, dest)
+
+static struct sock_filter bfd_flt[] = {
+	BPF_STMT(BPF_LD + BPF_B + BPF_ABS, OFFSET_IP_PROTOCOL),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IPPROTO_UDP, 0, 8),
+	BPF_STMT(BPF_LD + BPF_B + BPF_ABS, OFFSET_IP_TTL),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, BFD_TTL, 0, 6),
+	BPF_STMT(BPF_LD + BPF_W + BPF_ABS, OFFSET_IP_SADDR),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0xffffffff, 0, 4), /* peer address */
+	BPF_STMT(BPF_LDX + BPF_B + BPF_MSH, 0),
+	BPF_STMT(BPF_LD + BPF_H + BPF_IND, OFFSET_UDP_DEST),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, BFD_UDP_PORT, 0, 1),
+	BPF_STMT(BPF_RET + BPF_K, (u_int) -1),
+	BPF_STMT(BPF_RET + BPF_K, 0),
+};
+
+/* this replaces peer address in filter code */
+#define SET_FILTER_PEER_ADDR(fprog, addr) (fprog)->filter[5].k = ntohl(addr)
+
+static const struct sock_fprog bfd_fprog = {
+	.len = ARRAY_SIZE(bfd_flt),
+	.filter = bfd_flt,
+};
+
+static uint16_t ip_csum(const void *buf, size_t len)
+{
+	const uint16_t *ptr = buf;
+	uint32_t sum = 0;
+
+	for (; len > 1; len -= 2)
+		sum += *ptr++;
+	if (len)
+		sum += *(const uint8_t *) ptr;
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+static unsigned int lw_bfd_desired_min_tx(struct lw_bfd_port_priv *bfd_ppriv)
+{
+	/* RFC 5880 6.8.3: not faster than once per second while not up */
+	if (bfd_ppriv->sess.state != BFD_STATE_UP &&
+	    bfd_ppriv->desired_min_tx < BFD_SLOW_TX_US)
+		return BFD_SLOW_TX_US;
+	return bfd_ppriv->desired_min_tx;
+}
+
+static unsigned int lw_bfd_tx_interval(struct lw_bfd_port_priv *bfd_ppriv)
+{
+	unsigned int desired_min_tx = lw_bfd_desired_min_tx(bfd_ppriv);
+
+	if (desired_min_tx < bfd_ppriv->sess.remote_min_rx)
+		return bfd_ppriv->sess.remote_min_rx;
+	return desired_min_tx;
+}
+
+/* Longest detection time which fits timer setup in us */
+#define BFD_DETECT_TIME_MAX_US	UINT_MAX
+
+static unsigned int lw_bfd_detect_time(struct lw_bfd_port_priv *bfd_ppriv)
+{
+	uint64_t interval = bfd_ppriv->required_min_rx;
+	uint64_t detect_time;
+
+	if (interval < bfd_ppriv->sess.remote_desired_min_tx)
+		interval = bfd_ppriv->sess.remote_desired_min_tx;
+	/* Peer controls both factors, so the product may not fit */
+	detect_time = bfd_ppriv->sess.remote_detect_mult * interval;
+	if (detect_time > BFD_DETECT_TIME_MAX_US)
+		detect_time = BFD_DETECT_TIME_MAX_US;
+	return detect_time;
+}
+
+static int lw_bfd_send(struct lw_bfd_port_priv *bfd_ppriv, uint8_t flags)
+{
+	struct bfd_packet bp;
+	struct sockaddr_ll ll_dst;
+
+	memset(&bp, 0, sizeof(bp));
+	bp.iph.version = 4;
+	bp.iph.ihl = sizeof(bp.iph) >> 2;
+	bp.iph.tos = 0xc0; /* CS6, network control */
+	bp.iph.tot_len = htons(sizeof(bp));
+	bp.iph.ttl = BFD_TTL;
+	bp.iph.protocol = IPPROTO_UDP;
+	bp.iph.saddr = bfd_ppriv->src.s_addr;
+	bp.iph.daddr = bfd_ppriv->dst.s_addr;
+	bp.iph.check = ip_csum(&bp.iph, sizeof(bp.iph));
+
+	/* UDP checksum is optional for IPv4, so it is left out */
+	bp.udph.source = htons(BFD_UDP_SRC_PORT_MIN +
+			       bfd_ppriv->common.tdport->ifindex % 16384);
+	bp.udph.dest = htons(BFD_UDP_PORT);
+	bp.udph.len = htons(sizeof(bp.udph) + sizeof(bp.ctrl));
+
+	bp.ctrl.vers_diag = BFD_VERSION << 5 | bfd_ppriv->sess.diag;
+	bp.ctrl.state_flags = bfd_ppriv->sess.state << 6 | flags;
+	bp.ctrl.detect_mult = bfd_ppriv->detect_mult;
+	bp.ctrl.length = sizeof(bp.ctrl);
+	bp.ctrl.my_discr = htonl(bfd_ppriv->sess.local_discr);
+	bp.ctrl.your_discr = htonl(bfd_ppriv->sess.remote_discr);
+	bp.ctrl.desired_min_tx = htonl(lw_bfd_desired_min_tx(bfd_ppriv));
+	bp.ctrl.required_min_rx = htonl(bfd_ppriv->required_min_rx);
+
+	ll_dst = bfd_ppriv->ll_peer;
+	if (!bfd_ppriv->peer_hwaddr_known)
+		memset(ll_dst.sll_addr, 0xff, ll_dst.sll_halen);
+	return teamd_sendto(bfd_ppriv->sock, &bp, sizeof(bp), 0,
+			    (struct sockaddr *) &ll_dst, sizeof(ll_dst));
+}
+
+#define LW_BFD_TX_CB_NAME "lw_bfd_tx"
+#define LW_BFD_DETECT_CB_NAME "lw_bfd_detect"
+#define LW_BFD_SOCKET_CB_NAME "lw_bfd_socket"
+
+static void lw_bfd_tx_schedule(struct teamd_context *ctx,
+			       struct lw_bfd_port_priv *bfd_ppriv)
+{
+	unsigned int interval = lw_bfd_tx_interval(bfd_ppriv);
+	unsigned int jitter_max;
+	struct timespec ts;
+
+	/* RFC 5880 6.8.7: reduce interval by random 0-25% (10-25%) */
+	jitter_max = bfd_ppriv->detect_mult == 1 ? 16 : 26;
+	interval -= interval / 100 * (25 - rand_r(&bfd_ppriv->seed) %
+				      jitter_max);
+	us_to_timespec(&ts, interval);
+	teamd_loop_callback_timer_set(ctx, LW_BFD_TX_CB_NAME, bfd_ppriv,
+				      NULL, &ts);
+}
+
+static void lw_bfd_detect_schedule(struct teamd_context *ctx,
+				   struct lw_bfd_port_priv *bfd_ppriv)
+{
+	struct timespec ts;
+
+	us_to_timespec(&ts, lw_bfd_detect_time(bfd_ppriv));
+	teamd_loop_callback_timer_set(ctx, LW_BFD_DETECT_CB_NAME, bfd_ppriv,
+				      NULL, &ts);
+	teamd_loop_callback_enable(ctx, LW_BFD_DETECT_CB_NAME, bfd_ppriv);
+}
+
+static int lw_bfd_state_set(struct teamd_context *ctx,
+			    struct lw_bfd_port_priv *bfd_ppriv,
+			    enum bfd_state state, enum bfd_diag diag)
+{
+	struct lw_common_port_priv *common_ppriv = &bfd_ppriv->common;
+	enum bfd_state orig_state = bfd_ppriv->sess.state;
+
+	if (state == orig_state)
+		return 0;
+	bfd_ppriv->sess.state = state;
+	bfd_ppriv->sess.diag = diag;
+	if (state == BFD_STATE_DOWN) {
+		bfd_ppriv->sess.poll = false;
+		teamd_loop_callback_disable(ctx, LW_BFD_DETECT_CB_NAME,
+					    bfd_ppriv);
+	}
+	if (state == BFD_STATE_UP || orig_state == BFD_STATE_UP) {
+		/* Transmit rate changes, let the peer know */
+		bfd_ppriv->sess.poll = state == BFD_STATE_UP;
+		lw_bfd_tx_schedule(ctx, bfd_ppriv);
+	}
+	return teamd_link_watch_check_link_up(ctx, common_ppriv->tdport,
+					      common_ppriv,
+					      state == BFD_STATE_UP);
+}
+
+static int __lw_bfd_callback_tx(struct teamd_context *ctx, void *priv)
+{
+	struct lw_bfd_port_priv *bfd_ppriv = priv;
+	int err = 0;
+
+	/* Peer does not want any packets, or there is no way to send yet */
+	if (bfd_ppriv->sess.remote_min_rx && !bfd_ppriv->resolve_pending &&
+	    bfd_ppriv->sock_opened)
+		err = lw_bfd_send(bfd_ppriv,
+				  bfd_ppriv->sess.poll ? BFD_FLAG_POLL : 0);
+	lw_bfd_tx_schedule(ctx, bfd_ppriv);
+	return err;
+}
+
+static int lw_bfd_callback_tx(struct teamd_context *ctx, int events,
+			      void *priv)
+{
+	int err;
+
+	teamd_rt_noalloc_begin();
+	err = __lw_bfd_callback_tx(ctx, priv);
+	teamd_rt_noalloc_end();
+	return err;
+}
+
+static int lw_bfd_callback_detect(struct teamd_context *ctx, int events,
+				  void *priv)
+{
+	struct lw_bfd_port_priv *bfd_ppriv = priv;
+	struct teamd_port *tdport = bfd_ppriv->common.tdport;
+	int err;
+
+	teamd_rt_noalloc_begin();
+	teamd_log_dbg("%s: BFD detection time expired.", tdport->ifname);
+	bfd_ppriv->sess.remote_discr = 0;
+	err = lw_bfd_state_set(ctx, bfd_ppriv, BFD_STATE_DOWN,
+			       BFD_DIAG_DETECT_EXPIRED);
+	teamd_rt_noalloc_end();
+	return err;
+}
+
+static bool lw_bfd_packet_valid(struct lw_bfd_port_priv *bfd_ppriv,
+				const void *buf, size_t len,
+				const struct bfd_ctrl **pctrl)
+{
+	const struct iphdr *iph = buf;
+	const struct udphdr *udph;
+	const struct bfd_ctrl *ctrl;
+	size_t ihl;
+
+	if (len < sizeof(*iph))
+		return false;
+	ihl = iph->ihl << 2;
+	if (len < ihl + sizeof(*udph) + sizeof(*ctrl) ||
+	    iph->protocol != IPPROTO_UDP || iph->ttl != BFD_TTL ||
+	    iph->saddr != bfd_ppriv->dst.s_addr ||
+	    iph->daddr != bfd_ppriv->src.s_addr)
+		return false;
+	udph = buf + ihl;
+	if (udph->dest != htons(BFD_UDP_PORT))
+		return false;
+	ctrl = buf + ihl + sizeof(*udph);
+
+	/* RFC 5880 6.8.6 reception checks */
+	if (BFD_VERSION_GET(ctrl->vers_diag) != BFD_VERSION ||
+	    ctrl->length < sizeof(*ctrl) ||
+	    ctrl->length > len - ihl - sizeof(*udph) ||
+	    !ctrl->detect_mult ||
+	    ctrl->state_flags & (BFD_FLAG_MULTIPOINT | BFD_FLAG_AUTH) ||
+	    !ctrl->my_discr)
+		return false;
+	if (ctrl->your_discr) {
+		if (ntohl(ctrl->your_discr) != bfd_ppriv->sess.local_discr)
+			return false;
+	} else if (BFD_STATE_GET(ctrl->state_flags) != BFD_STATE_DOWN &&
+		   BFD_STATE_GET(ctrl->state_flags) != BFD_STATE_ADMIN_DOWN) {
+		return false;
+	}
+	*pctrl = ctrl;
+	return true;
+}
+
+static int __lw_bfd_callback_socket(struct teamd_context *ctx, void *priv)
+{
+	struct lw_bfd_port_priv *bfd_ppriv = priv;
+	const struct bfd_ctrl *ctrl;
+	struct sockaddr_ll ll_from;
+	enum bfd_state state = bfd_ppriv->sess.state;
+	enum bfd_state remote_state;
+	char buf[128];
+	int err;
+
+	err = teamd_recvfrom(bfd_ppriv->sock, buf, sizeof(buf), 0,
+			     (struct sockaddr *) &ll_from, sizeof(ll_from));
+	if (err <= 0)
+		return err;
+	if (!lw_bfd_packet_valid(bfd_ppriv, buf, err, &ctrl))
+		return 0;
+
+	if (ll_from.sll_halen == bfd_ppriv->ll_peer.sll_halen) {
+		memcpy(bfd_ppriv->ll_peer.sll_addr, ll_from.sll_addr,
+		       ll_from.sll_halen);
+		bfd_ppriv->peer_hwaddr_known = true;
+	}
+
+	remote_state = BFD_STATE_GET(ctrl->state_flags);
+	bfd_ppriv->sess.remote_discr = ntohl(ctrl->my_discr);
+	bfd_ppriv->sess.remote_state = remote_state;
+	bfd_ppriv->sess.remote_desired_min_tx = ntohl(ctrl->desired_min_tx);
+	bfd_ppriv->sess.remote_min_rx = ntohl(ctrl->required_min_rx);
+	bfd_ppriv->sess.remote_detect_mult = ctrl->detect_mult;
+	if (ctrl->state_flags & BFD_FLAG_FINAL)
+		bfd_ppriv->sess.poll = false;
+
+	if (remote_state == BFD_STATE_ADMIN_DOWN) {
+		if (state != BFD_STATE_DOWN)
+			state = BFD_STATE_DOWN;
+	} else if (state == BFD_STATE_DOWN) {
+		if (remote_state == BFD_STATE_DOWN)
+			state = BFD_STATE_INIT;
+		else if (remote_state == BFD_STATE_INIT)
+			state = BFD_STATE_UP;
+	} else if (state == BFD_STATE_INIT) {
+		if (remote_state == BFD_STATE_INIT ||
+		    remote_state == BFD_STATE_UP)
+			state = BFD_STATE_UP;
+	} else if (state == BFD_STATE_UP) {
+		if (remote_state == BFD_STATE_DOWN)
+			state = BFD_STATE_DOWN;
+	}
+	err = lw_bfd_state_set(ctx, bfd_ppriv, state,
+			       state == BFD_STATE_DOWN ?
+			       BFD_DIAG_NEIGHBOR_DOWN : BFD_DIAG_NONE);
+	if (err)
+		return err;
+
+	if (state == BFD_STATE_INIT || state == BFD_STATE_UP)
+		lw_bfd_detect_schedule(ctx, bfd_ppriv);
+
+	/* Poll has to be answered right away */
+	if (ctrl->state_flags & BFD_FLAG_POLL)
+		return lw_bfd_send(bfd_ppriv, BFD_FLAG_FINAL);
+	return 0;
+}
+
+static int lw_bfd_callback_socket(struct teamd_context *ctx, int events,
+				  void *priv)
+{
+	int err;
+
+	teamd_rt_noalloc_begin();
+	err = __lw_bfd_callback_socket(ctx, priv);
+	teamd_rt_noalloc_end();
+	return err;
+}
+
+static int lw_bfd_load_interval(struct teamd_context *ctx,
+				struct teamd_config_path_cookie *cpcookie,
+				unsigned int *interval, const char *name,
+				int default_val)
+{
+	int err;
+	int tmp;
+
+	err = teamd_config_int_get(ctx, &tmp, "@.%s", cpcookie, name);
+	if (err) {
+		tmp = default_val;
+	} else if (tmp <= 0 || tmp > 4000) {
+		teamd_log_err("\"%s\" must be in range 1-4000.", name);
+		return -EINVAL;
+	}
+	teamd_log_dbg("%s \"%d\".", name, tmp);
+	*interval = tmp * 1000;
+	return 0;
+}
+
+#define LW_BFD_DEFAULT_INTERVAL 50
+#define LW_BFD_DEFAULT_DETECT_MULT 3
+#define LW_BFD_DEFAULT_RESOLVE_INTERVAL 300000 /* ms */
+
+static int lw_bfd_resolve_changed(struct teamd_context *ctx,
+				  struct lw_resolve *res, bool first);
+
+/*
+ * Host names which are not address literals are resolved in background.
+ * Until both of them are, no packets are sent and session stays down.
+ */
+static int lw_bfd_resolve(struct teamd_context *ctx,
+			  struct lw_bfd_port_priv *bfd_ppriv,
+			  struct lw_resolve *res, const char *hostname,
+			  struct in_addr *addr)
+{
+	int err;
+
+	err = lw_resolve_init(ctx, res, AF_INET, hostname, addr,
+			      bfd_ppriv->resolve_interval,
+			      lw_bfd_resolve_changed, bfd_ppriv);
+	if (err)
+		return err;
+	if (!res->resolved)
+		bfd_ppriv->resolve_pending++;
+	return 0;
+}
+
+static void lw_bfd_resolve_fini(struct teamd_context *ctx,
+				struct lw_bfd_port_priv *bfd_ppriv)
+{
+	lw_resolve_fini(ctx, &bfd_ppriv->dst_res);
+	lw_resolve_fini(ctx, &bfd_ppriv->src_res);
+}
+
+static int lw_bfd_load_options(struct teamd_context *ctx,
+			       struct teamd_port *tdport,
+			       struct lw_bfd_port_priv *bfd_ppriv)
+{
+	struct teamd_config_path_cookie *cpcookie = bfd_ppriv->common.cpcookie;
+	const char *host;
+	int tmp;
+	int err;
+
+	err = teamd_config_int_get(ctx, &tmp, "@.resolve_interval", cpcookie);
+	if (!err) {
+		if (tmp < 0) {
+			teamd_log_err("\"resolve_interval\" must not be negative number.");
+			return -EINVAL;
+		}
+	} else {
+		tmp = LW_BFD_DEFAULT_RESOLVE_INTERVAL;
+	}
+	teamd_log_dbg("resolve_interval \"%d\".", tmp);
+	bfd_ppriv->resolve_interval = tmp;
+
+	err = teamd_config_string_get(ctx, &host, "@.source_host", cpcookie);
+	if (err) {
+		teamd_log_err("Failed to get \"source_host\" link-watch option.");
+		return -EINVAL;
+	}
+	err = lw_bfd_resolve(ctx, bfd_ppriv, &bfd_ppriv->src_res, host,
+			     &bfd_ppriv->src);
+	if (err)
+		return err;
+	teamd_log_dbg("source host \"%s\".", host);
+
+	err = teamd_config_string_get(ctx, &host, "@.target_host", cpcookie);
+	if (err) {
+		teamd_log_err("Failed to get \"target_host\" link-watch option.");
+		return -EINVAL;
+	}
+	err = lw_bfd_resolve(ctx, bfd_ppriv, &bfd_ppriv->dst_res, host,
+			     &bfd_ppriv->dst);
+	if (err)
+		return err;
+	teamd_log_dbg("target host \"%s\".", host);
+
+	err = lw_bfd_load_interval(ctx, cpcookie, &bfd_ppriv->desired_min_tx,
+				   "desired_min_tx", LW_BFD_DEFAULT_INTERVAL);
+	if (err)
+		return err;
+	err = lw_bfd_load_interval(ctx, cpcookie, &bfd_ppriv->required_min_rx,
+				   "required_min_rx", LW_BFD_DEFAULT_INTERVAL);
+	if (err)
+		return err;
+
+	err = teamd_config_int_get(ctx, &tmp, "@.detect_mult", cpcookie);
+	if (err) {
+		tmp = LW_BFD_DEFAULT_DETECT_MULT;
+	} else if (tmp < 1 || tmp > 255) {
+		teamd_log_err("\"detect_mult\" must be in range 1-255.");
+		return -EINVAL;
+	}
+	teamd_log_dbg("detect_mult \"%d\".", tmp);
+	bfd_ppriv->detect_mult = tmp;
+	return 0;
+}
+
+static int lw_bfd_sock_open(struct lw_bfd_port_priv *bfd_ppriv)
+{
+	struct sock_filter bfd_flt[ARRAY_SIZE(bfd_flt)];
+	struct sock_fprog fprog;
+	int err;
+
+	memcpy(&bfd_flt, bfd_fprog.filter, sizeof(bfd_flt));
+	fprog = bfd_fprog;
+	fprog.filter = bfd_flt;
+	SET_FILTER_PEER_ADDR(&fprog, bfd_ppriv->dst.s_addr);
+	err = teamd_packet_sock_open(&bfd_ppriv->sock,
+				     bfd_ppriv->common.tdport->ifindex,
+				     htons(ETH_P_IP), &fprog, NULL);
+	if (err)
+		return err;
+	err = teamd_getsockname_hwaddr(bfd_ppriv->sock, &bfd_ppriv->ll_peer, 0);
+	if (err)
+		goto close_sock;
+	if (bfd_ppriv->ll_peer.sll_halen > sizeof(bfd_ppriv->ll_peer.sll_addr)) {
+		err = -ENOTSUP;
+		goto close_sock;
+	}
+	return 0;
+
+close_sock:
+	close(bfd_ppriv->sock);
+	return err;
+}
+
+static int lw_bfd_sock_init(struct teamd_context *ctx,
+			    struct lw_bfd_port_priv *bfd_ppriv)
+{
+	int err;
+
+	err = lw_bfd_sock_open(bfd_ppriv);
+	if (err) {
+		teamd_log_err("Failed to create socket.");
+		return err;
+	}
+	err = teamd_loop_callback_fd_add(ctx, LW_BFD_SOCKET_CB_NAME, bfd_ppriv,
+					 lw_bfd_callback_socket,
+					 bfd_ppriv->sock,
+					 TEAMD_LOOP_FD_EVENT_READ,
+					 TEAMD_LOOP_PRIO_LINK_WATCH);
+	if (err) {
+		teamd_log_err("Failed add socket callback.");
+		close(bfd_ppriv->sock);
+		return err;
+	}
+	bfd_ppriv->sock_opened = true;
+	return 0;
+}
+
+static void lw_bfd_sock_fini(struct teamd_context *ctx,
+			     struct lw_bfd_port_priv *bfd_ppriv)
+{
+	if (!bfd_ppriv->sock_opened)
+		return;
+	teamd_loop_callback_del(ctx, LW_BFD_SOCKET_CB_NAME, bfd_ppriv);
+	close(bfd_ppriv->sock);
+	bfd_ppriv->sock_opened = false;
+}
+
+/*
+ * In case socket can not be opened again, no packets are sent and session
+ * goes down. Opening is retried until it succeeds.
+ */
+static int lw_bfd_sock_reopen(struct teamd_context *ctx,
+			      struct lw_bfd_port_priv *bfd_ppriv)
+{
+	struct teamd_port *tdport = bfd_ppriv->common.tdport;
+	int err;
+
+	lw_bfd_sock_fini(ctx, bfd_ppriv);
+	err = lw_bfd_sock_init(ctx, bfd_ppriv);
+	if (err) {
+		teamd_log_warn("%s: Failed to reopen socket, retrying.",
+			       tdport->ifname);
+		teamd_workq_schedule_delayed(ctx, &bfd_ppriv->sock_workq,
+					     BFD_SOCK_RETRY_INTERVAL);
+		return 0;
+	}
+	teamd_loop_callback_enable(ctx, LW_BFD_SOCKET_CB_NAME, bfd_ppriv);
+	return 0;
+}
+
+static int lw_bfd_sock_work(struct teamd_context *ctx,
+			    struct teamd_workq *workq)
+{
+	struct lw_bfd_port_priv *bfd_ppriv;
+
+	bfd_ppriv = get_container(workq, struct lw_bfd_port_priv, sock_workq);
+	return lw_bfd_sock_reopen(ctx, bfd_ppriv);
+}
+
+/*
+ * Socket filter matches on peer address, so socket is opened again once
+ * it changes. Session with the former peer is over.
+ */
+static int lw_bfd_resolve_changed(struct teamd_context *ctx,
+				  struct lw_resolve *res, bool first)
+{
+	struct lw_bfd_port_priv *bfd_ppriv = res->priv;
+	int err;
+
+	if (first)
+		bfd_ppriv->resolve_pending--;
+	if (res != &bfd_ppriv->dst_res)
+		return 0;
+	teamd_workq_cancel_work(ctx, &bfd_ppriv->sock_workq);
+	err = lw_bfd_sock_reopen(ctx, bfd_ppriv);
+	if (err)
+		return err;
+	bfd_ppriv->peer_hwaddr_known = false;
+	bfd_ppriv->sess.remote_discr = 0;
+	bfd_ppriv->sess.remote_min_rx = 1;
+	return lw_bfd_state_set(ctx, bfd_ppriv, BFD_STATE_DOWN,
+				BFD_DIAG_NONE);
+}
+
+static void lw_bfd_sess_init(struct lw_bfd_port_priv *bfd_ppriv)
+{
+	uint32_t ifindex = bfd_ppriv->common.tdport->ifindex;
+
+	bfd_ppriv->seed = time(NULL) ^ getpid() ^ ifindex;
+	/* Discriminator has to be nonzero and unique among sessions */
+	bfd_ppriv->sess.local_discr = ((uint32_t) rand_r(&bfd_ppriv->seed) << 16) ^
+				      ifindex;
+	if (!bfd_ppriv->sess.local_discr)
+		bfd_ppriv->sess.local_discr = 1;
+	bfd_ppriv->sess.state = BFD_STATE_DOWN;
+	bfd_ppriv->sess.remote_state = BFD_STATE_DOWN;
+	bfd_ppriv->sess.diag = BFD_DIAG_NONE;
+	bfd_ppriv->sess.remote_discr = 0;
+	bfd_ppriv->sess.remote_min_rx = 1;
+	bfd_ppriv->sess.remote_desired_min_tx = 0;
+	bfd_ppriv->sess.remote_detect_mult = 0;
+	bfd_ppriv->sess.poll = false;
+
+	bfd_ppriv->ll_peer.sll_family = AF_PACKET;
+	bfd_ppriv->ll_peer.sll_protocol = htons(ETH_P_IP);
+	bfd_ppriv->ll_peer.sll_ifindex = ifindex;
+	bfd_ppriv->peer_hwaddr_known = false;
+}
+
+static int lw_bfd_port_added(struct teamd_context *ctx,
+			     struct teamd_port *tdport,
+			     void *priv, void *creator_priv)
+{
+	struct lw_bfd_port_priv *bfd_ppriv = priv;
+	int err;
+
+	teamd_workq_init_work(&bfd_ppriv->sock_workq, lw_bfd_sock_work);
+	err = lw_bfd_load_options(ctx, tdport, bfd_ppriv);
+	if (err) {
+		teamd_log_err("Failed to load options.");
+		goto resolve_fini;
+	}
+
+	err = lw_bfd_sock_init(ctx, bfd_ppriv);
+	if (err)
+		goto resolve_fini;
+	lw_bfd_sess_init(bfd_ppriv);
+
+	err = teamd_loop_callback_timer_add(ctx, LW_BFD_TX_CB_NAME, bfd_ppriv,
+					    lw_bfd_callback_tx,
+					    TEAMD_LOOP_PRIO_LINK_WATCH);
+	if (err) {
+		teamd_log_err("Failed add tx callback timer");
+		goto socket_fini;
+	}
+
+	err = teamd_loop_callback_timer_add(ctx, LW_BFD_DETECT_CB_NAME,
+					    bfd_ppriv, lw_bfd_callback_detect,
+					    TEAMD_LOOP_PRIO_LINK_WATCH);
+	if (err) {
+		teamd_log_err("Failed add detect callback timer");
+		goto tx_callback_del;
+	}
+
+	err = team_set_port_user_linkup_enabled(ctx->th, tdport->ifindex, true);
+	if (err) {
+		teamd_log_err("%s: Failed to enable user linkup.",
+			      tdport->ifname);
+		goto detect_callback_del;
+	}
+
+	teamd_loop_callback_enable(ctx, LW_BFD_SOCKET_CB_NAME, bfd_ppriv);
+	/* First packet goes out right away */
+	teamd_loop_callback_timer_set(ctx, LW_BFD_TX_CB_NAME, bfd_ppriv,
+				      NULL, NULL);
+	teamd_loop_callback_enable(ctx, LW_BFD_TX_CB_NAME, bfd_ppriv);
+	return 0;
+
+detect_callback_del:
+	teamd_loop_callback_del(ctx, LW_BFD_DETECT_CB_NAME, bfd_ppriv);
+tx_callback_del:
+	teamd_loop_callback_del(ctx, LW_BFD_TX_CB_NAME, bfd_ppriv);
+socket_fini:
+	lw_bfd_sock_fini(ctx, bfd_ppriv);
+resolve_fini:
+	lw_bfd_resolve_fini(ctx, bfd_ppriv);
+	return err;
+}
+
+static void lw_bfd_port_removed(struct teamd_context *ctx,
+				struct teamd_port *tdport,
+				void *priv, void *creator_priv)
+{
+	struct lw_bfd_port_priv *bfd_ppriv = priv;
+
+	/* Let the peer know right away instead of waiting for timeout */
+	bfd_ppriv->sess.state = BFD_STATE_ADMIN_DOWN;
+	bfd_ppriv->sess.diag = BFD_DIAG_NONE;
+	if (!bfd_ppriv->resolve_pending && bfd_ppriv->sock_opened)
+		lw_bfd_send(bfd_ppriv, 0);
+
+	teamd_loop_callback_del(ctx, LW_BFD_DETECT_CB_NAME, bfd_ppriv);
+	teamd_loop_callback_del(ctx, LW_BFD_TX_CB_NAME, bfd_ppriv);
+	teamd_workq_cancel_work(ctx, &bfd_ppriv->sock_workq);
+	lw_bfd_sock_fini(ctx, bfd_ppriv);
+	lw_bfd_resolve_fini(ctx, bfd_ppriv);
+}
+
+static int lw_bfd_state_source_host_get(struct teamd_context *ctx,
+					struct team_state_gsc *gsc,
+					void *priv)
+{
+	struct lw_bfd_port_priv *bfd_ppriv = lw_bfd_ppriv_get(priv);
+
+	gsc->data.str_val.ptr = str_in_addr(&bfd_ppriv->src);
+	return 0;
+}
+
+static int lw_bfd_state_target_host_get(struct teamd_context *ctx,
+					struct team_state_gsc *gsc,
+					void *priv)
+{
+	struct lw_bfd_port_priv *bfd_ppriv = lw_bfd_ppriv_get(priv);
+
+	gsc->data.str_val.ptr = str_in_addr(&bfd_ppriv->dst);
+	return 0;
+}
+
+static int lw_bfd_state_desired_min_tx_get(struct teamd_context *ctx,
+					   struct team_state_gsc *gsc,
+					   void *priv)
+{
+	struct lw_bfd_port_priv *bfd_ppriv = lw_bfd_ppriv_get(priv);
+
+	gsc->data.int_val = bfd_ppriv->desired_min_tx / 1000;
+	return 0;
+}
+
+static int lw_bfd_state_required_min_rx_get(struct teamd_context *ctx,
+					    struct team_state_gsc *gsc,
+					    void *priv)
+{
+	struct lw_bfd_port_priv *bfd_ppriv = lw_bfd_ppriv_get(priv);
+
+	gsc->data.int_val = bfd_ppriv->required_min_rx / 1000;
+	return 0;
+}
+
+static int lw_bfd_state_detect_mult_get(struct teamd_context *ctx,
+					struct team_state_gsc *gsc,
+					void *priv)
+{
+	struct lw_bfd_port_priv *bfd_ppriv = lw_bfd_ppriv_get(priv);
+
+	gsc->data.int_val = bfd_ppriv->detect_mult;
+	return 0;
+}
+
+static int lw_bfd_state_session_state_get(struct teamd_context *ctx,
+					  struct team_state_gsc *gsc,
+					  void *priv)
+{
+	struct lw_bfd_port_priv *bfd_ppriv = lw_bfd_ppriv_get(priv);
+
+	gsc->data.str_val.ptr = bfd_state_names[bfd_ppriv->sess.state];
+	return 0;
+}
+
+static int lw_bfd_state_remote_session_state_get(struct teamd_context *ctx,
+						 struct team_state_gsc *gsc,
+						 void *priv)
+{
+	struct lw_bfd_port_priv *bfd_ppriv = lw_bfd_ppriv_get(priv);
+
+	gsc->data.str_val.ptr = bfd_state_names[bfd_ppriv->sess.remote_state];
+	return 0;
+}
+
+static int lw_bfd_state_diag_get(struct teamd_context *ctx,
+				 struct team_state_gsc *gsc,
+				 void *priv)
+{
+	struct lw_bfd_port_priv *bfd_ppriv = lw_bfd_ppriv_get(priv);
+
+	gsc->data.int_val = bfd_ppriv->sess.diag;
+	return 0;
+}
+
+static int lw_bfd_state_local_discr_get(struct teamd_context *ctx,
+					struct team_state_gsc *gsc,
+					void *priv)
+{
+	struct lw_bfd_port_priv *bfd_ppriv = lw_bfd_ppriv_get(priv);
+
+	gsc->data.int_val = bfd_ppriv->sess.local_discr;
+	return 0;
+}
+
+static int lw_bfd_state_remote_discr_get(struct teamd_context *ctx,
+					 struct team_state_gsc *gsc,
+					 void *priv)
+{
+	struct lw_bfd_port_priv *bfd_ppriv = lw_bfd_ppriv_get(priv);
+
+	gsc->data.int_val = bfd_ppriv->sess.remote_discr;
+	return 0;
+}
+
+static int lw_bfd_state_detection_time_get(struct teamd_context *ctx,
+					   struct team_state_gsc *gsc,
+					   void *priv)
+{
+	struct lw_bfd_port_priv *bfd_ppriv = lw_bfd_ppriv_get(priv);
+
+	gsc->data.int_val = lw_bfd_detect_time(bfd_ppriv) / 1000;
+	return 0;
+}
+
+static const struct teamd_state_val lw_bfd_state_vals[] = {
+	{
+		.subpath = "source_host",
+		.type = TEAMD_STATE_ITEM_TYPE_STRING,
+		.getter = lw_bfd_state_source_host_get,
+	},
+	{
+		.subpath = "target_host",
+		.type = TEAMD_STATE_ITEM_TYPE_STRING,
+		.getter = lw_bfd_state_target_host_get,
+	},
+	{
+		.subpath = "desired_min_tx",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_bfd_state_desired_min_tx_get,
+	},
+	{
+		.subpath = "required_min_rx",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_bfd_state_required_min_rx_get,
+	},
+	{
+		.subpath = "detect_mult",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_bfd_state_detect_mult_get,
+	},
+	{
+		.subpath = "session_state",
+		.type = TEAMD_STATE_ITEM_TYPE_STRING,
+		.getter = lw_bfd_state_session_state_get,
+	},
+	{
+		.subpath = "remote_session_state",
+		.type = TEAMD_STATE_ITEM_TYPE_STRING,
+		.getter = lw_bfd_state_remote_session_state_get,
+	},
+	{
+		.subpath = "diag",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_bfd_state_diag_get,
+	},
+	{
+		.subpath = "local_discriminator",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_bfd_state_local_discr_get,
+	},
+	{
+		.subpath = "remote_discriminator",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_bfd_state_remote_discr_get,
+	},
+	{
+		.subpath = "detection_time",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_bfd_state_detection_time_get,
+	},
+};
+
+const struct teamd_link_watch teamd_link_watch_bfd = {
+	.name			= "bfd",
+	.state_vg		= {
+		.vals		= lw_bfd_state_vals,
+		.vals_count	= ARRAY_SIZE(lw_bfd_state_vals),
+	},
+	.port_priv = {
+		.init		= lw_bfd_port_added,
+		.fini		= lw_bfd_port_removed,
+		.priv_size	= sizeof(struct lw_bfd_port_priv),
+	},
+};
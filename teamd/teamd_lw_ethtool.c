@@ -146,7 +146,8 @@ static int lw_ethtool_port_added(struct teamd_context *ctx,
 		return err;
 	}
 	err = teamd_loop_callback_timer_add(ctx, LW_ETHTOOL_DELAY_CB_NAME,
-					    priv, lw_ethtool_callback_delay);
+					    priv, lw_ethtool_callback_delay,
+					    TEAMD_LOOP_PRIO_LINK_WATCH);
 	if (err) {
 		teamd_log_err("Failed add delay callback timer");
 		return err;
@@ -0,0 +1,819 @@
+/*
+ *   teamd_lw_icmp_ping.c - Team port ICMP echo ping link watcher
+ *   Copyright (C) 2026 libteam contributors
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/ip6.h>
+#include <netinet/icmp6.h>
+#include <netinet/ether.h>
+#include <linux/if_ether.h>
+#include <netdb.h>
+#include <private/misc.h>
+#include "teamd.h"
+#include "teamd_link_watch.h"
+#include "teamd_config.h"
+
+/*
+ * ICMP echo ping link watch, IPv4 or IPv6
+ *
+ * IP stack would not pass replies received on inactive port to us and it
+ * would not send through a port either, as ports have no addresses and
+ * neighbours are not resolved on them. So echo requests are sent and
+ * replies are received by packet socket bound to the port, with IP
+ * headers built here. Target hwaddr is either configured or learned from
+ * replies, until then requests are sent to broadcast hwaddr.
+ *
+ * Replies are matched by identifier, which is unique per watcher, and
+ * by sequence number of the last request sent, so late replies are not
+ * counted and RTT is exact.
+ */
+
+#define ICMPP_TTL	64
+
+union icmpp_addr {
+	struct sockaddr sa;
+	struct sockaddr_in sin;
+	struct sockaddr_in6 sin6;
+};
+
+struct lw_icmpp_port_priv {
+	union {
+		struct lw_common_port_priv common;
+		struct lw_psr_port_priv psr;
+	} start; /* must be first */
+	int family;
+	union icmpp_addr src;
+	union icmpp_addr dst;
+	struct lw_resolve src_res;
+	struct lw_resolve dst_res;
+	bool send_always;
+	struct sockaddr_ll ll_dst;
+	bool dst_hwaddr_known;
+	bool dst_hwaddr_static;
+	uint16_t id;
+	uint16_t seq; /* of the last request sent */
+	unsigned int replies_late; /* replies to earlier requests */
+};
+
+static struct lw_icmpp_port_priv *
+lw_icmpp_ppriv_get(struct lw_psr_port_priv *psr_ppriv)
+{
+	return (struct lw_icmpp_port_priv *) psr_ppriv;
+}
+
+struct icmpp_packet {
+	struct iphdr			iph;
+	struct icmphdr			icmph;
+} __attribute__((packed));
+
+struct icmpp6_packet {
+	struct ip6_hdr			ip6h;
+	struct icmp6_hdr		icmp6h;
+} __attribute__((packed));
+
+static socklen_t icmpp_addr_len(int family)
+{
+	return family == AF_INET ? sizeof(struct sockaddr_in) :
+				   sizeof(struct sockaddr_in6);
+}
+
+/*
+ * Family has to be known before target is resolved, it is taken from host
+ * given as IPv6 address literal. IPv4 is used otherwise.
+ */
+static int icmpp_family_get(const char *source_host, const char *target_host)
+{
+	struct in6_addr addr;
+
+	if (inet_pton(AF_INET6, source_host, &addr) == 1 ||
+	    inet_pton(AF_INET6, target_host, &addr) == 1)
+		return AF_INET6;
+	return AF_INET;
+}
+
+static void *icmpp_addr_ptr(union icmpp_addr *addr, int family)
+{
+	addr->sa.sa_family = family;
+	if (family == AF_INET)
+		return &addr->sin.sin_addr;
+	return &addr->sin6.sin6_addr;
+}
+
+static char *icmpp_addr_str(union icmpp_addr *addr, int family)
+{
+	static char buf[NI_MAXHOST];
+
+	return __str_sockaddr(&addr->sa, icmpp_addr_len(family), family,
+			      buf, sizeof(buf));
+}
+
+static uint32_t csum_add(uint32_t sum, const void *buf, size_t len)
+{
+	const uint16_t *ptr = buf;
+
+	for (; len > 1; len -= 2)
+		sum += *ptr++;
+	if (len)
+		sum += *(const uint8_t *) ptr;
+	return sum;
+}
+
+static uint16_t csum_fold(uint32_t sum)
+{
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+#define OFFSET_IP_PROTOCOL					\
+	in_struct_offset(struct iphdr, protocol)
+#define OFFSET_IP_SADDR						\
+	in_struct_offset(struct iphdr, saddr)
+#define OFFSET_ICMP_TYPE					\
+	in_struct_offset(struct icmphdr, type)
+#define OFFSET_ICMP_ID						\
+	in_struct_offset(struct icmphdr, un.echo.id)
+
+static struct sock_filter icmpp_rpl_flt[] = {
+	BPF_STMT(BPF_LD + BPF_B + BPF_ABS, OFFSET_IP_PROTOCOL),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IPPROTO_ICMP, 0, 4),
+	BPF_STMT(BPF_LDX + BPF_B + BPF_MSH, 0),
+	BPF_STMT(BPF_LD + BPF_B + BPF_IND, OFFSET_ICMP_TYPE),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ICMP_ECHOREPLY, 0, 1),
+	BPF_STMT(BPF_RET + BPF_K, (u_int) -1),
+	BPF_STMT(BPF_RET + BPF_K, 0),
+};
+
+static const struct sock_fprog icmpp_rpl_fprog = {
+	.len = ARRAY_SIZE(icmpp_rpl_flt),
+	.filter = icmpp_rpl_flt,
+};
+
+static struct sock_filter icmpp_flt[] = {
+	BPF_STMT(BPF_LD + BPF_B + BPF_ABS, OFFSET_IP_PROTOCOL),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IPPROTO_ICMP, 0, 8),
+	BPF_STMT(BPF_LD + BPF_W + BPF_ABS, OFFSET_IP_SADDR),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0xffffffff, 0, 6), /* target */
+	BPF_STMT(BPF_LDX + BPF_B + BPF_MSH, 0),
+	BPF_STMT(BPF_LD + BPF_B + BPF_IND, OFFSET_ICMP_TYPE),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ICMP_ECHOREPLY, 0, 3),
+	BPF_STMT(BPF_LD + BPF_H + BPF_IND, OFFSET_ICMP_ID),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0xffff, 0, 1), /* identifier */
+	BPF_STMT(BPF_RET + BPF_K, (u_int) -1),
+	BPF_STMT(BPF_RET + BPF_K, 0),
+};
+
+/* this replaces target address and identifier in filter code */
+#define SET_FILTER_TARGET_ID(fprog, addr, id)				\
+	do {								\
+		(fprog)->filter[3].k = ntohl((addr)->s_addr);		\
+		(fprog)->filter[8].k = id;				\
+	} while (0)
+
+static const struct sock_fprog icmpp_fprog = {
+	.len = ARRAY_SIZE(icmpp_flt),
+	.filter = icmpp_flt,
+};
+
+#define OFFSET_IP6_NEXT_HEADER					\
+	in_struct_offset(struct ip6_hdr, ip6_nxt)
+#define OFFSET_IP6_SRC						\
+	in_struct_offset(struct ip6_hdr, ip6_src)
+#define OFFSET_ICMP6_TYPE					\
+	sizeof(struct ip6_hdr) +				\
+	in_struct_offset(struct icmp6_hdr, icmp6_type)
+#define OFFSET_ICMP6_ID						\
+	sizeof(struct ip6_hdr) +				\
+	in_struct_offset(struct icmp6_hdr, icmp6_id)
+
+static struct sock_filter icmpp6_rpl_flt[] = {
+	BPF_STMT(BPF_LD + BPF_B + BPF_ABS, OFFSET_IP6_NEXT_HEADER),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IPPROTO_ICMPV6, 0, 3),
+	BPF_STMT(BPF_LD + BPF_B + BPF_ABS, OFFSET_ICMP6_TYPE),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ICMP6_ECHO_REPLY, 0, 1),
+	BPF_STMT(BPF_RET + BPF_K, (u_int) -1),
+	BPF_STMT(BPF_RET + BPF_K, 0),
+};
+
+static const struct sock_fprog icmpp6_rpl_fprog = {
+	.len = ARRAY_SIZE(icmpp6_rpl_flt),
+	.filter = icmpp6_rpl_flt,
+};
+
+static struct sock_filter icmpp6_flt[] = {
+	BPF_STMT(BPF_LD + BPF_B + BPF_ABS, OFFSET_IP6_NEXT_HEADER),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IPPROTO_ICMPV6, 0, 13),
+	BPF_STMT(BPF_LD + BPF_W + BPF_ABS, OFFSET_IP6_SRC),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0xffffffff, 0, 11), /* target[0] */
+	BPF_STMT(BPF_LD + BPF_W + BPF_ABS, OFFSET_IP6_SRC + 4),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0xffffffff, 0, 9), /* target[1] */
+	BPF_STMT(BPF_LD + BPF_W + BPF_ABS, OFFSET_IP6_SRC + 8),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0xffffffff, 0, 7), /* target[2] */
+	BPF_STMT(BPF_LD + BPF_W + BPF_ABS, OFFSET_IP6_SRC + 12),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0xffffffff, 0, 5), /* target[3] */
+	BPF_STMT(BPF_LD + BPF_B + BPF_ABS, OFFSET_ICMP6_TYPE),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ICMP6_ECHO_REPLY, 0, 3),
+	BPF_STMT(BPF_LD + BPF_H + BPF_ABS, OFFSET_ICMP6_ID),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0xffff, 0, 1), /* identifier */
+	BPF_STMT(BPF_RET + BPF_K, (u_int) -1),
+	BPF_STMT(BPF_RET + BPF_K, 0),
+};
+
+/* this replaces target address words and identifier in filter code */
+#define SET_FILTER6_TARGET_ID(fprog, addr, id)				\
+	do {								\
+		int __i;						\
+									\
+		for (__i = 0; __i < 4; __i++)				\
+			(fprog)->filter[3 + 2 * __i].k =		\
+				ntohl((addr)->s6_addr32[__i]);		\
+		(fprog)->filter[13].k = id;				\
+	} while (0)
+
+static const struct sock_fprog icmpp6_fprog = {
+	.len = ARRAY_SIZE(icmpp6_flt),
+	.filter = icmpp6_flt,
+};
+
+static unsigned short icmpp_protocol(struct lw_icmpp_port_priv *icmpp_ppriv)
+{
+	return icmpp_ppriv->family == AF_INET ? ETH_P_IP : ETH_P_IPV6;
+}
+
+static int lw_icmpp_sock_open(struct lw_psr_port_priv *psr_ppriv)
+{
+	struct lw_icmpp_port_priv *icmpp_ppriv = lw_icmpp_ppriv_get(psr_ppriv);
+	uint32_t ifindex = psr_ppriv->common.tdport->ifindex;
+	struct sock_filter flt[ARRAY_SIZE(icmpp6_flt)];
+	struct sock_fprog fprog;
+	struct sockaddr_ll ll_my;
+	int err;
+
+	/* Replies come from shared rx ring, socket is used for send only */
+	if (psr_ppriv->rx_ring) {
+		err = teamd_packet_sock_open(&psr_ppriv->sock, ifindex,
+					     0, NULL, NULL);
+	} else if (icmpp_ppriv->family == AF_INET) {
+		memcpy(flt, icmpp_fprog.filter, sizeof(icmpp_flt));
+		fprog = icmpp_fprog;
+		fprog.filter = flt;
+		SET_FILTER_TARGET_ID(&fprog, &icmpp_ppriv->dst.sin.sin_addr,
+				     icmpp_ppriv->id);
+		err = teamd_packet_sock_open(&psr_ppriv->sock, ifindex,
+					     htons(ETH_P_IP), &fprog, NULL);
+	} else {
+		memcpy(flt, icmpp6_fprog.filter, sizeof(icmpp6_flt));
+		fprog = icmpp6_fprog;
+		fprog.filter = flt;
+		SET_FILTER6_TARGET_ID(&fprog, &icmpp_ppriv->dst.sin6.sin6_addr,
+				      icmpp_ppriv->id);
+		err = teamd_packet_sock_open(&psr_ppriv->sock, ifindex,
+					     htons(ETH_P_IPV6), &fprog, NULL);
+	}
+	if (err)
+		return err;
+
+	err = teamd_getsockname_hwaddr(psr_ppriv->sock, &ll_my, 0);
+	if (err)
+		goto close_sock;
+	if (ll_my.sll_halen != ETH_ALEN) {
+		teamd_log_err("Unexpected length of hw address.");
+		err = -ENOTSUP;
+		goto close_sock;
+	}
+	/* Socket is opened again once target changes, so is its hwaddr */
+	icmpp_ppriv->dst_hwaddr_known = false;
+	icmpp_ppriv->ll_dst.sll_halen = ETH_ALEN;
+	icmpp_ppriv->ll_dst.sll_family = AF_PACKET;
+	icmpp_ppriv->ll_dst.sll_ifindex = ifindex;
+	icmpp_ppriv->ll_dst.sll_protocol = htons(icmpp_protocol(icmpp_ppriv));
+	return 0;
+
+close_sock:
+	close(psr_ppriv->sock);
+	return err;
+}
+
+static void lw_icmpp_sock_close(struct lw_psr_port_priv *psr_ppriv)
+{
+	close(psr_ppriv->sock);
+}
+
+static const struct lw_psr_ops lw_psr_ops_icmpp6;
+
+static int lw_icmpp_load_options(struct teamd_context *ctx,
+				 struct teamd_port *tdport,
+				 struct lw_psr_port_priv *psr_ppriv)
+{
+	struct lw_icmpp_port_priv *icmpp_ppriv = lw_icmpp_ppriv_get(psr_ppriv);
+	struct teamd_config_path_cookie *cpcookie = psr_ppriv->common.cpcookie;
+	const char *hwaddr_str;
+	const char *source_host;
+	const char *target_host;
+	int err;
+
+	err = teamd_config_string_get(ctx, &target_host, "@.target_host",
+				      cpcookie);
+	if (err) {
+		teamd_log_err("Failed to get \"target_host\" link-watch option.");
+		return -EINVAL;
+	}
+	/* Source address is needed as there is none on port to pick from */
+	err = teamd_config_string_get(ctx, &source_host, "@.source_host",
+				      cpcookie);
+	if (err) {
+		teamd_log_err("Failed to get \"source_host\" link-watch option.");
+		return -EINVAL;
+	}
+	icmpp_ppriv->family = icmpp_family_get(source_host, target_host);
+
+	err = lw_psr_resolve(ctx, psr_ppriv, &icmpp_ppriv->dst_res,
+			     icmpp_ppriv->family, target_host,
+			     icmpp_addr_ptr(&icmpp_ppriv->dst,
+					    icmpp_ppriv->family));
+	if (err)
+		return err;
+	teamd_log_dbg("target host \"%s\".", target_host);
+
+	err = lw_psr_resolve(ctx, psr_ppriv, &icmpp_ppriv->src_res,
+			     icmpp_ppriv->family, source_host,
+			     icmpp_addr_ptr(&icmpp_ppriv->src,
+					    icmpp_ppriv->family));
+	if (err)
+		return err;
+	teamd_log_dbg("source host \"%s\".", source_host);
+
+	err = teamd_config_string_get(ctx, &hwaddr_str, "@.target_hwaddr",
+				      cpcookie);
+	if (!err) {
+		struct ether_addr *hwaddr = ether_aton(hwaddr_str);
+
+		if (!hwaddr) {
+			teamd_log_err("Wrong \"target_hwaddr\" option value.");
+			return -EINVAL;
+		}
+		memcpy(icmpp_ppriv->ll_dst.sll_addr, hwaddr, ETH_ALEN);
+		icmpp_ppriv->dst_hwaddr_static = true;
+		teamd_log_dbg("target hwaddr \"%s\".", hwaddr_str);
+	}
+
+	err = teamd_config_bool_get(ctx, &icmpp_ppriv->send_always,
+				    "@.send_always", cpcookie);
+	if (err)
+		icmpp_ppriv->send_always = false;
+	teamd_log_dbg("send_always \"%d\".", icmpp_ppriv->send_always);
+
+	/* Unique among watchers of this instance and likely among others */
+	icmpp_ppriv->id = (getpid() << 8) ^ (tdport->ifindex << 4) ^
+			  psr_ppriv->common.id;
+
+	/* Rx ring and tx batch are per protocol, so per family here */
+	if (icmpp_ppriv->family == AF_INET6)
+		psr_ppriv->ops = &lw_psr_ops_icmpp6;
+	return 0;
+}
+
+static void icmpp_packet_build(struct lw_icmpp_port_priv *icmpp_ppriv,
+			       struct lw_tx_batch_msg *msg)
+{
+	struct icmpp_packet ip;
+
+	memset(&ip, 0, sizeof(ip));
+	ip.iph.version = 4;
+	ip.iph.ihl = sizeof(ip.iph) >> 2;
+	ip.iph.tot_len = htons(sizeof(ip));
+	ip.iph.frag_off = htons(IP_DF);
+	ip.iph.ttl = ICMPP_TTL;
+	ip.iph.protocol = IPPROTO_ICMP;
+	ip.iph.saddr = icmpp_ppriv->src.sin.sin_addr.s_addr;
+	ip.iph.daddr = icmpp_ppriv->dst.sin.sin_addr.s_addr;
+	ip.iph.check = csum_fold(csum_add(0, &ip.iph, sizeof(ip.iph)));
+
+	ip.icmph.type = ICMP_ECHO;
+	ip.icmph.un.echo.id = htons(icmpp_ppriv->id);
+	ip.icmph.un.echo.sequence = htons(icmpp_ppriv->seq);
+	ip.icmph.checksum = csum_fold(csum_add(0, &ip.icmph,
+					       sizeof(ip.icmph)));
+
+	memcpy(msg->buf, &ip, sizeof(ip));
+	msg->len = sizeof(ip);
+}
+
+static void icmpp6_packet_build(struct lw_icmpp_port_priv *icmpp_ppriv,
+				struct lw_tx_batch_msg *msg)
+{
+	struct icmpp6_packet ip6;
+	uint32_t sum;
+
+	memset(&ip6, 0, sizeof(ip6));
+	ip6.ip6h.ip6_flow = htonl(6 << 28);
+	ip6.ip6h.ip6_plen = htons(sizeof(ip6.icmp6h));
+	ip6.ip6h.ip6_nxt = IPPROTO_ICMPV6;
+	ip6.ip6h.ip6_hlim = ICMPP_TTL;
+	ip6.ip6h.ip6_src = icmpp_ppriv->src.sin6.sin6_addr;
+	ip6.ip6h.ip6_dst = icmpp_ppriv->dst.sin6.sin6_addr;
+
+	ip6.icmp6h.icmp6_type = ICMP6_ECHO_REQUEST;
+	ip6.icmp6h.icmp6_id = htons(icmpp_ppriv->id);
+	ip6.icmp6h.icmp6_seq = htons(icmpp_ppriv->seq);
+
+	/* Pseudo header: addresses, upper-layer length and next header */
+	sum = csum_add(0, &ip6.ip6h.ip6_src, 2 * sizeof(struct in6_addr));
+	sum += htons(sizeof(ip6.icmp6h));
+	sum += htons(IPPROTO_ICMPV6);
+	sum = csum_add(sum, &ip6.icmp6h, sizeof(ip6.icmp6h));
+	ip6.icmp6h.icmp6_cksum = csum_fold(sum);
+
+	memcpy(msg->buf, &ip6, sizeof(ip6));
+	msg->len = sizeof(ip6);
+}
+
+static int lw_icmpp_send_prepare(struct lw_psr_port_priv *psr_ppriv,
+				 struct lw_tx_batch_msg *msg,
+				 unsigned int index)
+{
+	struct lw_icmpp_port_priv *icmpp_ppriv = lw_icmpp_ppriv_get(psr_ppriv);
+
+	msg->len = 0;
+	if (!(psr_ppriv->common.forced_send || icmpp_ppriv->send_always))
+		return 0;
+
+	msg->addr.ll = icmpp_ppriv->ll_dst;
+	if (!icmpp_ppriv->dst_hwaddr_static && !icmpp_ppriv->dst_hwaddr_known)
+		memset(msg->addr.ll.sll_addr, 0xff, ETH_ALEN);
+	msg->addr_len = sizeof(msg->addr.ll);
+
+	icmpp_ppriv->seq++;
+	if (icmpp_ppriv->family == AF_INET)
+		icmpp_packet_build(icmpp_ppriv, msg);
+	else
+		icmpp6_packet_build(icmpp_ppriv, msg);
+	return 0;
+}
+
+static int lw_icmpp_send(struct lw_psr_port_priv *psr_ppriv)
+{
+	struct lw_tx_batch_msg msg;
+	int err;
+
+	err = lw_icmpp_send_prepare(psr_ppriv, &msg, 0);
+	if (err || !msg.len)
+		return err;
+	err = teamd_sendto(psr_ppriv->sock, msg.buf, msg.len, 0,
+			   &msg.addr.sa, msg.addr_len);
+	if (err)
+		return err;
+	lw_psr_probe_sent(psr_ppriv);
+	return 0;
+}
+
+static int lw_icmpp_tx_batch_sock_open(int *sock_p)
+{
+	/* Not bound, destination port is given by each message */
+	*sock_p = socket(PF_PACKET, SOCK_DGRAM, 0);
+	if (*sock_p == -1) {
+		teamd_log_err("Failed to create packet socket.");
+		return -errno;
+	}
+	return 0;
+}
+
+/* Returns echo reply header in case packet is reply from our target */
+static const void *icmpp_reply_get(struct lw_icmpp_port_priv *icmpp_ppriv,
+				   const uint8_t *buf, size_t len)
+{
+	const struct iphdr *iph = (const struct iphdr *) buf;
+	const struct icmphdr *icmph;
+	size_t hlen;
+
+	if (len < sizeof(*iph) || iph->version != 4 ||
+	    iph->protocol != IPPROTO_ICMP ||
+	    iph->saddr != icmpp_ppriv->dst.sin.sin_addr.s_addr)
+		return NULL;
+	hlen = iph->ihl << 2;
+	if (hlen < sizeof(*iph) || len < hlen + sizeof(*icmph))
+		return NULL;
+	icmph = (const struct icmphdr *) (buf + hlen);
+	if (icmph->type != ICMP_ECHOREPLY ||
+	    icmph->un.echo.id != htons(icmpp_ppriv->id))
+		return NULL;
+	return icmph;
+}
+
+static const void *icmpp6_reply_get(struct lw_icmpp_port_priv *icmpp_ppriv,
+				    const uint8_t *buf, size_t len)
+{
+	const struct ip6_hdr *ip6h = (const struct ip6_hdr *) buf;
+	const struct icmp6_hdr *icmp6h;
+
+	/* Extension headers are not expected in echo reply */
+	if (len < sizeof(struct icmpp6_packet) ||
+	    ip6h->ip6_nxt != IPPROTO_ICMPV6 ||
+	    memcmp(&ip6h->ip6_src, &icmpp_ppriv->dst.sin6.sin6_addr,
+		   sizeof(struct in6_addr)))
+		return NULL;
+	icmp6h = (const struct icmp6_hdr *) (buf + sizeof(*ip6h));
+	if (icmp6h->icmp6_type != ICMP6_ECHO_REPLY ||
+	    icmp6h->icmp6_id != htons(icmpp_ppriv->id))
+		return NULL;
+	return icmp6h;
+}
+
+static void __lw_icmpp_receive(struct lw_psr_port_priv *psr_ppriv,
+			       const void *buf, size_t len,
+			       const struct sockaddr_ll *ll_from,
+			       const struct timespec *ts)
+{
+	struct lw_icmpp_port_priv *icmpp_ppriv = lw_icmpp_ppriv_get(psr_ppriv);
+	uint16_t seq;
+
+	if (icmpp_ppriv->family == AF_INET) {
+		const struct icmphdr *icmph;
+
+		icmph = icmpp_reply_get(icmpp_ppriv, buf, len);
+		if (!icmph)
+			return;
+		seq = ntohs(icmph->un.echo.sequence);
+	} else {
+		const struct icmp6_hdr *icmp6h;
+
+		icmp6h = icmpp6_reply_get(icmpp_ppriv, buf, len);
+		if (!icmp6h)
+			return;
+		seq = ntohs(icmp6h->icmp6_seq);
+	}
+	if (seq != icmpp_ppriv->seq) {
+		icmpp_ppriv->replies_late++;
+		return;
+	}
+
+	if (!icmpp_ppriv->dst_hwaddr_static && ll_from->sll_halen == ETH_ALEN) {
+		memcpy(icmpp_ppriv->ll_dst.sll_addr, ll_from->sll_addr,
+		       ETH_ALEN);
+		icmpp_ppriv->dst_hwaddr_known = true;
+	}
+	lw_psr_reply_received(psr_ppriv, ts);
+}
+
+static int lw_icmpp_receive(struct lw_psr_port_priv *psr_ppriv)
+{
+	/* Room for IPv4 header with options */
+	uint8_t buf[sizeof(struct icmpp6_packet) + 40];
+	struct sockaddr_ll ll_from;
+	struct timespec ts;
+	int err;
+
+	err = teamd_recvfrom_ts(psr_ppriv->sock, buf, sizeof(buf), 0,
+				(struct sockaddr *) &ll_from, sizeof(ll_from),
+				&ts);
+	if (err <= 0)
+		return err;
+	__lw_icmpp_receive(psr_ppriv, buf, err, &ll_from, &ts);
+	return 0;
+}
+
+static void lw_icmpp_receive_frame(struct lw_psr_port_priv *psr_ppriv,
+				   const void *buf, size_t len,
+				   const struct sockaddr_ll *ll_from,
+				   int vlanid, const struct timespec *ts)
+{
+	if (vlanid != -1)
+		return;
+	__lw_icmpp_receive(psr_ppriv, buf, len, ll_from, ts);
+}
+
+static void lw_icmpp_xsk_match(struct lw_psr_port_priv *psr_ppriv,
+			       struct lw_xsk_match *match)
+{
+	struct lw_icmpp_port_priv *icmpp_ppriv = lw_icmpp_ppriv_get(psr_ppriv);
+
+	match->protocol = icmpp_protocol(icmpp_ppriv);
+	match->echo_id = icmpp_ppriv->id;
+}
+
+static const struct lw_psr_ops lw_psr_ops_icmpp = {
+	.sock_open		= lw_icmpp_sock_open,
+	.sock_close		= lw_icmpp_sock_close,
+	.load_options		= lw_icmpp_load_options,
+	.send			= lw_icmpp_send,
+	.receive		= lw_icmpp_receive,
+	.receive_frame		= lw_icmpp_receive_frame,
+	.proto_name		= "icmp",
+	.rx_ring_protocol	= ETH_P_IP,
+	.rx_ring_fprog		= &icmpp_rpl_fprog,
+	.send_prepare		= lw_icmpp_send_prepare,
+	.tx_batch_sock_open	= lw_icmpp_tx_batch_sock_open,
+	.xsk_match		= lw_icmpp_xsk_match,
+};
+
+static const struct lw_psr_ops lw_psr_ops_icmpp6 = {
+	.sock_open		= lw_icmpp_sock_open,
+	.sock_close		= lw_icmpp_sock_close,
+	.load_options		= lw_icmpp_load_options,
+	.send			= lw_icmpp_send,
+	.receive		= lw_icmpp_receive,
+	.receive_frame		= lw_icmpp_receive_frame,
+	.proto_name		= "icmp6",
+	.rx_ring_protocol	= ETH_P_IPV6,
+	.rx_ring_fprog		= &icmpp6_rpl_fprog,
+	.send_prepare		= lw_icmpp_send_prepare,
+	.tx_batch_sock_open	= lw_icmpp_tx_batch_sock_open,
+	.xsk_match		= lw_icmpp_xsk_match,
+};
+
+static int lw_icmpp_port_added(struct teamd_context *ctx,
+			       struct teamd_port *tdport,
+			       void *priv, void *creator_priv)
+{
+	struct lw_icmpp_port_priv *icmpp_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = &icmpp_ppriv->start.psr;
+
+	/* Switched to IPv6 ops by load_options in case of IPv6 target */
+	psr_ppriv->ops = &lw_psr_ops_icmpp;
+	return lw_psr_port_added(ctx, tdport, priv, creator_priv);
+}
+
+static int lw_icmpp_state_source_host_get(struct teamd_context *ctx,
+					  struct team_state_gsc *gsc,
+					  void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+	struct lw_icmpp_port_priv *icmpp_ppriv = lw_icmpp_ppriv_get(psr_ppriv);
+
+	gsc->data.str_val.ptr = icmpp_addr_str(&icmpp_ppriv->src,
+					       icmpp_ppriv->family);
+	return 0;
+}
+
+static int lw_icmpp_state_target_host_get(struct teamd_context *ctx,
+					  struct team_state_gsc *gsc,
+					  void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+	struct lw_icmpp_port_priv *icmpp_ppriv = lw_icmpp_ppriv_get(psr_ppriv);
+
+	gsc->data.str_val.ptr = icmpp_addr_str(&icmpp_ppriv->dst,
+					       icmpp_ppriv->family);
+	return 0;
+}
+
+static int lw_icmpp_state_target_hwaddr_get(struct teamd_context *ctx,
+					    struct team_state_gsc *gsc,
+					    void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+	struct lw_icmpp_port_priv *icmpp_ppriv = lw_icmpp_ppriv_get(psr_ppriv);
+	static char buf[3 * ETH_ALEN];
+
+	if (!icmpp_ppriv->dst_hwaddr_static && !icmpp_ppriv->dst_hwaddr_known) {
+		gsc->data.str_val.ptr = "";
+		return 0;
+	}
+	gsc->data.str_val.ptr = ether_ntoa_r((struct ether_addr *)
+					     icmpp_ppriv->ll_dst.sll_addr,
+					     buf);
+	return 0;
+}
+
+static int lw_icmpp_state_send_always_get(struct teamd_context *ctx,
+					  struct team_state_gsc *gsc,
+					  void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+	struct lw_icmpp_port_priv *icmpp_ppriv = lw_icmpp_ppriv_get(psr_ppriv);
+
+	gsc->data.bool_val = icmpp_ppriv->send_always;
+	return 0;
+}
+
+static int lw_icmpp_state_replies_late_get(struct teamd_context *ctx,
+					   struct team_state_gsc *gsc,
+					   void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+	struct lw_icmpp_port_priv *icmpp_ppriv = lw_icmpp_ppriv_get(psr_ppriv);
+
+	gsc->data.int_val = icmpp_ppriv->replies_late;
+	return 0;
+}
+
+static const struct teamd_state_val lw_icmpp_state_vals[] = {
+	{
+		.subpath = "source_host",
+		.type = TEAMD_STATE_ITEM_TYPE_STRING,
+		.getter = lw_icmpp_state_source_host_get,
+	},
+	{
+		.subpath = "target_host",
+		.type = TEAMD_STATE_ITEM_TYPE_STRING,
+		.getter = lw_icmpp_state_target_host_get,
+	},
+	{
+		.subpath = "target_hwaddr",
+		.type = TEAMD_STATE_ITEM_TYPE_STRING,
+		.getter = lw_icmpp_state_target_hwaddr_get,
+	},
+	{
+		.subpath = "interval",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_interval_get,
+	},
+	{
+		.subpath = "fast_interval",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_fast_interval_get,
+	},
+	{
+		.subpath = "effective_interval",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_effective_interval_get,
+	},
+	{
+		.subpath = "init_wait",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_init_wait_get,
+	},
+	{
+		.subpath = "send_always",
+		.type = TEAMD_STATE_ITEM_TYPE_BOOL,
+		.getter = lw_icmpp_state_send_always_get,
+	},
+	{
+		.subpath = "missed_max",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_missed_max_get,
+	},
+	{
+		.subpath = "missed",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_missed_get,
+	},
+	{
+		.subpath = "replies_late",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_icmpp_state_replies_late_get,
+	},
+	{
+		.subpath = "probes_sent",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_probes_sent_get,
+	},
+	{
+		.subpath = "rtt_last",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_rtt_last_get,
+	},
+	{
+		.subpath = "rtt_avg",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_rtt_avg_get,
+	},
+	{
+		.subpath = "rtt_jitter",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_rtt_jitter_get,
+	},
+	{
+		.subpath = "loss_percent",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_loss_percent_get,
+	},
+};
+
+const struct teamd_link_watch teamd_link_watch_icmp_ping = {
+	.name			= "icmp_ping",
+	.state_vg		= {
+		.vals		= lw_icmpp_state_vals,
+		.vals_count	= ARRAY_SIZE(lw_icmpp_state_vals),
+	},
+	.port_priv = {
+		.init		= lw_icmpp_port_added,
+		.fini		= lw_psr_port_removed,
+		.priv_size	= sizeof(struct lw_icmpp_port_priv),
+	},
+	.health_get		= lw_psr_health_get,
+};
@@ -31,17 +31,6 @@
  * IPV6 NS/NA ping link watch
  */
 
-static int set_sockaddr_in6(struct sockaddr_in6 *sin6, const char *hostname)
-{
-	int err;
-
-	err = __set_sockaddr((struct sockaddr *) sin6, sizeof(*sin6),
-			     AF_INET6, hostname);
-	if (err)
-		return err;
-	return 0;
-}
-
 static char *str_sockaddr_in6(struct sockaddr_in6 *sin6)
 {
 	static char buf[NI_MAXHOST];
@@ -57,6 +46,9 @@ struct lw_nsnap_port_priv {
 	} start; /* must be first */
 	int tx_sock;
 	struct sockaddr_in6 dst;
+	struct lw_resolve dst_res;
+	unsigned int na_seen; /* NA packets received from rx ring */
+	unsigned int na_matched; /* NA packets which are valid replies */
 };
 
 static struct lw_nsnap_port_priv *
@@ -123,20 +115,70 @@ static const struct sock_fprog na_fprog = {
 	.filter = na_flt,
 };
 
+#define OFFSET_NA_TARGET					\
+	sizeof (struct ip6_hdr) +				\
+	in_struct_offset(struct nd_neighbor_advert, nd_na_target)
+
+static struct sock_filter na_target_flt[] = {
+	BPF_STMT(BPF_LD + BPF_B + BPF_ABS, OFFSET_NEXT_HEADER),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, IPPROTO_ICMPV6, 0, 11),
+	BPF_STMT(BPF_LD + BPF_B + BPF_ABS, OFFSET_NA_TYPE),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, ND_NEIGHBOR_ADVERT, 0, 9),
+	BPF_STMT(BPF_LD + BPF_W + BPF_ABS, OFFSET_NA_TARGET),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0xffffffff, 0, 7), /* target[0] */
+	BPF_STMT(BPF_LD + BPF_W + BPF_ABS, OFFSET_NA_TARGET + 4),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0xffffffff, 0, 5), /* target[1] */
+	BPF_STMT(BPF_LD + BPF_W + BPF_ABS, OFFSET_NA_TARGET + 8),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0xffffffff, 0, 3), /* target[2] */
+	BPF_STMT(BPF_LD + BPF_W + BPF_ABS, OFFSET_NA_TARGET + 12),
+	BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K, 0xffffffff, 0, 1), /* target[3] */
+	BPF_STMT(BPF_RET + BPF_K, (u_int) -1),
+	BPF_STMT(BPF_RET + BPF_K, 0),
+};
+
+/* this replaces target address words in filter code */
+#define SET_FILTER_NA_TARGET(fprog, addr)				\
+	do {								\
+		int __i;						\
+									\
+		for (__i = 0; __i < 4; __i++)				\
+			(fprog)->filter[5 + 2 * __i].k =		\
+				ntohl((addr)->s6_addr32[__i]);		\
+	} while (0)
+
+static const struct sock_fprog na_target_fprog = {
+	.len = ARRAY_SIZE(na_target_flt),
+	.filter = na_target_flt,
+};
+
 static int lw_nsnap_sock_open(struct lw_psr_port_priv *psr_ppriv)
 {
 	struct lw_nsnap_port_priv *nsnap_ppriv = lw_nsnap_ppriv_get(psr_ppriv);
+	struct sock_filter na_target_flt[ARRAY_SIZE(na_target_flt)];
+	struct sock_fprog fprog;
 	int err;
 
+	/*
+	 * Only NAs for our target are let through, others on the segment
+	 * would wake us up for nothing.
+	 */
+	memcpy(&na_target_flt, na_target_fprog.filter, sizeof(na_target_flt));
+	fprog = na_target_fprog;
+	fprog.filter = na_target_flt;
+	SET_FILTER_NA_TARGET(&fprog, &nsnap_ppriv->dst.sin6_addr);
+
 	/*
 	 * We use two sockets here. NS packets are send through ICMP6 socket.
 	 * With this socket, unfortunately, kernel does not provide a way to
 	 * deliver incoming ICMP6 packet on inactive ports into userspace.
-	 * So we use packet socket to get these packets.
+	 * So we use packet socket to get these packets. With shared rx
+	 * ring, the packet socket is only used to get port hwaddr.
 	 */
 	err = teamd_packet_sock_open(&psr_ppriv->sock,
 				     psr_ppriv->common.tdport->ifindex,
-				     htons(ETH_P_IPV6), &na_fprog, NULL);
+				     psr_ppriv->rx_ring ? 0 : htons(ETH_P_IPV6),
+				     psr_ppriv->rx_ring ? NULL : &fprog,
+				     NULL);
 	if (err)
 		return err;
 	err = icmp6_sock_open(&nsnap_ppriv->tx_sock);
@@ -170,7 +212,9 @@ static int lw_nsnap_load_options(struct teamd_context *ctx,
 		teamd_log_err("Failed to get \"target_host\" link-watch option.");
 		return -EINVAL;
 	}
-	err = set_sockaddr_in6(&nsnap_ppriv->dst, host);
+	nsnap_ppriv->dst.sin6_family = AF_INET6;
+	err = lw_psr_resolve(ctx, psr_ppriv, &nsnap_ppriv->dst_res, AF_INET6,
+			     host, &nsnap_ppriv->dst.sin6_addr);
 	if (err)
 		return err;
 	teamd_log_dbg("target address \"%s\".",
@@ -193,14 +237,17 @@ struct ns_packet {
 	unsigned char			hwaddr[ETH_ALEN];
 };
 
-static int lw_nsnap_send(struct lw_psr_port_priv *psr_ppriv)
+static int lw_nsnap_send_prepare(struct lw_psr_port_priv *psr_ppriv,
+				 struct lw_tx_batch_msg *msg,
+				 unsigned int index)
 {
 	struct lw_nsnap_port_priv *nsnap_ppriv = lw_nsnap_ppriv_get(psr_ppriv);
 	int err;
 	struct sockaddr_ll ll_my;
-	struct sockaddr_in6 sendto_addr;
+	struct sockaddr_in6 *sendto_addr = &msg->addr.sin6;
 	struct ns_packet nsp;
 
+	msg->len = 0;
 	err = teamd_getsockname_hwaddr(psr_ppriv->sock, &ll_my,
 				       sizeof(nsp.hwaddr));
 	if (err)
@@ -216,13 +263,30 @@ static int lw_nsnap_send(struct lw_psr_port_priv *psr_ppriv)
 	nsp.opt.nd_opt_len = 1; /* 8 bytes */
 	memcpy(nsp.hwaddr, ll_my.sll_addr, sizeof(nsp.hwaddr));
 
-	sendto_addr = nsnap_ppriv->dst;
-	compute_multi_in6_addr(&sendto_addr.sin6_addr);
-	sendto_addr.sin6_scope_id = psr_ppriv->common.tdport->ifindex;
-	err = teamd_sendto(nsnap_ppriv->tx_sock, &nsp, sizeof(nsp), 0,
-			   (struct sockaddr *) &sendto_addr,
-			   sizeof(sendto_addr));
-	return err;
+	*sendto_addr = nsnap_ppriv->dst;
+	compute_multi_in6_addr(&sendto_addr->sin6_addr);
+	sendto_addr->sin6_scope_id = psr_ppriv->common.tdport->ifindex;
+	msg->addr_len = sizeof(*sendto_addr);
+	memcpy(msg->buf, &nsp, sizeof(nsp));
+	msg->len = sizeof(nsp);
+	return 0;
+}
+
+static int lw_nsnap_send(struct lw_psr_port_priv *psr_ppriv)
+{
+	struct lw_nsnap_port_priv *nsnap_ppriv = lw_nsnap_ppriv_get(psr_ppriv);
+	struct lw_tx_batch_msg msg;
+	int err;
+
+	err = lw_nsnap_send_prepare(psr_ppriv, &msg, 0);
+	if (err)
+		return err;
+	err = teamd_sendto(nsnap_ppriv->tx_sock, msg.buf, msg.len, 0,
+			   &msg.addr.sa, msg.addr_len);
+	if (err)
+		return err;
+	lw_psr_probe_sent(psr_ppriv);
+	return 0;
 }
 
 struct na_packet {
@@ -232,35 +296,66 @@ struct na_packet {
 	unsigned char			hwaddr[ETH_ALEN];
 };
 
-static int lw_nsnap_receive(struct lw_psr_port_priv *psr_ppriv)
+static void __lw_nsnap_receive(struct lw_psr_port_priv *psr_ppriv,
+			       const struct na_packet *nap,
+			       const struct timespec *ts)
 {
 	struct lw_nsnap_port_priv *nsnap_ppriv = lw_nsnap_ppriv_get(psr_ppriv);
+
+	/* check IPV6 header */
+	if (nap->ip6h.ip6_vfc != 0x60 /* IPV6 */ ||
+	    nap->ip6h.ip6_plen != htons(sizeof(*nap) - sizeof(nap->ip6h)) ||
+	    nap->ip6h.ip6_nxt != IPPROTO_ICMPV6 ||
+	    nap->ip6h.ip6_hlim != 255 /* Do not route */ ||
+	    memcmp(&nap->ip6h.ip6_src, &nsnap_ppriv->dst.sin6_addr,
+		   sizeof(struct in6_addr)))
+		return;
+
+	/* check ICMP6 header */
+	if (nap->nah.nd_na_type != ND_NEIGHBOR_ADVERT ||
+	    nap->opt.nd_opt_type != ND_OPT_TARGET_LINKADDR ||
+	    nap->opt.nd_opt_len != 1 /* 8 bytes */)
+		return;
+
+	nsnap_ppriv->na_matched++;
+	lw_psr_reply_received(psr_ppriv, ts);
+}
+
+static int lw_nsnap_receive(struct lw_psr_port_priv *psr_ppriv)
+{
 	struct na_packet nap;
 	struct sockaddr_ll ll_from;
+	struct timespec ts;
 	int err;
 
-	err = teamd_recvfrom(psr_ppriv->sock, &nap, sizeof(nap), 0,
-			     (struct sockaddr *) &ll_from, sizeof(ll_from));
+	err = teamd_recvfrom_ts(psr_ppriv->sock, &nap, sizeof(nap), 0,
+				(struct sockaddr *) &ll_from, sizeof(ll_from),
+				&ts);
 	if (err <= 0)
 		return err;
+	__lw_nsnap_receive(psr_ppriv, &nap, &ts);
+	return 0;
+}
 
-	/* check IPV6 header */
-	if (nap.ip6h.ip6_vfc != 0x60 /* IPV6 */ ||
-	    nap.ip6h.ip6_plen != htons(sizeof(nap) - sizeof(nap.ip6h)) ||
-	    nap.ip6h.ip6_nxt != IPPROTO_ICMPV6 ||
-	    nap.ip6h.ip6_hlim != 255 /* Do not route */ ||
-	    memcmp(&nap.ip6h.ip6_src, &nsnap_ppriv->dst.sin6_addr,
-		   sizeof(struct in6_addr)))
-		return 0;
-
-	/* check ICMP6 header */
-	if (nap.nah.nd_na_type != ND_NEIGHBOR_ADVERT ||
-	    nap.opt.nd_opt_type != ND_OPT_TARGET_LINKADDR ||
-	    nap.opt.nd_opt_len != 1 /* 8 bytes */)
-		return 0;
+static void lw_nsnap_receive_frame(struct lw_psr_port_priv *psr_ppriv,
+				   const void *buf, size_t len,
+				   const struct sockaddr_ll *ll_from,
+				   int vlanid, const struct timespec *ts)
+{
+	struct lw_nsnap_port_priv *nsnap_ppriv = lw_nsnap_ppriv_get(psr_ppriv);
+	struct na_packet nap;
 
-	psr_ppriv->reply_received = true;
-	return 0;
+	memset(&nap, 0, sizeof(nap));
+	memcpy(&nap, buf, len < sizeof(nap) ? len : sizeof(nap));
+	nsnap_ppriv->na_seen++;
+	/*
+	 * Ring is shared by all watchers so its filter lets through any NA,
+	 * match the target here the same way as socket filter does.
+	 */
+	if (memcmp(&nap.nah.nd_na_target, &nsnap_ppriv->dst.sin6_addr,
+		   sizeof(struct in6_addr)))
+		return;
+	__lw_nsnap_receive(psr_ppriv, &nap, ts);
 }
 
 static const struct lw_psr_ops lw_psr_ops_nsnap = {
@@ -269,6 +364,12 @@ static const struct lw_psr_ops lw_psr_ops_nsnap = {
 	.load_options		= lw_nsnap_load_options,
 	.send			= lw_nsnap_send,
 	.receive		= lw_nsnap_receive,
+	.receive_frame		= lw_nsnap_receive_frame,
+	.proto_name		= "ipv6",
+	.rx_ring_protocol	= ETH_P_IPV6,
+	.rx_ring_fprog		= &na_fprog,
+	.send_prepare		= lw_nsnap_send_prepare,
+	.tx_batch_sock_open	= icmp6_sock_open,
 };
 
 static int lw_nsnap_port_added(struct teamd_context *ctx,
@@ -293,6 +394,30 @@ static int lw_nsnap_state_target_host_get(struct teamd_context *ctx,
 	return 0;
 }
 
+static int lw_nsnap_state_na_seen_get(struct teamd_context *ctx,
+				      struct team_state_gsc *gsc,
+				      void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+	struct lw_nsnap_port_priv *nsnap_ppriv = lw_nsnap_ppriv_get(psr_ppriv);
+
+	gsc->data.int_val = nsnap_ppriv->na_seen;
+	return 0;
+}
+
+static int lw_nsnap_state_na_matched_get(struct teamd_context *ctx,
+					 struct team_state_gsc *gsc,
+					 void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+	struct lw_nsnap_port_priv *nsnap_ppriv = lw_nsnap_ppriv_get(psr_ppriv);
+
+	gsc->data.int_val = nsnap_ppriv->na_matched;
+	return 0;
+}
+
 static const struct teamd_state_val lw_nsnap_state_vals[] = {
 	{
 		.subpath = "target_host",
@@ -304,6 +429,16 @@ static const struct teamd_state_val lw_nsnap_state_vals[] = {
 		.type = TEAMD_STATE_ITEM_TYPE_INT,
 		.getter = lw_psr_state_interval_get,
 	},
+	{
+		.subpath = "fast_interval",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_fast_interval_get,
+	},
+	{
+		.subpath = "effective_interval",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_effective_interval_get,
+	},
 	{
 		.subpath = "init_wait",
 		.type = TEAMD_STATE_ITEM_TYPE_INT,
@@ -319,6 +454,41 @@ static const struct teamd_state_val lw_nsnap_state_vals[] = {
 		.type = TEAMD_STATE_ITEM_TYPE_INT,
 		.getter = lw_psr_state_missed_get,
 	},
+	{
+		.subpath = "probes_sent",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_probes_sent_get,
+	},
+	{
+		.subpath = "rtt_last",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_rtt_last_get,
+	},
+	{
+		.subpath = "rtt_avg",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_rtt_avg_get,
+	},
+	{
+		.subpath = "rtt_jitter",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_rtt_jitter_get,
+	},
+	{
+		.subpath = "loss_percent",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_psr_state_loss_percent_get,
+	},
+	{
+		.subpath = "na_seen",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_nsnap_state_na_seen_get,
+	},
+	{
+		.subpath = "na_matched",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_nsnap_state_na_matched_get,
+	},
 };
 
 const struct teamd_link_watch teamd_link_watch_nsnap = {
@@ -332,4 +502,5 @@ const struct teamd_link_watch teamd_link_watch_nsnap = {
 		.fini		= lw_psr_port_removed,
 		.priv_size	= sizeof(struct lw_nsnap_port_priv),
 	},
+	.health_get		= lw_psr_health_get,
 };
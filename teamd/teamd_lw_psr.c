@@ -22,6 +22,7 @@
 #include "teamd.h"
 #include "teamd_link_watch.h"
 #include "teamd_config.h"
+#include "teamd_realtime.h"
 
 /*
  * Generic periodic send/receive link watch "template"
@@ -29,9 +30,113 @@
 
 static const struct timespec lw_psr_default_init_wait = { 0, 1 };
 #define LW_PSR_DEFAULT_MISSED_MAX 3
+#define LW_PSR_DEFAULT_RESOLVE_INTERVAL 300000 /* ms */
+#define LW_PSR_SOCK_RETRY_INTERVAL 1000 /* ms */
+
+/*
+ * Probe statistics. Replies are not matched to probes by any id, the first
+ * reply received after probe is sent is taken as its reply. Probe is
+ * counted as lost in case no reply comes until the next one is sent.
+ */
+#define LW_PSR_LOSS_HISTORY_MAX 64
+
+static int64_t timespec_diff_us(const struct timespec *ts1,
+				const struct timespec *ts2)
+{
+	return (int64_t) (ts1->tv_sec - ts2->tv_sec) * 1000000 +
+	       (ts1->tv_nsec - ts2->tv_nsec) / 1000;
+}
+
+static void lw_psr_probe_account(struct lw_psr_port_priv *psr_ppriv)
+{
+	if (!psr_ppriv->probe.pending)
+		return;
+	psr_ppriv->probe.pending = false;
+	psr_ppriv->probe.loss_history <<= 1;
+	if (!psr_ppriv->probe.replied)
+		psr_ppriv->probe.loss_history |= 1;
+	if (psr_ppriv->probe.loss_history_len < LW_PSR_LOSS_HISTORY_MAX)
+		psr_ppriv->probe.loss_history_len++;
+}
+
+void lw_psr_probe_sent(struct lw_psr_port_priv *psr_ppriv)
+{
+	psr_ppriv->probe.sent_count++;
+	/* With more probes per interval, RTT is measured from the first */
+	if (psr_ppriv->probe.pending)
+		return;
+	/* Kernel receive timestamps are in CLOCK_REALTIME */
+	clock_gettime(CLOCK_REALTIME, &psr_ppriv->probe.sent);
+	psr_ppriv->probe.pending = true;
+	psr_ppriv->probe.replied = false;
+}
+
+void lw_psr_reply_received(struct lw_psr_port_priv *psr_ppriv,
+			   const struct timespec *ts)
+{
+	struct timespec now;
+	int64_t rtt;
+	int64_t delta;
+
+	psr_ppriv->reply_received = true;
+	if (!psr_ppriv->probe.pending || psr_ppriv->probe.replied)
+		return;
+	if (!ts || (!ts->tv_sec && !ts->tv_nsec)) {
+		clock_gettime(CLOCK_REALTIME, &now);
+		ts = &now;
+	}
+	rtt = timespec_diff_us(ts, &psr_ppriv->probe.sent);
+	if (rtt < 0)
+		/* Reply to some earlier probe, received before it was sent */
+		return;
+	psr_ppriv->probe.replied = true;
+	psr_ppriv->probe.rtt_last = rtt;
+	/* Follows increase slowly so permanent path change is accepted */
+	if (!psr_ppriv->probe.rtt_min || rtt < psr_ppriv->probe.rtt_min)
+		psr_ppriv->probe.rtt_min = rtt;
+	else
+		psr_ppriv->probe.rtt_min += (rtt - psr_ppriv->probe.rtt_min) / 256;
+	if (!psr_ppriv->probe.rtt_avg) {
+		psr_ppriv->probe.rtt_avg = rtt;
+		psr_ppriv->probe.rtt_jitter = rtt / 2;
+		return;
+	}
+	/* Same smoothing as TCP uses for srtt and rttvar (RFC 6298) */
+	delta = rtt - psr_ppriv->probe.rtt_avg;
+	psr_ppriv->probe.rtt_avg += delta / 8;
+	psr_ppriv->probe.rtt_jitter += ((delta < 0 ? -delta : delta) -
+					psr_ppriv->probe.rtt_jitter) / 4;
+}
 
 #define LW_PERIODIC_CB_NAME "lw_periodic"
-static int lw_psr_callback_periodic(struct teamd_context *ctx, int events, void *priv)
+
+/*
+ * Once a reply is missed on port with link up, probes are sent at
+ * fast_interval until a reply comes or the link is declared down. That
+ * way the link failure is detected in interval + missed_max * fast_interval.
+ */
+static int lw_psr_fast_update(struct teamd_context *ctx,
+			      struct lw_psr_port_priv *psr_ppriv, bool link_up)
+{
+	bool fast = link_up && psr_ppriv->missed;
+	struct timespec *interval;
+	int err;
+
+	if (!psr_ppriv->fast_interval.tv_sec &&
+	    !psr_ppriv->fast_interval.tv_nsec)
+		return 0;
+	if (fast == psr_ppriv->fast)
+		return 0;
+	interval = fast ? &psr_ppriv->fast_interval : &psr_ppriv->interval;
+	err = teamd_loop_callback_timer_set(ctx, LW_PERIODIC_CB_NAME, psr_ppriv,
+					    interval, interval);
+	if (err)
+		return err;
+	psr_ppriv->fast = fast;
+	return 0;
+}
+
+static int __lw_psr_callback_periodic(struct teamd_context *ctx, void *priv)
 {
 	struct lw_common_port_priv *common_ppriv = priv;
 	struct lw_psr_port_priv *psr_ppriv = priv;
@@ -39,6 +144,11 @@ static int lw_psr_callback_periodic(struct teamd_context *ctx, int events, void
 	bool link_up = common_ppriv->link_up;
 	int err;
 
+	/* Nothing to probe until all hosts are resolved */
+	if (psr_ppriv->resolve_pending)
+		return 0;
+
+	lw_psr_probe_account(psr_ppriv);
 	if (psr_ppriv->reply_received) {
 		link_up = true;
 		psr_ppriv->missed = 0;
@@ -53,19 +163,46 @@ static int lw_psr_callback_periodic(struct teamd_context *ctx, int events, void
 	}
 	err = teamd_link_watch_check_link_up(ctx, tdport,
 					     common_ppriv, link_up);
+	if (err)
+		return err;
+	err = teamd_link_watch_check_health(ctx, common_ppriv);
 	if (err)
 		return err;
 	psr_ppriv->reply_received = false;
+	err = lw_psr_fast_update(ctx, psr_ppriv, link_up);
+	if (err)
+		return err;
 
+	/* Socket is reopened in background, replies would not come anyway */
+	if (!psr_ppriv->sock_opened)
+		return 0;
+	if (psr_ppriv->xsk)
+		return lw_xsk_send(ctx, psr_ppriv);
+	if (psr_ppriv->tx_batch)
+		return lw_tx_batch_queue(ctx, psr_ppriv);
 	return psr_ppriv->ops->send(psr_ppriv);
 }
 
+static int lw_psr_callback_periodic(struct teamd_context *ctx, int events, void *priv)
+{
+	int err;
+
+	teamd_rt_noalloc_begin();
+	err = __lw_psr_callback_periodic(ctx, priv);
+	teamd_rt_noalloc_end();
+	return err;
+}
+
 #define LW_SOCKET_CB_NAME "lw_socket"
 static int lw_psr_callback_socket(struct teamd_context *ctx, int events, void *priv)
 {
 	struct lw_psr_port_priv *psr_ppriv = priv;
+	int err;
 
-	return psr_ppriv->ops->receive(psr_ppriv);
+	teamd_rt_noalloc_begin();
+	err = psr_ppriv->ops->receive(psr_ppriv);
+	teamd_rt_noalloc_end();
+	return err;
 }
 
 static int lw_psr_load_options(struct teamd_context *ctx,
@@ -84,6 +221,22 @@ static int lw_psr_load_options(struct teamd_context *ctx,
 	teamd_log_dbg("interval \"%d\".", tmp);
 	ms_to_timespec(&psr_ppriv->interval, tmp);
 
+	err = teamd_config_int_get(ctx, &tmp, "@.fast_interval", cpcookie);
+	if (!err) {
+		if (tmp < 0) {
+			teamd_log_err("\"fast_interval\" must not be negative number.");
+			return -EINVAL;
+		}
+		if (tmp > timespec_to_ms(&psr_ppriv->interval)) {
+			teamd_log_err("\"fast_interval\" must not be greater than \"interval\".");
+			return -EINVAL;
+		}
+	} else {
+		tmp = 0;
+	}
+	teamd_log_dbg("fast_interval \"%d\".", tmp);
+	ms_to_timespec(&psr_ppriv->fast_interval, tmp);
+
 	err = teamd_config_int_get(ctx, &tmp, "@.init_wait", cpcookie);
 	if (!err)
 		ms_to_timespec(&psr_ppriv->init_wait, tmp);
@@ -104,6 +257,43 @@ static int lw_psr_load_options(struct teamd_context *ctx,
 	teamd_log_dbg("missed_max \"%d\".", tmp);
 	psr_ppriv->missed_max = tmp;
 
+	/* Link watch may set more in its load_options */
+	psr_ppriv->probe_count = 1;
+
+	err = teamd_config_bool_get(ctx, &psr_ppriv->tx_batch_enabled,
+				    "@.tx_batch", cpcookie);
+	if (err)
+		psr_ppriv->tx_batch_enabled = false;
+	if (psr_ppriv->tx_batch_enabled && !psr_ppriv->ops->send_prepare) {
+		teamd_log_err("\"tx_batch\" is not supported by this link-watch.");
+		return -EINVAL;
+	}
+	teamd_log_dbg("tx_batch \"%d\".", psr_ppriv->tx_batch_enabled);
+
+	err = teamd_config_int_get(ctx, &tmp, "@.tx_batch_window", cpcookie);
+	if (!err) {
+		if (tmp < 0) {
+			teamd_log_err("\"tx_batch_window\" must not be negative number.");
+			return -EINVAL;
+		}
+	} else {
+		tmp = 0;
+	}
+	teamd_log_dbg("tx_batch_window \"%d\".", tmp);
+	psr_ppriv->tx_batch_window = tmp;
+
+	err = teamd_config_int_get(ctx, &tmp, "@.resolve_interval", cpcookie);
+	if (!err) {
+		if (tmp < 0) {
+			teamd_log_err("\"resolve_interval\" must not be negative number.");
+			return -EINVAL;
+		}
+	} else {
+		tmp = LW_PSR_DEFAULT_RESOLVE_INTERVAL;
+	}
+	teamd_log_dbg("resolve_interval \"%d\".", tmp);
+	psr_ppriv->resolve_interval = tmp;
+
 	return 0;
 }
 
@@ -114,12 +304,144 @@ lw_psr_ppriv_get(struct lw_common_port_priv *common_ppriv)
 }
 
 
+static int lw_psr_sock_init(struct teamd_context *ctx,
+			    struct lw_psr_port_priv *psr_ppriv)
+{
+	struct teamd_port *tdport = psr_ppriv->common.tdport;
+	int on = 1;
+	int err;
+
+	err = psr_ppriv->ops->sock_open(psr_ppriv);
+	if (err) {
+		teamd_log_err("Failed to create socket.");
+		return err;
+	}
+	/* Replies come from the shared rx ring, socket is for sending only */
+	if (psr_ppriv->rx_ring) {
+		psr_ppriv->sock_opened = true;
+		return 0;
+	}
+
+	/* For probe RTT, failure only makes it less precise */
+	if (setsockopt(psr_ppriv->sock, SOL_SOCKET, SO_TIMESTAMPNS,
+		       &on, sizeof(on)))
+		teamd_log_warn("%s: Failed to enable receive timestamps.",
+			       tdport->ifname);
+	err = teamd_loop_callback_fd_add(ctx, LW_SOCKET_CB_NAME, psr_ppriv,
+					 lw_psr_callback_socket,
+					 psr_ppriv->sock,
+					 TEAMD_LOOP_FD_EVENT_READ,
+					 TEAMD_LOOP_PRIO_LINK_WATCH);
+	if (err) {
+		teamd_log_err("Failed add socket callback.");
+		psr_ppriv->ops->sock_close(psr_ppriv);
+		return err;
+	}
+	psr_ppriv->sock_opened = true;
+	return 0;
+}
+
+static void lw_psr_sock_fini(struct teamd_context *ctx,
+			     struct lw_psr_port_priv *psr_ppriv)
+{
+	if (!psr_ppriv->sock_opened)
+		return;
+	if (!psr_ppriv->rx_ring)
+		teamd_loop_callback_del(ctx, LW_SOCKET_CB_NAME, psr_ppriv);
+	psr_ppriv->ops->sock_close(psr_ppriv);
+	psr_ppriv->sock_opened = false;
+}
+
+/*
+ * In case socket can not be opened again, no probes are sent and link
+ * goes down. Opening is retried until it succeeds.
+ */
+static int lw_psr_sock_reopen(struct teamd_context *ctx,
+			      struct lw_psr_port_priv *psr_ppriv)
+{
+	struct teamd_port *tdport = psr_ppriv->common.tdport;
+	int err;
+
+	lw_psr_sock_fini(ctx, psr_ppriv);
+	err = lw_psr_sock_init(ctx, psr_ppriv);
+	if (err) {
+		teamd_log_warn("%s: Failed to reopen socket, retrying.",
+			       tdport->ifname);
+		teamd_workq_schedule_delayed(ctx, &psr_ppriv->sock_workq,
+					     LW_PSR_SOCK_RETRY_INTERVAL);
+		return 0;
+	}
+	if (!psr_ppriv->rx_ring)
+		teamd_loop_callback_enable(ctx, LW_SOCKET_CB_NAME, psr_ppriv);
+	return 0;
+}
+
+static int lw_psr_sock_work(struct teamd_context *ctx,
+			    struct teamd_workq *workq)
+{
+	struct lw_psr_port_priv *psr_ppriv;
+
+	psr_ppriv = get_container(workq, struct lw_psr_port_priv, sock_workq);
+	return lw_psr_sock_reopen(ctx, psr_ppriv);
+}
+
+/*
+ * Socket filters of link watches match on resolved addresses, so socket
+ * is opened again once any of them changes.
+ */
+static int lw_psr_resolve_changed(struct teamd_context *ctx,
+				  struct lw_resolve *res, bool first)
+{
+	struct lw_psr_port_priv *psr_ppriv = res->priv;
+
+	if (first)
+		psr_ppriv->resolve_pending--;
+	teamd_workq_cancel_work(ctx, &psr_ppriv->sock_workq);
+	return lw_psr_sock_reopen(ctx, psr_ppriv);
+}
+
+/*
+ * Host names which are not address literals are resolved in background.
+ * Until all of them are, no probes are sent and link stays down.
+ */
+int lw_psr_resolve(struct teamd_context *ctx,
+		   struct lw_psr_port_priv *psr_ppriv, struct lw_resolve *res,
+		   int family, const char *hostname, void *addr)
+{
+	int err;
+
+	err = lw_resolve_init(ctx, res, family, hostname, addr,
+			      psr_ppriv->resolve_interval,
+			      lw_psr_resolve_changed, psr_ppriv);
+	if (err)
+		return err;
+	list_add_tail(&psr_ppriv->resolve_list, &res->list);
+	if (!res->resolved)
+		psr_ppriv->resolve_pending++;
+	return 0;
+}
+
+static void lw_psr_resolve_fini(struct teamd_context *ctx,
+				struct lw_psr_port_priv *psr_ppriv)
+{
+	struct lw_resolve *res;
+	struct lw_resolve *tmp;
+
+	list_for_each_node_entry_safe(res, tmp, &psr_ppriv->resolve_list,
+				      list) {
+		list_del(&res->list);
+		lw_resolve_fini(ctx, res);
+	}
+}
+
 int lw_psr_port_added(struct teamd_context *ctx, struct teamd_port *tdport,
 		      void *priv, void *creator_priv)
 {
 	struct lw_psr_port_priv *psr_ppriv = priv;
 	int err;
 
+	list_init(&psr_ppriv->resolve_list);
+	teamd_workq_init_work(&psr_ppriv->sock_workq, lw_psr_sock_work);
 	err = lw_psr_load_options(ctx, tdport, psr_ppriv);
 	if (err) {
 		teamd_log_err("Failed to load options.");
@@ -129,32 +451,52 @@ int lw_psr_port_added(struct teamd_context *ctx, struct teamd_port *tdport,
 	err = psr_ppriv->ops->load_options(ctx, tdport, psr_ppriv);
 	if (err) {
 		teamd_log_err("Failed to load options.");
-		return err;
+		goto resolve_fini;
 	}
 
-	err = psr_ppriv->ops->sock_open(psr_ppriv);
-	if (err) {
-		teamd_log_err("Failed to create socket.");
-		return err;
+	/*
+	 * With shared rx ring, replies are passed in by the ring and port
+	 * socket is used only to send probes.
+	 */
+	if (lw_rx_ring_enabled(ctx, psr_ppriv)) {
+		err = lw_rx_ring_subscribe(ctx, psr_ppriv);
+		if (err) {
+			teamd_log_err("%s: Failed to subscribe to rx ring.",
+				      tdport->ifname);
+			goto resolve_fini;
+		}
 	}
 
-	err = teamd_loop_callback_fd_add(ctx, LW_SOCKET_CB_NAME, psr_ppriv,
-					 lw_psr_callback_socket,
-					 psr_ppriv->sock,
-					 TEAMD_LOOP_FD_EVENT_READ);
-	if (err) {
-		teamd_log_err("Failed add socket callback.");
-		goto close_sock;
+	if (psr_ppriv->tx_batch_enabled) {
+		err = lw_tx_batch_subscribe(ctx, psr_ppriv);
+		if (err) {
+			teamd_log_err("%s: Failed to subscribe to tx batch.",
+				      tdport->ifname);
+			goto rx_ring_unsubscribe;
+		}
+	}
+
+	err = lw_psr_sock_init(ctx, psr_ppriv);
+	if (err)
+		goto tx_batch_unsubscribe;
+
+	/* Packet socket stays as it is, so it is there to fall back to */
+	if (lw_xsk_enabled(ctx, psr_ppriv)) {
+		err = lw_xsk_subscribe(ctx, psr_ppriv);
+		if (err)
+			teamd_log_warn("%s: Failed to use AF_XDP, using packet socket.",
+				       tdport->ifname);
 	}
 
 	err = teamd_loop_callback_timer_add_set(ctx, LW_PERIODIC_CB_NAME,
 						psr_ppriv,
 						lw_psr_callback_periodic,
 						&psr_ppriv->interval,
-						&psr_ppriv->init_wait);
+						&psr_ppriv->init_wait,
+						TEAMD_LOOP_PRIO_LINK_WATCH);
 	if (err) {
 		teamd_log_err("Failed add callback timer");
-		goto socket_callback_del;
+		goto xsk_unsubscribe;
 	}
 
 	err = team_set_port_user_linkup_enabled(ctx->th, tdport->ifindex, true);
@@ -164,16 +506,22 @@ int lw_psr_port_added(struct teamd_context *ctx, struct teamd_port *tdport,
 		goto periodic_callback_del;
 	}
 
-	teamd_loop_callback_enable(ctx, LW_SOCKET_CB_NAME, psr_ppriv);
+	if (!psr_ppriv->rx_ring)
+		teamd_loop_callback_enable(ctx, LW_SOCKET_CB_NAME, psr_ppriv);
 	teamd_loop_callback_enable(ctx, LW_PERIODIC_CB_NAME, psr_ppriv);
 	return 0;
 
 periodic_callback_del:
 	teamd_loop_callback_del(ctx, LW_PERIODIC_CB_NAME, psr_ppriv);
-socket_callback_del:
-	teamd_loop_callback_del(ctx, LW_SOCKET_CB_NAME, psr_ppriv);
-close_sock:
-	psr_ppriv->ops->sock_close(psr_ppriv);
+xsk_unsubscribe:
+	lw_xsk_unsubscribe(ctx, psr_ppriv);
+	lw_psr_sock_fini(ctx, psr_ppriv);
+tx_batch_unsubscribe:
+	lw_tx_batch_unsubscribe(ctx, psr_ppriv);
+rx_ring_unsubscribe:
+	lw_rx_ring_unsubscribe(ctx, psr_ppriv);
+resolve_fini:
+	lw_psr_resolve_fini(ctx, psr_ppriv);
 	return err;
 }
 
@@ -183,8 +531,12 @@ void lw_psr_port_removed(struct teamd_context *ctx, struct teamd_port *tdport,
 	struct lw_psr_port_priv *psr_ppriv = priv;
 
 	teamd_loop_callback_del(ctx, LW_PERIODIC_CB_NAME, psr_ppriv);
-	teamd_loop_callback_del(ctx, LW_SOCKET_CB_NAME, psr_ppriv);
-	psr_ppriv->ops->sock_close(psr_ppriv);
+	teamd_workq_cancel_work(ctx, &psr_ppriv->sock_workq);
+	lw_xsk_unsubscribe(ctx, psr_ppriv);
+	lw_psr_sock_fini(ctx, psr_ppriv);
+	lw_tx_batch_unsubscribe(ctx, psr_ppriv);
+	lw_rx_ring_unsubscribe(ctx, psr_ppriv);
+	lw_psr_resolve_fini(ctx, psr_ppriv);
 }
 
 int lw_psr_state_interval_get(struct teamd_context *ctx,
@@ -198,6 +550,30 @@ int lw_psr_state_interval_get(struct teamd_context *ctx,
 	return 0;
 }
 
+int lw_psr_state_fast_interval_get(struct teamd_context *ctx,
+				   struct team_state_gsc *gsc,
+				   void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+
+	gsc->data.int_val = timespec_to_ms(&psr_ppriv->fast_interval);
+	return 0;
+}
+
+int lw_psr_state_effective_interval_get(struct teamd_context *ctx,
+					struct team_state_gsc *gsc,
+					void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+
+	gsc->data.int_val = timespec_to_ms(psr_ppriv->fast ?
+					   &psr_ppriv->fast_interval :
+					   &psr_ppriv->interval);
+	return 0;
+}
+
 int lw_psr_state_init_wait_get(struct teamd_context *ctx,
 			       struct team_state_gsc *gsc,
 			       void *priv)
@@ -230,3 +606,89 @@ int lw_psr_state_missed_get(struct teamd_context *ctx,
 	gsc->data.int_val = psr_ppriv->missed;
 	return 0;
 }
+
+int lw_psr_state_probes_sent_get(struct teamd_context *ctx,
+				 struct team_state_gsc *gsc,
+				 void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+
+	gsc->data.int_val = psr_ppriv->probe.sent_count;
+	return 0;
+}
+
+int lw_psr_state_rtt_last_get(struct teamd_context *ctx,
+			      struct team_state_gsc *gsc,
+			      void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+
+	gsc->data.int_val = psr_ppriv->probe.rtt_last;
+	return 0;
+}
+
+int lw_psr_state_rtt_avg_get(struct teamd_context *ctx,
+			     struct team_state_gsc *gsc,
+			     void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+
+	gsc->data.int_val = psr_ppriv->probe.rtt_avg;
+	return 0;
+}
+
+int lw_psr_state_rtt_jitter_get(struct teamd_context *ctx,
+				struct team_state_gsc *gsc,
+				void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+
+	gsc->data.int_val = psr_ppriv->probe.rtt_jitter;
+	return 0;
+}
+
+static unsigned int lw_psr_loss_percent(struct lw_psr_port_priv *psr_ppriv)
+{
+	unsigned int len = psr_ppriv->probe.loss_history_len;
+	uint64_t history = psr_ppriv->probe.loss_history;
+
+	if (len < LW_PSR_LOSS_HISTORY_MAX)
+		history &= ((uint64_t) 1 << len) - 1;
+	return len ? __builtin_popcountll(history) * 100 / len : 0;
+}
+
+int lw_psr_state_loss_percent_get(struct teamd_context *ctx,
+				  struct team_state_gsc *gsc,
+				  void *priv)
+{
+	struct lw_common_port_priv *common_ppriv = priv;
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+
+	gsc->data.int_val = lw_psr_loss_percent(psr_ppriv);
+	return 0;
+}
+
+/*
+ * Health is share of probes replied. In case smoothed RTT gets over twice
+ * the minimal one, which means queueing somewhere on the path, it is
+ * lowered further in proportion, by one half at most.
+ */
+unsigned int lw_psr_health_get(struct lw_common_port_priv *common_ppriv)
+{
+	struct lw_psr_port_priv *psr_ppriv = lw_psr_ppriv_get(common_ppriv);
+	unsigned int health = 100 - lw_psr_loss_percent(psr_ppriv);
+	int64_t rtt_min = psr_ppriv->probe.rtt_min;
+	int64_t rtt_avg = psr_ppriv->probe.rtt_avg;
+	unsigned int rtt_factor;
+
+	if (!rtt_min || rtt_avg <= 2 * rtt_min)
+		return health;
+	rtt_factor = 200 * rtt_min / rtt_avg;
+	if (rtt_factor < 50)
+		rtt_factor = 50;
+	return health * rtt_factor / 100;
+}
@@ -0,0 +1,535 @@
+/*
+ *   teamd_lw_resolve.c - Asynchronous host name resolution for link watchers
+ *   Copyright (C) 2026 libteam contributors
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/eventfd.h>
+#include <private/misc.h>
+#include <private/list.h>
+
+#include "teamd.h"
+#include "teamd_link_watch.h"
+#include "teamd_workq.h"
+
+/*
+ * Address literals are converted right away. Other host names are looked
+ * up by getaddrinfo_a() so a slow resolver does not stall the loop. Where
+ * it is not available, names are looked up by blocking getaddrinfo() from
+ * workq, so at least not before link watch is set up. getaddrinfo_a()
+ * helper thread only signals completion through eventfd, results are
+ * picked up in the loop. Names are looked up again each resolve_interval,
+ * or sooner with backoff in case lookup fails.
+ *
+ * Lookup in progress can not always be cancelled. Such query is left
+ * orphaned. Helper thread notification may come any time later, even
+ * after the resolver is gone from the loop, so the resolver and each
+ * query are refcounted, with one reference held by the loop and one by
+ * each pending notification. Resolver eventfd is closed only once the
+ * last notification is done with it.
+ */
+
+#define LW_RESOLVE_RETRY_MIN	1000	/* ms */
+#define LW_RESOLVE_RETRY_MAX	300000	/* ms */
+
+struct lw_resolver {
+	struct teamd_context *ctx;
+#ifdef HAVE_GETADDRINFO_A
+	int efd;
+#endif
+	unsigned int refs; /* loop and pending notifications, atomic */
+	unsigned int refcount; /* lw_resolve users */
+#ifdef HAVE_GETADDRINFO_A
+	struct list_item query_list;
+#endif
+	struct {
+		unsigned int lookups;
+		unsigned int failures;
+	} stats;
+};
+
+#ifdef HAVE_GETADDRINFO_A
+struct lw_resolve_query {
+	struct list_item list;
+	struct lw_resolver *resolver;
+	struct lw_resolve *res; /* NULL once owner is gone */
+	unsigned int refs; /* loop and pending notification, atomic */
+	struct gaicb gcb;
+	struct addrinfo hints;
+	char *hostname;
+};
+#endif
+
+static size_t lw_resolve_addr_len(int family)
+{
+	return family == AF_INET ? sizeof(struct in_addr) :
+				   sizeof(struct in6_addr);
+}
+
+static void lw_resolve_addr_copy(void *addr, int family,
+				 const struct sockaddr *sa)
+{
+	if (family == AF_INET)
+		memcpy(addr, &((struct sockaddr_in *) sa)->sin_addr,
+		       sizeof(struct in_addr));
+	else
+		memcpy(addr, &((struct sockaddr_in6 *) sa)->sin6_addr,
+		       sizeof(struct in6_addr));
+}
+
+static char *lw_resolve_addr_str(struct lw_resolve *res)
+{
+	static char buf[INET6_ADDRSTRLEN];
+
+	return (char *) inet_ntop(res->family, res->addr, buf, sizeof(buf));
+}
+
+static int lw_resolve_complete(struct teamd_context *ctx,
+			       struct lw_resolve *res, int ret,
+			       struct addrinfo *result);
+
+static void lw_resolver_put(struct lw_resolver *resolver)
+{
+	if (__atomic_sub_fetch(&resolver->refs, 1, __ATOMIC_ACQ_REL))
+		return;
+#ifdef HAVE_GETADDRINFO_A
+	close(resolver->efd);
+#endif
+	free(resolver);
+}
+
+#ifdef HAVE_GETADDRINFO_A
+
+static void lw_resolve_query_put(struct lw_resolve_query *query)
+{
+	if (__atomic_sub_fetch(&query->refs, 1, __ATOMIC_ACQ_REL))
+		return;
+	if (query->gcb.ar_result)
+		freeaddrinfo(query->gcb.ar_result);
+	free(query->hostname);
+	free(query);
+}
+
+static void lw_resolver_wakeup(struct lw_resolver *resolver)
+{
+	uint64_t one = 1;
+
+	if (write(resolver->efd, &one, sizeof(one)) == -1)
+		return;
+}
+
+static void lw_resolver_notify(union sigval sv)
+{
+	struct lw_resolve_query *query = sv.sival_ptr;
+	struct lw_resolver *resolver = query->resolver;
+
+	/*
+	 * Runs in getaddrinfo_a() helper thread. Only wake up the loop and
+	 * drop references of this notification, nothing else may be done.
+	 */
+	lw_resolver_wakeup(resolver);
+	lw_resolve_query_put(query);
+	lw_resolver_put(resolver);
+}
+
+static int lw_resolve_start(struct teamd_context *ctx, struct lw_resolve *res)
+{
+	struct lw_resolver *resolver = res->resolver;
+	struct lw_resolve_query *query;
+	struct gaicb *list[1];
+	struct sigevent sev;
+	int err;
+
+	query = myzalloc(sizeof(*query));
+	if (!query)
+		return -ENOMEM;
+	query->hostname = strdup(res->hostname);
+	if (!query->hostname) {
+		err = -ENOMEM;
+		goto free_query;
+	}
+	query->resolver = resolver;
+	query->res = res;
+	query->refs = 2;
+	query->hints.ai_family = res->family;
+	query->gcb.ar_name = query->hostname;
+	query->gcb.ar_request = &query->hints;
+	list[0] = &query->gcb;
+
+	memset(&sev, 0, sizeof(sev));
+	sev.sigev_notify = SIGEV_THREAD;
+	sev.sigev_notify_function = lw_resolver_notify;
+	sev.sigev_value.sival_ptr = query;
+	__atomic_add_fetch(&resolver->refs, 1, __ATOMIC_ACQ_REL);
+	err = getaddrinfo_a(GAI_NOWAIT, list, 1, &sev);
+	if (err) {
+		teamd_log_err("getaddrinfo_a failed: %s", gai_strerror(err));
+		lw_resolver_put(resolver);
+		err = -ENOMEM;
+		goto free_hostname;
+	}
+	list_add_tail(&resolver->query_list, &query->list);
+	res->query = query;
+	resolver->stats.lookups++;
+	teamd_log_dbg("Resolving \"%s\".", res->hostname);
+	return 0;
+
+free_hostname:
+	free(query->hostname);
+free_query:
+	free(query);
+	return err;
+}
+
+/* Drops loop reference of the query, it is not processed anymore */
+static void lw_resolve_query_release(struct lw_resolve_query *query)
+{
+	list_del(&query->list);
+	lw_resolve_query_put(query);
+}
+
+/* Cancels lookup if possible, no notification comes for cancelled one */
+static bool lw_resolve_query_cancel(struct lw_resolve_query *query)
+{
+	if (gai_cancel(&query->gcb) != EAI_CANCELED)
+		return false;
+	lw_resolve_query_put(query);
+	lw_resolver_put(query->resolver);
+	return true;
+}
+
+#else
+
+static int lw_resolve_start(struct teamd_context *ctx, struct lw_resolve *res)
+{
+	struct addrinfo *result = NULL;
+	struct addrinfo hints;
+	int ret;
+	int err;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = res->family;
+	res->resolver->stats.lookups++;
+	teamd_log_dbg("Resolving \"%s\".", res->hostname);
+	ret = getaddrinfo(res->hostname, NULL, &hints, &result);
+	err = lw_resolve_complete(ctx, res, ret, result);
+	if (result)
+		freeaddrinfo(result);
+	return err;
+}
+
+#endif
+
+static int lw_resolve_complete(struct teamd_context *ctx,
+			       struct lw_resolve *res, int ret,
+			       struct addrinfo *result)
+{
+	bool first = !res->resolved;
+	char addr[sizeof(struct in6_addr)];
+	unsigned int delay;
+
+	res->query = NULL;
+	if (ret || !result) {
+		res->resolver->stats.failures++;
+		teamd_log_warn("Failed to resolve \"%s\": %s", res->hostname,
+			       gai_strerror(ret));
+		/* Keep using last known address, try again soon */
+		delay = res->retry;
+		if (res->retry < LW_RESOLVE_RETRY_MAX)
+			res->retry = res->retry * 2;
+		if (res->retry > LW_RESOLVE_RETRY_MAX)
+			res->retry = LW_RESOLVE_RETRY_MAX;
+		if (res->interval && res->retry > res->interval)
+			res->retry = res->interval;
+		teamd_workq_schedule_delayed(ctx, &res->workq, delay);
+		return 0;
+	}
+
+	res->retry = LW_RESOLVE_RETRY_MIN;
+	if (res->interval)
+		teamd_workq_schedule_delayed(ctx, &res->workq, res->interval);
+
+	lw_resolve_addr_copy(addr, res->family, result->ai_addr);
+	if (!first && !memcmp(addr, res->addr, lw_resolve_addr_len(res->family)))
+		return 0;
+	memcpy(res->addr, addr, lw_resolve_addr_len(res->family));
+	res->resolved = true;
+	teamd_log_info("\"%s\" resolved to %s.", res->hostname,
+		       lw_resolve_addr_str(res));
+	return res->changed(ctx, res, first);
+}
+
+#ifdef HAVE_GETADDRINFO_A
+static int lw_resolver_callback_efd(struct teamd_context *ctx, int events,
+				    void *priv)
+{
+	struct lw_resolver *resolver = priv;
+	struct lw_resolve_query *query;
+	struct lw_resolve_query *tmp;
+	uint64_t count;
+	int ret;
+	int err = 0;
+
+	if (read(resolver->efd, &count, sizeof(count)) == -1 &&
+	    errno != EAGAIN) {
+		teamd_log_err("Failed to read resolver eventfd.");
+		return -errno;
+	}
+	list_for_each_node_entry_safe(query, tmp, &resolver->query_list,
+				      list) {
+		ret = gai_error(&query->gcb);
+		if (ret == EAI_INPROGRESS)
+			continue;
+		if (query->res) {
+			ret = lw_resolve_complete(ctx, query->res, ret,
+						  query->gcb.ar_result);
+			if (ret && !err)
+				err = ret;
+		}
+		lw_resolve_query_release(query);
+	}
+	return err;
+}
+#endif
+
+static int lw_resolver_state_lookups_get(struct teamd_context *ctx,
+					 struct team_state_gsc *gsc,
+					 void *priv)
+{
+	struct lw_resolver *resolver = priv;
+
+	gsc->data.int_val = resolver->stats.lookups;
+	return 0;
+}
+
+static int lw_resolver_state_failures_get(struct teamd_context *ctx,
+					  struct team_state_gsc *gsc,
+					  void *priv)
+{
+	struct lw_resolver *resolver = priv;
+
+	gsc->data.int_val = resolver->stats.failures;
+	return 0;
+}
+
+static const struct teamd_state_val lw_resolver_state_vals[] = {
+	{
+		.subpath = "lookups",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_resolver_state_lookups_get,
+	},
+	{
+		.subpath = "failures",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_resolver_state_failures_get,
+	},
+};
+
+static const struct teamd_state_val lw_resolver_state_vg = {
+	.subpath = "link_watch_resolver",
+	.vals = lw_resolver_state_vals,
+	.vals_count = ARRAY_SIZE(lw_resolver_state_vals),
+};
+
+#define LW_RESOLVER_CB_NAME "lw_resolver"
+
+static int lw_resolver_create(struct teamd_context *ctx,
+			      struct lw_resolver **presolver)
+{
+	struct lw_resolver *resolver;
+	int err;
+
+	resolver = myzalloc(sizeof(*resolver));
+	if (!resolver)
+		return -ENOMEM;
+	resolver->ctx = ctx;
+	resolver->refs = 1;
+#ifdef HAVE_GETADDRINFO_A
+	list_init(&resolver->query_list);
+	resolver->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (resolver->efd == -1) {
+		err = -errno;
+		goto free_resolver;
+	}
+
+	err = teamd_loop_callback_fd_add(ctx, LW_RESOLVER_CB_NAME, resolver,
+					 lw_resolver_callback_efd,
+					 resolver->efd,
+					 TEAMD_LOOP_FD_EVENT_READ,
+					 TEAMD_LOOP_PRIO_BACKGROUND);
+	if (err) {
+		teamd_log_err("Failed add resolver callback.");
+		goto close_efd;
+	}
+#endif
+
+	err = teamd_state_val_register(ctx, &lw_resolver_state_vg, resolver);
+	if (err)
+		goto callback_del;
+
+#ifdef HAVE_GETADDRINFO_A
+	teamd_loop_callback_enable(ctx, LW_RESOLVER_CB_NAME, resolver);
+#endif
+	ctx->lw_resolver = resolver;
+	*presolver = resolver;
+	return 0;
+
+callback_del:
+#ifdef HAVE_GETADDRINFO_A
+	teamd_loop_callback_del(ctx, LW_RESOLVER_CB_NAME, resolver);
+close_efd:
+	close(resolver->efd);
+free_resolver:
+#endif
+	free(resolver);
+	return err;
+}
+
+/*
+ * Last user is gone. Orphaned lookups which can not be cancelled keep
+ * the resolver eventfd open until their notifications are done.
+ */
+static void lw_resolver_destroy(struct lw_resolver *resolver)
+{
+	struct teamd_context *ctx = resolver->ctx;
+#ifdef HAVE_GETADDRINFO_A
+	struct lw_resolve_query *query;
+	struct lw_resolve_query *tmp;
+#endif
+
+	teamd_state_val_unregister(ctx, &lw_resolver_state_vg, resolver);
+	ctx->lw_resolver = NULL;
+#ifdef HAVE_GETADDRINFO_A
+	teamd_loop_callback_del(ctx, LW_RESOLVER_CB_NAME, resolver);
+	list_for_each_node_entry_safe(query, tmp, &resolver->query_list,
+				      list) {
+		lw_resolve_query_cancel(query);
+		lw_resolve_query_release(query);
+	}
+#endif
+	lw_resolver_put(resolver);
+}
+
+static int lw_resolve_work(struct teamd_context *ctx,
+			   struct teamd_workq *workq)
+{
+	struct lw_resolve *res;
+
+	res = get_container(workq, struct lw_resolve, workq);
+	if (res->query)
+		return 0;
+	return lw_resolve_start(ctx, res);
+}
+
+int lw_resolve_init(struct teamd_context *ctx, struct lw_resolve *res,
+		    int family, const char *hostname, void *addr,
+		    unsigned int interval, lw_resolve_changed_func_t changed,
+		    void *priv)
+{
+	struct lw_resolver *resolver = ctx->lw_resolver;
+	struct addrinfo *result;
+	struct addrinfo hints;
+	int err;
+
+	memset(res, 0, sizeof(*res));
+	res->family = family;
+	res->addr = addr;
+	res->interval = interval;
+	res->retry = LW_RESOLVE_RETRY_MIN;
+	res->changed = changed;
+	res->priv = priv;
+	teamd_workq_init_work(&res->workq, lw_resolve_work);
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = family;
+	hints.ai_flags = AI_NUMERICHOST;
+	err = getaddrinfo(hostname, NULL, &hints, &result);
+	if (!err) {
+		lw_resolve_addr_copy(addr, family, result->ai_addr);
+		freeaddrinfo(result);
+		res->resolved = true;
+		return 0;
+	}
+	if (err != EAI_NONAME) {
+		teamd_log_err("getaddrinfo failed: %s", gai_strerror(err));
+		return -EINVAL;
+	}
+
+	/* Not an address literal, so it is looked up in background */
+	memset(addr, 0, lw_resolve_addr_len(family));
+	res->hostname = strdup(hostname);
+	if (!res->hostname)
+		return -ENOMEM;
+	if (!resolver) {
+		err = lw_resolver_create(ctx, &resolver);
+		if (err)
+			goto free_hostname;
+	}
+	resolver->refcount++;
+	res->resolver = resolver;
+#ifdef HAVE_GETADDRINFO_A
+	err = lw_resolve_start(ctx, res);
+	if (err)
+		goto resolver_put;
+#else
+	/* Lookup blocks, so it is not done before link watch is set up */
+	teamd_workq_schedule_work(ctx, &res->workq);
+#endif
+	return 0;
+
+#ifdef HAVE_GETADDRINFO_A
+resolver_put:
+	res->resolver = NULL;
+	if (!--resolver->refcount)
+		lw_resolver_destroy(resolver);
+#endif
+free_hostname:
+	free(res->hostname);
+	res->hostname = NULL;
+	return err;
+}
+
+void lw_resolve_fini(struct teamd_context *ctx, struct lw_resolve *res)
+{
+	struct lw_resolver *resolver = res->resolver;
+#ifdef HAVE_GETADDRINFO_A
+	struct lw_resolve_query *query = res->query;
+#endif
+
+	if (!resolver)
+		return;
+	teamd_workq_cancel_work(ctx, &res->workq);
+#ifdef HAVE_GETADDRINFO_A
+	if (query) {
+		if (lw_resolve_query_cancel(query))
+			lw_resolve_query_release(query);
+		else
+			query->res = NULL;
+	}
+#endif
+	free(res->hostname);
+	res->hostname = NULL;
+	res->resolver = NULL;
+	if (!--resolver->refcount)
+		lw_resolver_destroy(resolver);
+}
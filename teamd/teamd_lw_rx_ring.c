@@ -0,0 +1,486 @@
+/*
+ *   teamd_lw_rx_ring.c - Shared receive ring for ping based link watchers
+ *   Copyright (C) 2026 libteam contributors
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#include <private/misc.h>
+#include <private/list.h>
+
+#include "teamd.h"
+#include "teamd_link_watch.h"
+#include "teamd_config.h"
+#include "teamd_realtime.h"
+
+/*
+ * Instead of packet socket per watcher, all watchers of the same protocol
+ * share one TPACKET_V3 socket. Frames are read directly from the mmaped
+ * ring, a whole block of them per wakeup, and are passed to watchers by
+ * ingress ifindex.
+ *
+ * Socket has to see frames before they get to the team rx_handler,
+ * otherwise frames received on inactive ports would not be delivered.
+ * So it is bound to ETH_P_ALL and BPF filter built of ifindexes of
+ * subscribed ports and the protocol filter of the watcher drops anything
+ * else in kernel.
+ */
+
+#define LW_RX_RING_BLOCK_SIZE	(1 << 14)
+#define LW_RX_RING_BLOCK_COUNT	8
+#define LW_RX_RING_FRAME_SIZE	(1 << 11)
+/* Max time partly filled block waits before it is passed to teamd */
+#define LW_RX_RING_BLOCK_TOV_MS	2
+/* Limited by 8-bit BPF jump offsets, see lw_rx_ring_filter_update() */
+#define LW_RX_RING_MAX_IFINDEXES	250
+
+struct lw_rx_ring {
+	struct list_item list;
+	struct teamd_context *ctx;
+	const char *name;
+	unsigned short protocol; /* host byte order */
+	const struct sock_fprog *fprog;
+	int sock;
+	uint8_t *map;
+	unsigned int block_idx;
+	struct list_item sub_list;
+	unsigned int sub_count;
+	struct {
+		unsigned int wakeups;
+		unsigned int blocks;
+		unsigned int frames;
+		unsigned int delivered;
+	} stats;
+};
+
+/* Watchers of the same protocol with different filters get own rings */
+static struct lw_rx_ring *lw_rx_ring_find(struct teamd_context *ctx,
+					  const struct lw_psr_ops *ops)
+{
+	struct lw_rx_ring *ring;
+
+	list_for_each_node_entry(ring, &ctx->lw_rx_ring_list, list) {
+		if (ring->protocol == ops->rx_ring_protocol &&
+		    ring->fprog == ops->rx_ring_fprog)
+			return ring;
+	}
+	return NULL;
+}
+
+static int lw_rx_ring_filter_update(struct lw_rx_ring *ring)
+{
+	const struct sock_fprog *base = ring->fprog;
+	struct lw_psr_port_priv *psr_ppriv;
+	struct sock_filter *flt;
+	struct sock_fprog fprog;
+	uint32_t ifindexes[LW_RX_RING_MAX_IFINDEXES];
+	unsigned int count = 0;
+	unsigned int drop;
+	unsigned int i;
+	int ret;
+
+	list_for_each_node_entry(psr_ppriv, &ring->sub_list, rx_ring_list) {
+		uint32_t ifindex = psr_ppriv->common.tdport->ifindex;
+
+		for (i = 0; i < count; i++)
+			if (ifindexes[i] == ifindex)
+				break;
+		if (i < count)
+			continue;
+		if (count == LW_RX_RING_MAX_IFINDEXES)
+			return -E2BIG;
+		ifindexes[count++] = ifindex;
+	}
+
+	/*
+	 * 0:        ld pkttype; jeq outgoing -> drop
+	 * 2:        ld protocol; jne ring protocol -> drop
+	 * 4:        ld ifindex
+	 * 5:        jeq ifindex[i] -> base (for each ifindex)
+	 * drop:     ret 0
+	 * drop + 1: base protocol filter of the watcher
+	 */
+	drop = 5 + count;
+	flt = calloc(drop + 1 + base->len, sizeof(*flt));
+	if (!flt)
+		return -ENOMEM;
+	flt[0] = (struct sock_filter) BPF_STMT(BPF_LD + BPF_B + BPF_ABS,
+					       SKF_AD_OFF + SKF_AD_PKTTYPE);
+	flt[1] = (struct sock_filter) BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,
+					       PACKET_OUTGOING, drop - 2, 0);
+	flt[2] = (struct sock_filter) BPF_STMT(BPF_LD + BPF_H + BPF_ABS,
+					       SKF_AD_OFF + SKF_AD_PROTOCOL);
+	flt[3] = (struct sock_filter) BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,
+					       ring->protocol, 0, drop - 4);
+	flt[4] = (struct sock_filter) BPF_STMT(BPF_LD + BPF_W + BPF_ABS,
+					       SKF_AD_OFF + SKF_AD_IFINDEX);
+	for (i = 0; i < count; i++)
+		flt[5 + i] = (struct sock_filter)
+				BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,
+					 ifindexes[i], count - i, 0);
+	flt[drop] = (struct sock_filter) BPF_STMT(BPF_RET + BPF_K, 0);
+	memcpy(&flt[drop + 1], base->filter, base->len * sizeof(*flt));
+
+	fprog.len = drop + 1 + base->len;
+	fprog.filter = flt;
+	ret = setsockopt(ring->sock, SOL_SOCKET, SO_ATTACH_FILTER,
+			 &fprog, sizeof(fprog));
+	free(flt);
+	if (ret == -1) {
+		teamd_log_err("Failed to attach rx ring filter.");
+		return -errno;
+	}
+	return 0;
+}
+
+static void lw_rx_ring_frame_deliver(struct lw_rx_ring *ring,
+				     struct tpacket3_hdr *hdr)
+{
+	struct lw_psr_port_priv *psr_ppriv;
+	struct sockaddr_ll *ll_from;
+	struct timespec ts;
+	int vlanid = -1;
+
+	ll_from = (struct sockaddr_ll *)
+		  ((uint8_t *) hdr + TPACKET_ALIGN(sizeof(*hdr)));
+	ts.tv_sec = hdr->tp_sec;
+	ts.tv_nsec = hdr->tp_nsec;
+	if (hdr->tp_status & TP_STATUS_VLAN_VALID)
+		vlanid = hdr->hv1.tp_vlan_tci & 0xfff;
+
+	ring->stats.frames++;
+	list_for_each_node_entry(psr_ppriv, &ring->sub_list, rx_ring_list) {
+		if (psr_ppriv->common.tdport->ifindex != ll_from->sll_ifindex)
+			continue;
+		psr_ppriv->ops->receive_frame(psr_ppriv,
+					      (uint8_t *) hdr + hdr->tp_net,
+					      hdr->tp_snaplen, ll_from, vlanid,
+					      &ts);
+		ring->stats.delivered++;
+	}
+}
+
+static int lw_rx_ring_callback_socket(struct teamd_context *ctx, int events,
+				      void *priv)
+{
+	struct lw_rx_ring *ring = priv;
+	struct tpacket_block_desc *bd;
+	struct tpacket3_hdr *hdr;
+	unsigned int i;
+
+	teamd_rt_noalloc_begin();
+	ring->stats.wakeups++;
+	while (true) {
+		bd = (struct tpacket_block_desc *)
+		     (ring->map + ring->block_idx * LW_RX_RING_BLOCK_SIZE);
+		if (!(__atomic_load_n(&bd->hdr.bh1.block_status,
+				      __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+			break;
+
+		hdr = (struct tpacket3_hdr *)
+		      ((uint8_t *) bd + bd->hdr.bh1.offset_to_first_pkt);
+		for (i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+			lw_rx_ring_frame_deliver(ring, hdr);
+			hdr = (struct tpacket3_hdr *)
+			      ((uint8_t *) hdr + hdr->tp_next_offset);
+		}
+
+		/* Hand the block back to kernel */
+		__atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL,
+				 __ATOMIC_RELEASE);
+		ring->block_idx = (ring->block_idx + 1) %
+				  LW_RX_RING_BLOCK_COUNT;
+		ring->stats.blocks++;
+	}
+	teamd_rt_noalloc_end();
+	return 0;
+}
+
+static int lw_rx_ring_sock_open(struct lw_rx_ring *ring)
+{
+	struct tpacket_req3 req;
+	struct sockaddr_ll ll_my;
+	int version = TPACKET_V3;
+	size_t map_size = LW_RX_RING_BLOCK_SIZE * LW_RX_RING_BLOCK_COUNT;
+	int ret;
+	int err;
+
+	ring->sock = socket(PF_PACKET, SOCK_DGRAM, 0);
+	if (ring->sock == -1) {
+		teamd_log_err("Failed to create packet socket.");
+		return -errno;
+	}
+
+	ret = setsockopt(ring->sock, SOL_PACKET, PACKET_VERSION,
+			 &version, sizeof(version));
+	if (ret == -1) {
+		teamd_log_err("Failed to set TPACKET_V3.");
+		err = -errno;
+		goto close_sock;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = LW_RX_RING_BLOCK_SIZE;
+	req.tp_block_nr = LW_RX_RING_BLOCK_COUNT;
+	req.tp_frame_size = LW_RX_RING_FRAME_SIZE;
+	req.tp_frame_nr = map_size / LW_RX_RING_FRAME_SIZE;
+	req.tp_retire_blk_tov = LW_RX_RING_BLOCK_TOV_MS;
+	ret = setsockopt(ring->sock, SOL_PACKET, PACKET_RX_RING,
+			 &req, sizeof(req));
+	if (ret == -1) {
+		teamd_log_err("Failed to set up rx ring.");
+		err = -errno;
+		goto close_sock;
+	}
+
+	ring->map = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_LOCKED, ring->sock, 0);
+	if (ring->map == MAP_FAILED) {
+		teamd_log_err("Failed to map rx ring.");
+		err = -errno;
+		goto close_sock;
+	}
+
+	/* Filter first, so nothing unwanted gets in before bind */
+	err = lw_rx_ring_filter_update(ring);
+	if (err)
+		goto unmap;
+
+	memset(&ll_my, 0, sizeof(ll_my));
+	ll_my.sll_family = AF_PACKET;
+	ll_my.sll_protocol = htons(ETH_P_ALL);
+	ret = bind(ring->sock, (struct sockaddr *) &ll_my, sizeof(ll_my));
+	if (ret == -1) {
+		teamd_log_err("Failed to bind rx ring socket.");
+		err = -errno;
+		goto unmap;
+	}
+	return 0;
+
+unmap:
+	munmap(ring->map, map_size);
+close_sock:
+	close(ring->sock);
+	return err;
+}
+
+static void lw_rx_ring_sock_close(struct lw_rx_ring *ring)
+{
+	munmap(ring->map, LW_RX_RING_BLOCK_SIZE * LW_RX_RING_BLOCK_COUNT);
+	close(ring->sock);
+}
+
+static int lw_rx_ring_state_wakeups_get(struct teamd_context *ctx,
+					struct team_state_gsc *gsc,
+					void *priv)
+{
+	struct lw_rx_ring *ring = priv;
+
+	gsc->data.int_val = ring->stats.wakeups;
+	return 0;
+}
+
+static int lw_rx_ring_state_blocks_get(struct teamd_context *ctx,
+				       struct team_state_gsc *gsc,
+				       void *priv)
+{
+	struct lw_rx_ring *ring = priv;
+
+	gsc->data.int_val = ring->stats.blocks;
+	return 0;
+}
+
+static int lw_rx_ring_state_frames_get(struct teamd_context *ctx,
+				       struct team_state_gsc *gsc,
+				       void *priv)
+{
+	struct lw_rx_ring *ring = priv;
+
+	gsc->data.int_val = ring->stats.frames;
+	return 0;
+}
+
+static int lw_rx_ring_state_delivered_get(struct teamd_context *ctx,
+					  struct team_state_gsc *gsc,
+					  void *priv)
+{
+	struct lw_rx_ring *ring = priv;
+
+	gsc->data.int_val = ring->stats.delivered;
+	return 0;
+}
+
+static const struct teamd_state_val lw_rx_ring_state_vals[] = {
+	{
+		.subpath = "wakeups",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_rx_ring_state_wakeups_get,
+	},
+	{
+		.subpath = "blocks",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_rx_ring_state_blocks_get,
+	},
+	{
+		.subpath = "frames",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_rx_ring_state_frames_get,
+	},
+	{
+		.subpath = "delivered",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_rx_ring_state_delivered_get,
+	},
+};
+
+static const struct teamd_state_val lw_rx_ring_state_vg = {
+	.vals = lw_rx_ring_state_vals,
+	.vals_count = ARRAY_SIZE(lw_rx_ring_state_vals),
+};
+
+#define LW_RX_RING_CB_NAME "lw_rx_ring"
+
+static int lw_rx_ring_create(struct teamd_context *ctx,
+			     struct lw_rx_ring **pring,
+			     struct lw_psr_port_priv *psr_ppriv)
+{
+	const struct lw_psr_ops *ops = psr_ppriv->ops;
+	struct lw_rx_ring *ring;
+	int err;
+
+	ring = myzalloc(sizeof(*ring));
+	if (!ring)
+		return -ENOMEM;
+	ring->ctx = ctx;
+	ring->name = ops->proto_name;
+	ring->protocol = ops->rx_ring_protocol;
+	ring->fprog = ops->rx_ring_fprog;
+	list_init(&ring->sub_list);
+	/* Filter is built of subscribers, the first one has to be there */
+	list_add_tail(&ring->sub_list, &psr_ppriv->rx_ring_list);
+
+	err = lw_rx_ring_sock_open(ring);
+	if (err)
+		goto free_ring;
+
+	err = teamd_loop_callback_fd_add(ctx, LW_RX_RING_CB_NAME, ring,
+					 lw_rx_ring_callback_socket,
+					 ring->sock,
+					 TEAMD_LOOP_FD_EVENT_READ,
+					 TEAMD_LOOP_PRIO_LINK_WATCH);
+	if (err) {
+		teamd_log_err("Failed add rx ring callback.");
+		goto sock_close;
+	}
+
+	err = teamd_state_val_register_ex(ctx, &lw_rx_ring_state_vg, ring,
+					  NULL, "link_watch_rx_ring.%s",
+					  ring->name);
+	if (err)
+		goto callback_del;
+
+	teamd_loop_callback_enable(ctx, LW_RX_RING_CB_NAME, ring);
+	list_add(&ctx->lw_rx_ring_list, &ring->list);
+	teamd_log_dbg("Created %s link watch rx ring.", ring->name);
+	*pring = ring;
+	return 0;
+
+callback_del:
+	teamd_loop_callback_del(ctx, LW_RX_RING_CB_NAME, ring);
+sock_close:
+	lw_rx_ring_sock_close(ring);
+free_ring:
+	list_del(&psr_ppriv->rx_ring_list);
+	free(ring);
+	return err;
+}
+
+static void lw_rx_ring_destroy(struct lw_rx_ring *ring)
+{
+	struct teamd_context *ctx = ring->ctx;
+
+	list_del(&ring->list);
+	teamd_state_val_unregister(ctx, &lw_rx_ring_state_vg, ring);
+	teamd_loop_callback_del(ctx, LW_RX_RING_CB_NAME, ring);
+	lw_rx_ring_sock_close(ring);
+	teamd_log_dbg("Destroyed %s link watch rx ring.", ring->name);
+	free(ring);
+}
+
+bool lw_rx_ring_enabled(struct teamd_context *ctx,
+			struct lw_psr_port_priv *psr_ppriv)
+{
+	bool enabled;
+	int err;
+
+	if (!psr_ppriv->ops->receive_frame)
+		return false;
+	err = teamd_config_bool_get(ctx, &enabled, "$.link_watch_rx_ring");
+	return !err && enabled;
+}
+
+int lw_rx_ring_subscribe(struct teamd_context *ctx,
+			 struct lw_psr_port_priv *psr_ppriv)
+{
+	struct lw_rx_ring *ring;
+	int err;
+
+	ring = lw_rx_ring_find(ctx, psr_ppriv->ops);
+	if (!ring) {
+		/* Creation adds the first subscriber */
+		err = lw_rx_ring_create(ctx, &ring, psr_ppriv);
+		if (err)
+			return err;
+	} else {
+		list_add_tail(&ring->sub_list, &psr_ppriv->rx_ring_list);
+		err = lw_rx_ring_filter_update(ring);
+		if (err) {
+			list_del(&psr_ppriv->rx_ring_list);
+			return err;
+		}
+	}
+	ring->sub_count++;
+	psr_ppriv->rx_ring = ring;
+	return 0;
+}
+
+void lw_rx_ring_unsubscribe(struct teamd_context *ctx,
+			    struct lw_psr_port_priv *psr_ppriv)
+{
+	struct lw_rx_ring *ring = psr_ppriv->rx_ring;
+
+	if (!ring)
+		return;
+	list_del(&psr_ppriv->rx_ring_list);
+	psr_ppriv->rx_ring = NULL;
+	if (!--ring->sub_count) {
+		lw_rx_ring_destroy(ring);
+		return;
+	}
+	if (lw_rx_ring_filter_update(ring))
+		/* Stale ifindex in filter only costs a bit of filtering */
+		teamd_log_warn("Failed to update %s rx ring filter.",
+			       ring->name);
+}
@@ -183,7 +183,8 @@ static int lw_tipc_topsrv_subscribe(struct teamd_context *ctx, struct lw_tipc_po
 	err = teamd_loop_callback_fd_add(ctx, LW_TIPC_TOPSRV_SOCKET, priv,
 				 lw_tipc_callback_socket,
 				 priv->topsrv_sock,
-				 TEAMD_LOOP_FD_EVENT_READ);
+				 TEAMD_LOOP_FD_EVENT_READ,
+				 TEAMD_LOOP_PRIO_LINK_WATCH);
 	if (err) {
 		teamd_log_err("Failed to add socket callback");
 		err = -errno;
@@ -0,0 +1,352 @@
+/*
+ *   teamd_lw_tx_batch.c - Batched probe sending for ping based link watchers
+ *   Copyright (C) 2026 libteam contributors
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <private/misc.h>
+#include <private/list.h>
+
+#include "teamd.h"
+#include "teamd_link_watch.h"
+#include "teamd_workq.h"
+
+/*
+ * Probes of all watchers of the same protocol which use batching are
+ * queued here instead of being sent right away. Queue is flushed by
+ * a single sendmmsg() on a socket which is not bound to any port, each
+ * message carries its own destination ifindex or scope. That is done once
+ * link watch callbacks of the loop iteration are processed or, in case
+ * tx_batch_window is set, from link watch priority timer. Periodic timers
+ * of ports which expire in the same loop iteration, or within the window,
+ * so end up in one syscall.
+ */
+
+#define LW_TX_BATCH_MAX_MSGS	64
+
+struct lw_tx_batch {
+	struct list_item list;
+	struct teamd_context *ctx;
+	const char *name;
+	const struct lw_psr_ops *ops;
+	int sock;
+	unsigned int refcount;
+	struct teamd_workq flush_workq;
+	bool window_armed;
+	unsigned int count;
+	struct lw_tx_batch_msg msgs[LW_TX_BATCH_MAX_MSGS];
+	struct mmsghdr mmsgs[LW_TX_BATCH_MAX_MSGS];
+	struct iovec iovs[LW_TX_BATCH_MAX_MSGS];
+	struct {
+		unsigned int rounds;
+		unsigned int probes;
+		unsigned int syscalls;
+	} stats;
+};
+
+static struct lw_tx_batch *lw_tx_batch_find(struct teamd_context *ctx,
+					    const struct lw_psr_ops *ops)
+{
+	struct lw_tx_batch *batch;
+
+	list_for_each_node_entry(batch, &ctx->lw_tx_batch_list, list) {
+		if (batch->ops == ops)
+			return batch;
+	}
+	return NULL;
+}
+
+static int lw_tx_batch_flush(struct lw_tx_batch *batch)
+{
+	unsigned int sent = 0;
+	unsigned int i;
+	int ret;
+	int err = 0;
+
+	if (!batch->count)
+		return 0;
+
+	for (i = 0; i < batch->count; i++) {
+		batch->iovs[i].iov_len = batch->msgs[i].len;
+		batch->mmsgs[i].msg_hdr.msg_namelen = batch->msgs[i].addr_len;
+	}
+
+	while (sent < batch->count) {
+		ret = sendmmsg(batch->sock, &batch->mmsgs[sent],
+			       batch->count - sent, 0);
+		batch->stats.syscalls++;
+		if (ret != -1) {
+			for (i = sent; i < sent + ret; i++)
+				lw_psr_probe_sent(batch->msgs[i].psr_ppriv);
+			sent += ret;
+			continue;
+		}
+		/* Error always belongs to the first message not sent */
+		switch (errno) {
+		case EINTR:
+			continue;
+		case ENETDOWN:
+		case ENETUNREACH:
+		case EADDRNOTAVAIL:
+		case ENXIO:
+		case ENODEV: /* port may be gone already */
+			sent++;
+			continue;
+		default:
+			teamd_log_err("sendmmsg failed.");
+			err = -errno;
+			goto out;
+		}
+	}
+out:
+	batch->count = 0;
+	batch->stats.rounds++;
+	return err;
+}
+
+static int lw_tx_batch_flush_work(struct teamd_context *ctx,
+				  struct teamd_workq *workq)
+{
+	struct lw_tx_batch *batch;
+
+	batch = get_container(workq, struct lw_tx_batch, flush_workq);
+	return lw_tx_batch_flush(batch);
+}
+
+#define LW_TX_BATCH_WINDOW_CB_NAME "lw_tx_batch_window"
+
+static int lw_tx_batch_callback_window(struct teamd_context *ctx, int events,
+				       void *priv)
+{
+	struct lw_tx_batch *batch = priv;
+
+	/* Timer is one-shot, it is not armed anymore */
+	batch->window_armed = false;
+	return lw_tx_batch_flush(batch);
+}
+
+static void lw_tx_batch_window_arm(struct teamd_context *ctx,
+				   struct lw_tx_batch *batch,
+				   unsigned int window)
+{
+	struct timespec delay;
+
+	/* Window is opened by the first probe queued, others join it */
+	if (batch->window_armed)
+		return;
+	ms_to_timespec(&delay, window);
+	teamd_loop_callback_timer_set(ctx, LW_TX_BATCH_WINDOW_CB_NAME, batch,
+				      NULL, &delay);
+	teamd_loop_callback_enable(ctx, LW_TX_BATCH_WINDOW_CB_NAME, batch);
+	batch->window_armed = true;
+}
+
+int lw_tx_batch_queue(struct teamd_context *ctx,
+		      struct lw_psr_port_priv *psr_ppriv)
+{
+	struct lw_tx_batch *batch = psr_ppriv->tx_batch;
+	struct lw_tx_batch_msg *msg;
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < psr_ppriv->probe_count; i++) {
+		msg = &batch->msgs[batch->count];
+		err = psr_ppriv->ops->send_prepare(psr_ppriv, msg, i);
+		if (err)
+			return err;
+		if (!msg->len)
+			continue;
+		msg->psr_ppriv = psr_ppriv;
+		batch->count++;
+		batch->stats.probes++;
+		if (batch->count == LW_TX_BATCH_MAX_MSGS) {
+			teamd_workq_cancel_work(ctx, &batch->flush_workq);
+			err = lw_tx_batch_flush(batch);
+			if (err)
+				return err;
+		}
+	}
+	if (!batch->count)
+		return 0;
+	if (psr_ppriv->tx_batch_window)
+		lw_tx_batch_window_arm(ctx, batch, psr_ppriv->tx_batch_window);
+	else
+		teamd_workq_schedule_after_dispatch(ctx, &batch->flush_workq);
+	return 0;
+}
+
+static int lw_tx_batch_state_rounds_get(struct teamd_context *ctx,
+					struct team_state_gsc *gsc,
+					void *priv)
+{
+	struct lw_tx_batch *batch = priv;
+
+	gsc->data.int_val = batch->stats.rounds;
+	return 0;
+}
+
+static int lw_tx_batch_state_probes_get(struct teamd_context *ctx,
+					struct team_state_gsc *gsc,
+					void *priv)
+{
+	struct lw_tx_batch *batch = priv;
+
+	gsc->data.int_val = batch->stats.probes;
+	return 0;
+}
+
+static int lw_tx_batch_state_syscalls_get(struct teamd_context *ctx,
+					  struct team_state_gsc *gsc,
+					  void *priv)
+{
+	struct lw_tx_batch *batch = priv;
+
+	gsc->data.int_val = batch->stats.syscalls;
+	return 0;
+}
+
+static const struct teamd_state_val lw_tx_batch_state_vals[] = {
+	{
+		.subpath = "rounds",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_tx_batch_state_rounds_get,
+	},
+	{
+		.subpath = "probes",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_tx_batch_state_probes_get,
+	},
+	{
+		.subpath = "syscalls",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_tx_batch_state_syscalls_get,
+	},
+};
+
+static const struct teamd_state_val lw_tx_batch_state_vg = {
+	.vals = lw_tx_batch_state_vals,
+	.vals_count = ARRAY_SIZE(lw_tx_batch_state_vals),
+};
+
+static int lw_tx_batch_create(struct teamd_context *ctx,
+			      struct lw_tx_batch **pbatch,
+			      const struct lw_psr_ops *ops)
+{
+	struct lw_tx_batch *batch;
+	unsigned int i;
+	int err;
+
+	batch = myzalloc(sizeof(*batch));
+	if (!batch)
+		return -ENOMEM;
+	batch->ctx = ctx;
+	batch->name = ops->proto_name;
+	batch->ops = ops;
+	teamd_workq_init_work(&batch->flush_workq, lw_tx_batch_flush_work);
+	for (i = 0; i < LW_TX_BATCH_MAX_MSGS; i++) {
+		batch->iovs[i].iov_base = batch->msgs[i].buf;
+		batch->mmsgs[i].msg_hdr.msg_iov = &batch->iovs[i];
+		batch->mmsgs[i].msg_hdr.msg_iovlen = 1;
+		batch->mmsgs[i].msg_hdr.msg_name = &batch->msgs[i].addr;
+	}
+
+	err = ops->tx_batch_sock_open(&batch->sock);
+	if (err)
+		goto free_batch;
+
+	err = teamd_loop_callback_timer_add(ctx, LW_TX_BATCH_WINDOW_CB_NAME,
+					    batch, lw_tx_batch_callback_window,
+					    TEAMD_LOOP_PRIO_LINK_WATCH);
+	if (err)
+		goto close_sock;
+
+	err = teamd_state_val_register_ex(ctx, &lw_tx_batch_state_vg, batch,
+					  NULL, "link_watch_tx_batch.%s",
+					  batch->name);
+	if (err)
+		goto window_callback_del;
+
+	list_add(&ctx->lw_tx_batch_list, &batch->list);
+	teamd_log_dbg("Created %s link watch tx batch.", batch->name);
+	*pbatch = batch;
+	return 0;
+
+window_callback_del:
+	teamd_loop_callback_del(ctx, LW_TX_BATCH_WINDOW_CB_NAME, batch);
+close_sock:
+	close(batch->sock);
+free_batch:
+	free(batch);
+	return err;
+}
+
+static void lw_tx_batch_destroy(struct lw_tx_batch *batch)
+{
+	struct teamd_context *ctx = batch->ctx;
+
+	list_del(&batch->list);
+	/* Probes still queued are dropped */
+	teamd_workq_cancel_work(ctx, &batch->flush_workq);
+	teamd_loop_callback_del(ctx, LW_TX_BATCH_WINDOW_CB_NAME, batch);
+	teamd_state_val_unregister(ctx, &lw_tx_batch_state_vg, batch);
+	close(batch->sock);
+	teamd_log_dbg("Destroyed %s link watch tx batch.", batch->name);
+	free(batch);
+}
+
+int lw_tx_batch_subscribe(struct teamd_context *ctx,
+			  struct lw_psr_port_priv *psr_ppriv)
+{
+	struct lw_tx_batch *batch;
+	int err;
+
+	batch = lw_tx_batch_find(ctx, psr_ppriv->ops);
+	if (!batch) {
+		err = lw_tx_batch_create(ctx, &batch, psr_ppriv->ops);
+		if (err)
+			return err;
+	}
+	batch->refcount++;
+	psr_ppriv->tx_batch = batch;
+	return 0;
+}
+
+void lw_tx_batch_unsubscribe(struct teamd_context *ctx,
+			     struct lw_psr_port_priv *psr_ppriv)
+{
+	struct lw_tx_batch *batch = psr_ppriv->tx_batch;
+	unsigned int i, j;
+
+	if (!batch)
+		return;
+	/* Drop probes of this port still in queue, psr_ppriv is to be freed */
+	for (i = 0, j = 0; i < batch->count; i++) {
+		if (batch->msgs[i].psr_ppriv == psr_ppriv)
+			continue;
+		if (i != j)
+			batch->msgs[j] = batch->msgs[i];
+		j++;
+	}
+	batch->count = j;
+	psr_ppriv->tx_batch = NULL;
+	if (!--batch->refcount)
+		lw_tx_batch_destroy(batch);
+}
@@ -0,0 +1,979 @@
+/*
+ *   teamd_lw_xsk.c - AF_XDP probe I/O for ping based link watchers
+ *   Copyright (C) 2026 libteam contributors
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#ifdef HAVE_LINUX_IF_XDP_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/icmp6.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <linux/bpf.h>
+#include <private/misc.h>
+#include <private/list.h>
+#include <team.h>
+
+#include "teamd.h"
+#include "teamd_link_watch.h"
+#include "teamd_config.h"
+#include "teamd_realtime.h"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+/*
+ * All watchers on a port which use AF_XDP share one XDP program and one
+ * XSK bound to a single queue of the port. The program redirects to the
+ * XSK only ICMP and ICMPv6 echo replies with identifiers of subscribed
+ * watchers, anything else is passed to the stack. Replies are so read
+ * from the XSK rx ring and probes are put to its tx ring, frames never
+ * get copied through socket calls.
+ *
+ * Frames redirected are not seen by the stack at all, that is why only
+ * watchers whose replies are of no use to it may subscribe. ARP and NA
+ * replies are needed by the neighbour subsystem, those are left to
+ * packet sockets. Port packet socket of a watcher stays open, replies
+ * received on other queues of the port still get there.
+ *
+ * Everything is set up by plain bpf() and AF_XDP socket calls. Program
+ * is attached by BPF link, so it is detached once teamd is gone, even in
+ * case it crashes. In case anything fails, watcher falls back to its
+ * packet socket.
+ */
+
+#define LW_XSK_FRAME_SIZE	2048
+#define LW_XSK_RX_FRAMES	64
+#define LW_XSK_TX_FRAMES	64
+#define LW_XSK_FRAMES		(LW_XSK_RX_FRAMES + LW_XSK_TX_FRAMES)
+#define LW_XSK_RING_SIZE	64
+#define LW_XSK_MAX_SUBS		32
+#define LW_XSK_PROG_MAX_LEN	(32 + 2 * LW_XSK_MAX_SUBS)
+
+struct lw_xsk_ring {
+	uint32_t *producer;
+	uint32_t *consumer;
+	uint32_t *flags;
+	void *desc;
+	uint32_t mask;
+	uint8_t *map;
+	size_t map_len;
+};
+
+struct lw_xsk {
+	struct list_item list;
+	struct teamd_context *ctx;
+	struct teamd_port *tdport;
+	uint32_t ifindex;
+	uint32_t queue;
+	const char *mode;
+	int sock;
+	uint8_t *umem;
+	struct lw_xsk_ring fill;
+	struct lw_xsk_ring comp;
+	struct lw_xsk_ring rx;
+	struct lw_xsk_ring tx;
+	uint64_t tx_free[LW_XSK_TX_FRAMES];
+	unsigned int tx_free_count;
+	int map_fd;
+	int prog_fd;
+	int link_fd;
+	struct list_item sub_list;
+	unsigned int sub_count;
+	struct {
+		unsigned int rx_frames;
+		unsigned int delivered;
+		unsigned int tx_frames;
+		unsigned int tx_dropped;
+		unsigned int wakeups;
+	} stats;
+};
+
+static int sys_bpf(enum bpf_cmd cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static uint64_t ptr_to_u64(const void *ptr)
+{
+	return (uint64_t) (unsigned long) ptr;
+}
+
+/* XDP program is assembled here, jumps are to labels patched at the end */
+
+enum lw_xsk_label {
+	LW_XSK_LABEL_IPV6,
+	LW_XSK_LABEL_PASS,
+	LW_XSK_LABEL_REDIRECT,
+	LW_XSK_LABEL_COUNT,
+};
+
+struct lw_xsk_prog {
+	struct bpf_insn insns[LW_XSK_PROG_MAX_LEN];
+	unsigned int len;
+	int labels[LW_XSK_LABEL_COUNT];
+	int fixups[LW_XSK_PROG_MAX_LEN]; /* label jump goes to, or -1 */
+};
+
+static void prog_insn(struct lw_xsk_prog *prog, uint8_t code, uint8_t dst,
+		      uint8_t src, int16_t off, int32_t imm)
+{
+	struct bpf_insn *insn = &prog->insns[prog->len];
+
+	insn->code = code;
+	insn->dst_reg = dst;
+	insn->src_reg = src;
+	insn->off = off;
+	insn->imm = imm;
+	prog->fixups[prog->len++] = -1;
+}
+
+static void prog_jmp(struct lw_xsk_prog *prog, uint8_t op, uint8_t dst,
+		     uint8_t src, int32_t imm, enum lw_xsk_label label)
+{
+	prog_insn(prog, BPF_JMP | op | (src ? BPF_X : BPF_K), dst, src, 0, imm);
+	prog->fixups[prog->len - 1] = label;
+}
+
+static void prog_label(struct lw_xsk_prog *prog, enum lw_xsk_label label)
+{
+	prog->labels[label] = prog->len;
+}
+
+static void prog_ldx(struct lw_xsk_prog *prog, uint8_t size, uint8_t dst,
+		     uint8_t src, int16_t off)
+{
+	prog_insn(prog, BPF_LDX | BPF_MEM | size, dst, src, off, 0);
+}
+
+/* Loads byte, half or word of packet at off to r5, r2 points to data */
+static void prog_ld_pkt(struct lw_xsk_prog *prog, uint8_t size, int16_t off)
+{
+	prog_ldx(prog, size, BPF_REG_5, BPF_REG_2, off);
+}
+
+/* Jumps to fail label in case packet is shorter than len */
+static void prog_check_len(struct lw_xsk_prog *prog, int32_t len,
+			   enum lw_xsk_label fail)
+{
+	prog_insn(prog, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0);
+	prog_insn(prog, BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, len);
+	prog_jmp(prog, BPF_JGT, BPF_REG_4, BPF_REG_3, 0, fail);
+}
+
+#define ECHO_IP_OFF	ETH_HLEN
+#define ECHO_ICMP_OFF	(ECHO_IP_OFF + 20)
+#define ECHO_IP6_OFF	ETH_HLEN
+#define ECHO_ICMP6_OFF	(ECHO_IP6_OFF + 40)
+
+static void prog_echo_block(struct lw_xsk_prog *prog, struct lw_xsk *xsk,
+			    unsigned short protocol)
+{
+	bool ipv4 = protocol == ETH_P_IP;
+	enum lw_xsk_label next = ipv4 ? LW_XSK_LABEL_IPV6 : LW_XSK_LABEL_PASS;
+	struct lw_psr_port_priv *psr_ppriv;
+	int icmp_off = ipv4 ? ECHO_ICMP_OFF : ECHO_ICMP6_OFF;
+
+	prog_check_len(prog, icmp_off + 8, next);
+	prog_ld_pkt(prog, BPF_H, offsetof(struct ethhdr, h_proto));
+	prog_jmp(prog, BPF_JNE, BPF_REG_5, 0, htons(protocol), next);
+	if (ipv4) {
+		/* Replies with IP options are left to packet socket */
+		prog_ld_pkt(prog, BPF_B, ECHO_IP_OFF);
+		prog_jmp(prog, BPF_JNE, BPF_REG_5, 0, 0x45, LW_XSK_LABEL_PASS);
+		prog_ld_pkt(prog, BPF_B, ECHO_IP_OFF + 9);
+		prog_jmp(prog, BPF_JNE, BPF_REG_5, 0, IPPROTO_ICMP,
+			 LW_XSK_LABEL_PASS);
+		prog_ld_pkt(prog, BPF_B, icmp_off);
+		prog_jmp(prog, BPF_JNE, BPF_REG_5, 0, ICMP_ECHOREPLY,
+			 LW_XSK_LABEL_PASS);
+	} else {
+		prog_ld_pkt(prog, BPF_B, ECHO_IP6_OFF + 6);
+		prog_jmp(prog, BPF_JNE, BPF_REG_5, 0, IPPROTO_ICMPV6,
+			 LW_XSK_LABEL_PASS);
+		prog_ld_pkt(prog, BPF_B, icmp_off);
+		prog_jmp(prog, BPF_JNE, BPF_REG_5, 0, ICMP6_ECHO_REPLY,
+			 LW_XSK_LABEL_PASS);
+	}
+	prog_ld_pkt(prog, BPF_H, icmp_off + 4);
+	list_for_each_node_entry(psr_ppriv, &xsk->sub_list, xsk_list) {
+		if (psr_ppriv->xsk_match.protocol != protocol)
+			continue;
+		prog_jmp(prog, BPF_JEQ, BPF_REG_5, 0,
+			 htons(psr_ppriv->xsk_match.echo_id),
+			 LW_XSK_LABEL_REDIRECT);
+	}
+	prog_jmp(prog, BPF_JA, 0, 0, 0, LW_XSK_LABEL_PASS);
+}
+
+static void lw_xsk_prog_build(struct lw_xsk_prog *prog, struct lw_xsk *xsk)
+{
+	unsigned int i;
+
+	memset(prog, 0, sizeof(*prog));
+	/* r6 = ctx, r2 = data, r3 = data_end */
+	prog_insn(prog, BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0);
+	prog_ldx(prog, BPF_W, BPF_REG_2, BPF_REG_6,
+		 offsetof(struct xdp_md, data));
+	prog_ldx(prog, BPF_W, BPF_REG_3, BPF_REG_6,
+		 offsetof(struct xdp_md, data_end));
+	prog_echo_block(prog, xsk, ETH_P_IP);
+	prog_label(prog, LW_XSK_LABEL_IPV6);
+	prog_echo_block(prog, xsk, ETH_P_IPV6);
+
+	prog_label(prog, LW_XSK_LABEL_PASS);
+	prog_insn(prog, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS);
+	prog_insn(prog, BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+
+	/* bpf_redirect_map(&xsks, rx_queue_index, XDP_PASS) */
+	prog_label(prog, LW_XSK_LABEL_REDIRECT);
+	prog_ldx(prog, BPF_W, BPF_REG_2, BPF_REG_6,
+		 offsetof(struct xdp_md, rx_queue_index));
+	prog_insn(prog, BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1,
+		  BPF_PSEUDO_MAP_FD, 0, xsk->map_fd);
+	prog_insn(prog, 0, 0, 0, 0, 0);
+	prog_insn(prog, BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS);
+	prog_insn(prog, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map);
+	prog_insn(prog, BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+
+	for (i = 0; i < prog->len; i++) {
+		if (prog->fixups[i] == -1)
+			continue;
+		prog->insns[i].off = prog->labels[prog->fixups[i]] - i - 1;
+	}
+}
+
+static int lw_xsk_prog_load(struct lw_xsk *xsk)
+{
+	struct lw_xsk_prog prog;
+	union bpf_attr attr;
+	int fd;
+
+	lw_xsk_prog_build(&prog, xsk);
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = ptr_to_u64(prog.insns);
+	attr.insn_cnt = prog.len;
+	attr.license = ptr_to_u64("LGPL");
+	strncpy(attr.prog_name, "teamd_lw_xsk", sizeof(attr.prog_name) - 1);
+	fd = sys_bpf(BPF_PROG_LOAD, &attr);
+	if (fd == -1) {
+		teamd_log_err("%s: Failed to load XDP program.",
+			      xsk->tdport->ifname);
+		return -errno;
+	}
+	return fd;
+}
+
+static int lw_xsk_map_create(struct lw_xsk *xsk)
+{
+	union bpf_attr attr;
+	int key = xsk->queue;
+	int err;
+	int fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(int);
+	attr.value_size = sizeof(int);
+	attr.max_entries = xsk->queue + 1;
+	fd = sys_bpf(BPF_MAP_CREATE, &attr);
+	if (fd == -1) {
+		teamd_log_err("%s: Failed to create XSK map.",
+			      xsk->tdport->ifname);
+		return -errno;
+	}
+	xsk->map_fd = fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = fd;
+	attr.key = ptr_to_u64(&key);
+	attr.value = ptr_to_u64(&xsk->sock);
+	attr.flags = BPF_ANY;
+	if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr)) {
+		teamd_log_err("%s: Failed to add XSK to map.",
+			      xsk->tdport->ifname);
+		err = -errno;
+		close(fd);
+		return err;
+	}
+	return 0;
+}
+
+/* Native mode is tried first, generic one works with any driver */
+static int lw_xsk_prog_attach(struct lw_xsk *xsk)
+{
+	static const struct {
+		uint32_t flags;
+		const char *name;
+	} modes[] = {
+		{ XDP_FLAGS_DRV_MODE, "native" },
+		{ XDP_FLAGS_SKB_MODE, "generic" },
+	};
+	union bpf_attr attr;
+	unsigned int i;
+	int fd;
+
+	for (i = 0; i < ARRAY_SIZE(modes); i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.link_create.prog_fd = xsk->prog_fd;
+		attr.link_create.target_ifindex = xsk->ifindex;
+		attr.link_create.attach_type = BPF_XDP;
+		attr.link_create.flags = modes[i].flags;
+		fd = sys_bpf(BPF_LINK_CREATE, &attr);
+		if (fd != -1) {
+			xsk->link_fd = fd;
+			xsk->mode = modes[i].name;
+			return 0;
+		}
+	}
+	teamd_log_err("%s: Failed to attach XDP program.", xsk->tdport->ifname);
+	return -errno;
+}
+
+/* Program is replaced on each change of subscribers */
+static int lw_xsk_prog_update(struct lw_xsk *xsk)
+{
+	union bpf_attr attr;
+	int err;
+	int fd;
+
+	fd = lw_xsk_prog_load(xsk);
+	if (fd < 0)
+		return fd;
+	memset(&attr, 0, sizeof(attr));
+	attr.link_update.link_fd = xsk->link_fd;
+	attr.link_update.new_prog_fd = fd;
+	if (sys_bpf(BPF_LINK_UPDATE, &attr)) {
+		teamd_log_err("%s: Failed to replace XDP program.",
+			      xsk->tdport->ifname);
+		err = -errno;
+		close(fd);
+		return err;
+	}
+	close(xsk->prog_fd);
+	xsk->prog_fd = fd;
+	return 0;
+}
+
+static int lw_xsk_ring_map(struct lw_xsk *xsk, struct lw_xsk_ring *ring,
+			   const struct xdp_ring_offset *off, off_t pgoff,
+			   size_t desc_size)
+{
+	ring->map_len = off->desc + LW_XSK_RING_SIZE * desc_size;
+	ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, xsk->sock, pgoff);
+	if (ring->map == MAP_FAILED) {
+		int err = -errno;
+
+		ring->map = NULL;
+		teamd_log_err("Failed to map XSK ring.");
+		return err;
+	}
+	ring->producer = (uint32_t *) (ring->map + off->producer);
+	ring->consumer = (uint32_t *) (ring->map + off->consumer);
+	ring->flags = (uint32_t *) (ring->map + off->flags);
+	ring->desc = ring->map + off->desc;
+	ring->mask = LW_XSK_RING_SIZE - 1;
+	return 0;
+}
+
+static void lw_xsk_ring_unmap(struct lw_xsk_ring *ring)
+{
+	if (ring->map)
+		munmap(ring->map, ring->map_len);
+}
+
+static int lw_xsk_setsockopt(struct lw_xsk *xsk, int optname,
+			     const void *optval, socklen_t optlen)
+{
+	if (setsockopt(xsk->sock, SOL_XDP, optname, optval, optlen)) {
+		teamd_log_err("%s: Failed to setsockopt %d on XSK.",
+			      xsk->tdport->ifname, optname);
+		return -errno;
+	}
+	return 0;
+}
+
+static int lw_xsk_sock_open(struct lw_xsk *xsk)
+{
+	struct xdp_umem_reg umem_reg;
+	struct xdp_mmap_offsets off;
+	struct sockaddr_xdp sxdp;
+	int ring_size = LW_XSK_RING_SIZE;
+	socklen_t optlen;
+	uint64_t *fill;
+	unsigned int i;
+	int err;
+
+	xsk->umem = mmap(NULL, LW_XSK_FRAMES * LW_XSK_FRAME_SIZE,
+			 PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (xsk->umem == MAP_FAILED) {
+		xsk->umem = NULL;
+		return -ENOMEM;
+	}
+
+	xsk->sock = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+	if (xsk->sock == -1) {
+		teamd_log_err("%s: Failed to create XSK.", xsk->tdport->ifname);
+		err = -errno;
+		goto umem_unmap;
+	}
+
+	memset(&umem_reg, 0, sizeof(umem_reg));
+	umem_reg.addr = ptr_to_u64(xsk->umem);
+	umem_reg.len = LW_XSK_FRAMES * LW_XSK_FRAME_SIZE;
+	umem_reg.chunk_size = LW_XSK_FRAME_SIZE;
+	err = lw_xsk_setsockopt(xsk, XDP_UMEM_REG, &umem_reg, sizeof(umem_reg));
+	if (err)
+		goto close_sock;
+	err = lw_xsk_setsockopt(xsk, XDP_UMEM_FILL_RING, &ring_size,
+				sizeof(ring_size));
+	if (err)
+		goto close_sock;
+	err = lw_xsk_setsockopt(xsk, XDP_UMEM_COMPLETION_RING, &ring_size,
+				sizeof(ring_size));
+	if (err)
+		goto close_sock;
+	err = lw_xsk_setsockopt(xsk, XDP_RX_RING, &ring_size,
+				sizeof(ring_size));
+	if (err)
+		goto close_sock;
+	err = lw_xsk_setsockopt(xsk, XDP_TX_RING, &ring_size,
+				sizeof(ring_size));
+	if (err)
+		goto close_sock;
+
+	optlen = sizeof(off);
+	if (getsockopt(xsk->sock, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen)) {
+		teamd_log_err("%s: Failed to get XSK ring offsets.",
+			      xsk->tdport->ifname);
+		err = -errno;
+		goto close_sock;
+	}
+	err = lw_xsk_ring_map(xsk, &xsk->fill, &off.fr,
+			      XDP_UMEM_PGOFF_FILL_RING, sizeof(uint64_t));
+	if (err)
+		goto rings_unmap;
+	err = lw_xsk_ring_map(xsk, &xsk->comp, &off.cr,
+			      XDP_UMEM_PGOFF_COMPLETION_RING, sizeof(uint64_t));
+	if (err)
+		goto rings_unmap;
+	err = lw_xsk_ring_map(xsk, &xsk->rx, &off.rx, XDP_PGOFF_RX_RING,
+			      sizeof(struct xdp_desc));
+	if (err)
+		goto rings_unmap;
+	err = lw_xsk_ring_map(xsk, &xsk->tx, &off.tx, XDP_PGOFF_TX_RING,
+			      sizeof(struct xdp_desc));
+	if (err)
+		goto rings_unmap;
+
+	/* The first frames are for rx, all given to kernel, rest for tx */
+	fill = xsk->fill.desc;
+	for (i = 0; i < LW_XSK_RX_FRAMES; i++)
+		fill[i] = i * LW_XSK_FRAME_SIZE;
+	__atomic_store_n(xsk->fill.producer, LW_XSK_RX_FRAMES,
+			 __ATOMIC_RELEASE);
+	for (i = 0; i < LW_XSK_TX_FRAMES; i++)
+		xsk->tx_free[i] = (LW_XSK_RX_FRAMES + i) * LW_XSK_FRAME_SIZE;
+	xsk->tx_free_count = LW_XSK_TX_FRAMES;
+
+	memset(&sxdp, 0, sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = xsk->ifindex;
+	sxdp.sxdp_queue_id = xsk->queue;
+	sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP;
+	if (bind(xsk->sock, (struct sockaddr *) &sxdp, sizeof(sxdp))) {
+		teamd_log_err("%s: Failed to bind XSK to queue %u.",
+			      xsk->tdport->ifname, xsk->queue);
+		err = -errno;
+		goto rings_unmap;
+	}
+	return 0;
+
+rings_unmap:
+	lw_xsk_ring_unmap(&xsk->tx);
+	lw_xsk_ring_unmap(&xsk->rx);
+	lw_xsk_ring_unmap(&xsk->comp);
+	lw_xsk_ring_unmap(&xsk->fill);
+close_sock:
+	close(xsk->sock);
+umem_unmap:
+	munmap(xsk->umem, LW_XSK_FRAMES * LW_XSK_FRAME_SIZE);
+	return err;
+}
+
+static void lw_xsk_sock_close(struct lw_xsk *xsk)
+{
+	close(xsk->sock);
+	lw_xsk_ring_unmap(&xsk->tx);
+	lw_xsk_ring_unmap(&xsk->rx);
+	lw_xsk_ring_unmap(&xsk->comp);
+	lw_xsk_ring_unmap(&xsk->fill);
+	munmap(xsk->umem, LW_XSK_FRAMES * LW_XSK_FRAME_SIZE);
+}
+
+static void lw_xsk_frame_deliver(struct lw_xsk *xsk, const uint8_t *frame,
+				 uint32_t len)
+{
+	const struct ethhdr *eth = (const struct ethhdr *) frame;
+	struct lw_psr_port_priv *psr_ppriv;
+	struct sockaddr_ll ll_from;
+
+	if (len < ETH_HLEN)
+		return;
+	memset(&ll_from, 0, sizeof(ll_from));
+	ll_from.sll_family = AF_PACKET;
+	ll_from.sll_protocol = eth->h_proto;
+	ll_from.sll_ifindex = xsk->ifindex;
+	ll_from.sll_halen = ETH_ALEN;
+	memcpy(ll_from.sll_addr, eth->h_source, ETH_ALEN);
+
+	/* Watchers check identifier and sequence on their own */
+	list_for_each_node_entry(psr_ppriv, &xsk->sub_list, xsk_list) {
+		if (htons(psr_ppriv->xsk_match.protocol) != eth->h_proto)
+			continue;
+		psr_ppriv->ops->receive_frame(psr_ppriv, frame + ETH_HLEN,
+					      len - ETH_HLEN, &ll_from, -1,
+					      NULL);
+		xsk->stats.delivered++;
+	}
+}
+
+static int lw_xsk_callback_socket(struct teamd_context *ctx, int events,
+				  void *priv)
+{
+	struct lw_xsk *xsk = priv;
+	struct xdp_desc *rx_desc = xsk->rx.desc;
+	uint64_t *fill = xsk->fill.desc;
+	uint32_t fill_prod;
+	uint32_t prod;
+	uint32_t cons;
+
+	teamd_rt_noalloc_begin();
+	xsk->stats.wakeups++;
+	prod = __atomic_load_n(xsk->rx.producer, __ATOMIC_ACQUIRE);
+	cons = *xsk->rx.consumer;
+	fill_prod = *xsk->fill.producer;
+	for (; cons != prod; cons++) {
+		struct xdp_desc *desc = &rx_desc[cons & xsk->rx.mask];
+
+		lw_xsk_frame_deliver(xsk, xsk->umem + desc->addr, desc->len);
+		xsk->stats.rx_frames++;
+		/* Fill ring is as big as count of rx frames, so there is room */
+		fill[fill_prod++ & xsk->fill.mask] =
+			desc->addr & ~((uint64_t) LW_XSK_FRAME_SIZE - 1);
+	}
+	__atomic_store_n(xsk->rx.consumer, cons, __ATOMIC_RELEASE);
+	__atomic_store_n(xsk->fill.producer, fill_prod, __ATOMIC_RELEASE);
+	teamd_rt_noalloc_end();
+	return 0;
+}
+
+static void lw_xsk_tx_reclaim(struct lw_xsk *xsk)
+{
+	uint64_t *comp = xsk->comp.desc;
+	uint32_t prod;
+	uint32_t cons;
+
+	prod = __atomic_load_n(xsk->comp.producer, __ATOMIC_ACQUIRE);
+	cons = *xsk->comp.consumer;
+	for (; cons != prod; cons++)
+		xsk->tx_free[xsk->tx_free_count++] = comp[cons & xsk->comp.mask];
+	__atomic_store_n(xsk->comp.consumer, cons, __ATOMIC_RELEASE);
+}
+
+/* Probe gets Ethernet header here, packet socket would add it otherwise */
+static bool lw_xsk_tx_put(struct lw_xsk *xsk, struct lw_tx_batch_msg *msg)
+{
+	struct xdp_desc *tx_desc = xsk->tx.desc;
+	struct xdp_desc *desc;
+	struct ethhdr *eth;
+	uint32_t prod;
+	uint64_t addr;
+
+	prod = *xsk->tx.producer;
+	if (!xsk->tx_free_count ||
+	    prod - __atomic_load_n(xsk->tx.consumer, __ATOMIC_ACQUIRE) >
+	    xsk->tx.mask) {
+		xsk->stats.tx_dropped++;
+		return false;
+	}
+	addr = xsk->tx_free[--xsk->tx_free_count];
+	eth = (struct ethhdr *) (xsk->umem + addr);
+	memcpy(eth->h_dest, msg->addr.ll.sll_addr, ETH_ALEN);
+	memcpy(eth->h_source,
+	       team_get_ifinfo_hwaddr(xsk->tdport->team_ifinfo), ETH_ALEN);
+	eth->h_proto = msg->addr.ll.sll_protocol;
+	memcpy(eth + 1, msg->buf, msg->len);
+
+	desc = &tx_desc[prod & xsk->tx.mask];
+	desc->addr = addr;
+	desc->len = ETH_HLEN + msg->len;
+	desc->options = 0;
+	__atomic_store_n(xsk->tx.producer, prod + 1, __ATOMIC_RELEASE);
+	xsk->stats.tx_frames++;
+	return true;
+}
+
+static int lw_xsk_tx_kick(struct lw_xsk *xsk)
+{
+	if (!(__atomic_load_n(xsk->tx.flags, __ATOMIC_ACQUIRE) &
+	      XDP_RING_NEED_WAKEUP))
+		return 0;
+	if (sendto(xsk->sock, NULL, 0, MSG_DONTWAIT, NULL, 0) == -1) {
+		switch (errno) {
+		case EAGAIN:
+		case EBUSY:
+		case ENOBUFS:
+		case ENETDOWN:
+			return 0;
+		default:
+			teamd_log_err("%s: Failed to kick XSK tx.",
+				      xsk->tdport->ifname);
+			return -errno;
+		}
+	}
+	return 0;
+}
+
+int lw_xsk_send(struct teamd_context *ctx, struct lw_psr_port_priv *psr_ppriv)
+{
+	struct lw_xsk *xsk = psr_ppriv->xsk;
+	struct lw_tx_batch_msg msg;
+	unsigned int queued = 0;
+	unsigned int i;
+	int err;
+
+	lw_xsk_tx_reclaim(xsk);
+	for (i = 0; i < psr_ppriv->probe_count; i++) {
+		err = psr_ppriv->ops->send_prepare(psr_ppriv, &msg, i);
+		if (err)
+			return err;
+		if (!msg.len)
+			continue;
+		if (lw_xsk_tx_put(xsk, &msg))
+			queued++;
+	}
+	if (!queued)
+		return 0;
+	err = lw_xsk_tx_kick(xsk);
+	if (err)
+		return err;
+	for (i = 0; i < queued; i++)
+		lw_psr_probe_sent(psr_ppriv);
+	return 0;
+}
+
+static int lw_xsk_state_mode_get(struct teamd_context *ctx,
+				 struct team_state_gsc *gsc,
+				 void *priv)
+{
+	struct lw_xsk *xsk = priv;
+
+	gsc->data.str_val.ptr = xsk->mode;
+	return 0;
+}
+
+static int lw_xsk_state_queue_get(struct teamd_context *ctx,
+				  struct team_state_gsc *gsc,
+				  void *priv)
+{
+	struct lw_xsk *xsk = priv;
+
+	gsc->data.int_val = xsk->queue;
+	return 0;
+}
+
+static int lw_xsk_state_rx_frames_get(struct teamd_context *ctx,
+				      struct team_state_gsc *gsc,
+				      void *priv)
+{
+	struct lw_xsk *xsk = priv;
+
+	gsc->data.int_val = xsk->stats.rx_frames;
+	return 0;
+}
+
+static int lw_xsk_state_delivered_get(struct teamd_context *ctx,
+				      struct team_state_gsc *gsc,
+				      void *priv)
+{
+	struct lw_xsk *xsk = priv;
+
+	gsc->data.int_val = xsk->stats.delivered;
+	return 0;
+}
+
+static int lw_xsk_state_tx_frames_get(struct teamd_context *ctx,
+				      struct team_state_gsc *gsc,
+				      void *priv)
+{
+	struct lw_xsk *xsk = priv;
+
+	gsc->data.int_val = xsk->stats.tx_frames;
+	return 0;
+}
+
+static int lw_xsk_state_tx_dropped_get(struct teamd_context *ctx,
+				       struct team_state_gsc *gsc,
+				       void *priv)
+{
+	struct lw_xsk *xsk = priv;
+
+	gsc->data.int_val = xsk->stats.tx_dropped;
+	return 0;
+}
+
+static int lw_xsk_state_wakeups_get(struct teamd_context *ctx,
+				    struct team_state_gsc *gsc,
+				    void *priv)
+{
+	struct lw_xsk *xsk = priv;
+
+	gsc->data.int_val = xsk->stats.wakeups;
+	return 0;
+}
+
+static const struct teamd_state_val lw_xsk_state_vals[] = {
+	{
+		.subpath = "mode",
+		.type = TEAMD_STATE_ITEM_TYPE_STRING,
+		.getter = lw_xsk_state_mode_get,
+	},
+	{
+		.subpath = "queue",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_xsk_state_queue_get,
+	},
+	{
+		.subpath = "wakeups",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_xsk_state_wakeups_get,
+	},
+	{
+		.subpath = "rx_frames",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_xsk_state_rx_frames_get,
+	},
+	{
+		.subpath = "delivered",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_xsk_state_delivered_get,
+	},
+	{
+		.subpath = "tx_frames",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_xsk_state_tx_frames_get,
+	},
+	{
+		.subpath = "tx_dropped",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = lw_xsk_state_tx_dropped_get,
+	},
+};
+
+static const struct teamd_state_val lw_xsk_state_vg = {
+	.vals = lw_xsk_state_vals,
+	.vals_count = ARRAY_SIZE(lw_xsk_state_vals),
+};
+
+#define LW_XSK_CB_NAME "lw_xsk"
+
+static struct lw_xsk *lw_xsk_find(struct teamd_context *ctx, uint32_t ifindex)
+{
+	struct lw_xsk *xsk;
+
+	list_for_each_node_entry(xsk, &ctx->lw_xsk_list, list) {
+		if (xsk->ifindex == ifindex)
+			return xsk;
+	}
+	return NULL;
+}
+
+static int lw_xsk_create(struct teamd_context *ctx, struct lw_xsk **pxsk,
+			 struct lw_psr_port_priv *psr_ppriv)
+{
+	struct teamd_port *tdport = psr_ppriv->common.tdport;
+	struct lw_xsk *xsk;
+	int queue;
+	int err;
+
+	err = teamd_config_int_get(ctx, &queue, "$.link_watch_xdp_queue");
+	if (err)
+		queue = 0;
+	if (queue < 0) {
+		teamd_log_err("\"link_watch_xdp_queue\" must not be negative number.");
+		return -EINVAL;
+	}
+
+	xsk = myzalloc(sizeof(*xsk));
+	if (!xsk)
+		return -ENOMEM;
+	xsk->ctx = ctx;
+	xsk->tdport = tdport;
+	xsk->ifindex = tdport->ifindex;
+	xsk->queue = queue;
+	list_init(&xsk->sub_list);
+	/* Program is built of subscribers, the first one has to be there */
+	list_add_tail(&xsk->sub_list, &psr_ppriv->xsk_list);
+
+	err = lw_xsk_sock_open(xsk);
+	if (err)
+		goto free_xsk;
+	err = lw_xsk_map_create(xsk);
+	if (err)
+		goto sock_close;
+	xsk->prog_fd = lw_xsk_prog_load(xsk);
+	if (xsk->prog_fd < 0) {
+		err = xsk->prog_fd;
+		goto map_close;
+	}
+	err = lw_xsk_prog_attach(xsk);
+	if (err)
+		goto prog_close;
+
+	err = teamd_loop_callback_fd_add(ctx, LW_XSK_CB_NAME, xsk,
+					 lw_xsk_callback_socket, xsk->sock,
+					 TEAMD_LOOP_FD_EVENT_READ,
+					 TEAMD_LOOP_PRIO_LINK_WATCH);
+	if (err) {
+		teamd_log_err("Failed add XSK callback.");
+		goto link_close;
+	}
+
+	err = teamd_state_val_register_ex(ctx, &lw_xsk_state_vg, xsk,
+					  NULL, "link_watch_xdp.%s",
+					  tdport->ifname);
+	if (err)
+		goto callback_del;
+
+	teamd_loop_callback_enable(ctx, LW_XSK_CB_NAME, xsk);
+	list_add(&ctx->lw_xsk_list, &xsk->list);
+	teamd_log_info("%s: Using AF_XDP in %s mode on queue %u for link watch probes.",
+		       tdport->ifname, xsk->mode, xsk->queue);
+	*pxsk = xsk;
+	return 0;
+
+callback_del:
+	teamd_loop_callback_del(ctx, LW_XSK_CB_NAME, xsk);
+link_close:
+	close(xsk->link_fd);
+prog_close:
+	close(xsk->prog_fd);
+map_close:
+	close(xsk->map_fd);
+sock_close:
+	lw_xsk_sock_close(xsk);
+free_xsk:
+	list_del(&psr_ppriv->xsk_list);
+	free(xsk);
+	return err;
+}
+
+static void lw_xsk_destroy(struct lw_xsk *xsk)
+{
+	struct teamd_context *ctx = xsk->ctx;
+
+	list_del(&xsk->list);
+	teamd_state_val_unregister(ctx, &lw_xsk_state_vg, xsk);
+	teamd_loop_callback_del(ctx, LW_XSK_CB_NAME, xsk);
+	/* Program is detached once the last reference to link is gone */
+	close(xsk->link_fd);
+	close(xsk->prog_fd);
+	close(xsk->map_fd);
+	lw_xsk_sock_close(xsk);
+	teamd_log_dbg("%s: Stopped using AF_XDP.", xsk->tdport->ifname);
+	free(xsk);
+}
+
+bool lw_xsk_enabled(struct teamd_context *ctx,
+		    struct lw_psr_port_priv *psr_ppriv)
+{
+	const struct lw_psr_ops *ops = psr_ppriv->ops;
+	bool enabled;
+	int err;
+
+	if (!ops->xsk_match || !ops->receive_frame || !ops->send_prepare)
+		return false;
+	err = teamd_config_bool_get(ctx, &enabled, "$.link_watch_xdp");
+	return !err && enabled;
+}
+
+int lw_xsk_subscribe(struct teamd_context *ctx,
+		     struct lw_psr_port_priv *psr_ppriv)
+{
+	struct lw_xsk *xsk;
+	int err;
+
+	psr_ppriv->ops->xsk_match(psr_ppriv, &psr_ppriv->xsk_match);
+	xsk = lw_xsk_find(ctx, psr_ppriv->common.tdport->ifindex);
+	if (!xsk) {
+		/* Creation adds the first subscriber */
+		err = lw_xsk_create(ctx, &xsk, psr_ppriv);
+		if (err)
+			return err;
+	} else {
+		if (xsk->sub_count == LW_XSK_MAX_SUBS)
+			return -ENOSPC;
+		list_add_tail(&xsk->sub_list, &psr_ppriv->xsk_list);
+		err = lw_xsk_prog_update(xsk);
+		if (err) {
+			list_del(&psr_ppriv->xsk_list);
+			return err;
+		}
+	}
+	xsk->sub_count++;
+	psr_ppriv->xsk = xsk;
+	return 0;
+}
+
+void lw_xsk_unsubscribe(struct teamd_context *ctx,
+			struct lw_psr_port_priv *psr_ppriv)
+{
+	struct lw_xsk *xsk = psr_ppriv->xsk;
+
+	if (!xsk)
+		return;
+	list_del(&psr_ppriv->xsk_list);
+	psr_ppriv->xsk = NULL;
+	if (!--xsk->sub_count) {
+		lw_xsk_destroy(xsk);
+		return;
+	}
+	/* Old program only redirects replies nobody waits for any more */
+	lw_xsk_prog_update(xsk);
+}
+
+#endif /* HAVE_LINUX_IF_XDP_H */
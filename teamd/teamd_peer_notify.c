@@ -0,0 +1,434 @@
+/*
+ *   teamd_peer_notify.c - Gratuitous ARP and unsolicited NA bursts
+ *   Copyright (C) 2026 libteam contributors
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ifaddrs.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <netinet/if_ether.h>
+#include <netinet/ip6.h>
+#include <netinet/icmp6.h>
+#include <linux/if_packet.h>
+#include <linux/if_vlan.h>
+#include <linux/sockios.h>
+#include <private/misc.h>
+
+#include "teamd.h"
+#include "teamd_config.h"
+#include "teamd_realtime.h"
+#include "teamd_workq.h"
+
+/*
+ * Once a new active port is set, gratuitous ARP for every IPv4 address and
+ * unsolicited neighbour advertisement for every IPv6 address of the team
+ * device, and of configured VLAN devices on top of it, are sent directly
+ * through the port. Unlike kernel notify_peers, this covers the VLANs too.
+ * Frames are built once per failover and each round of the burst is sent
+ * by a single sendmmsg().
+ */
+
+#define PN_MAX_VLANS		64
+#define PN_MAX_FRAMES		128
+#define PN_FRAME_LEN		96
+#define PN_VLAN_HLEN		4
+#define PN_DFLT_COUNT		0
+#define PN_DFLT_INTERVAL	50
+
+struct pn_frame {
+	unsigned char buf[PN_FRAME_LEN];
+	size_t len;
+};
+
+struct teamd_peer_notify {
+	struct teamd_context *ctx;
+	int sock;
+	unsigned int count;
+	unsigned int interval;
+	unsigned int vlan_count;
+	uint16_t vlans[PN_MAX_VLANS];
+	unsigned int rounds_left;
+	struct teamd_workq round_workq;
+	unsigned int frame_count;
+	struct pn_frame frames[PN_MAX_FRAMES];
+	struct mmsghdr mmsgs[PN_MAX_FRAMES];
+	struct iovec iovs[PN_MAX_FRAMES];
+	struct sockaddr_ll ll_dst;
+};
+
+static const unsigned char pn_bcast_hwaddr[ETH_ALEN] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+/* Ethernet address of all-nodes multicast ff02::1 */
+static const unsigned char pn_all_nodes_hwaddr[ETH_ALEN] = {
+	0x33, 0x33, 0x00, 0x00, 0x00, 0x01
+};
+
+static uint32_t csum_add(uint32_t sum, const void *buf, size_t len)
+{
+	const uint16_t *ptr = buf;
+
+	for (; len > 1; len -= 2)
+		sum += *ptr++;
+	if (len)
+		sum += *(const uint8_t *) ptr;
+	return sum;
+}
+
+static uint16_t csum_fold(uint32_t sum)
+{
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+/* Returns pointer to place for payload */
+static unsigned char *pn_eth_put(unsigned char *buf, const unsigned char *dst,
+				 const char *hwaddr, int vlan,
+				 uint16_t protocol)
+{
+	uint16_t tmp;
+
+	memcpy(buf, dst, ETH_ALEN);
+	memcpy(buf + ETH_ALEN, hwaddr, ETH_ALEN);
+	buf += 2 * ETH_ALEN;
+	if (vlan >= 0) {
+		tmp = htons(ETH_P_8021Q);
+		memcpy(buf, &tmp, sizeof(tmp));
+		tmp = htons(vlan);
+		memcpy(buf + 2, &tmp, sizeof(tmp));
+		buf += PN_VLAN_HLEN;
+	}
+	tmp = htons(protocol);
+	memcpy(buf, &tmp, sizeof(tmp));
+	return buf + sizeof(tmp);
+}
+
+static size_t pn_eth_len(int vlan)
+{
+	return ETH_HLEN + (vlan >= 0 ? PN_VLAN_HLEN : 0);
+}
+
+static void pn_garp_build(struct pn_frame *frame, const char *hwaddr,
+			  int vlan, const struct in_addr *addr)
+{
+	struct ether_arp arp;
+	unsigned char *payload;
+
+	memset(&arp, 0, sizeof(arp));
+	arp.arp_hrd = htons(ARPHRD_ETHER);
+	arp.arp_pro = htons(ETH_P_IP);
+	arp.arp_hln = ETH_ALEN;
+	arp.arp_pln = sizeof(*addr);
+	arp.arp_op = htons(ARPOP_REQUEST);
+	memcpy(arp.arp_sha, hwaddr, ETH_ALEN);
+	memcpy(arp.arp_spa, addr, sizeof(*addr));
+	memcpy(arp.arp_tpa, addr, sizeof(*addr));
+
+	payload = pn_eth_put(frame->buf, pn_bcast_hwaddr, hwaddr, vlan,
+			     ETH_P_ARP);
+	memcpy(payload, &arp, sizeof(arp));
+	frame->len = pn_eth_len(vlan) + sizeof(arp);
+}
+
+struct pn_na_packet {
+	struct ip6_hdr ip6h;
+	struct nd_neighbor_advert na;
+	struct nd_opt_hdr opt;
+	unsigned char opt_hwaddr[ETH_ALEN];
+} __attribute__((packed));
+
+static void pn_na_build(struct pn_frame *frame, const char *hwaddr,
+			int vlan, const struct in6_addr *addr)
+{
+	struct pn_na_packet pkt;
+	size_t icmp_len = sizeof(pkt) - sizeof(pkt.ip6h);
+	unsigned char *payload;
+	uint32_t sum;
+
+	memset(&pkt, 0, sizeof(pkt));
+	pkt.ip6h.ip6_flow = htonl(6 << 28);
+	pkt.ip6h.ip6_plen = htons(icmp_len);
+	pkt.ip6h.ip6_nxt = IPPROTO_ICMPV6;
+	pkt.ip6h.ip6_hlim = 255;
+	pkt.ip6h.ip6_src = *addr;
+	inet_pton(AF_INET6, "ff02::1", &pkt.ip6h.ip6_dst);
+
+	pkt.na.nd_na_type = ND_NEIGHBOR_ADVERT;
+	pkt.na.nd_na_flags_reserved = ND_NA_FLAG_OVERRIDE;
+	pkt.na.nd_na_target = *addr;
+	pkt.opt.nd_opt_type = ND_OPT_TARGET_LINKADDR;
+	pkt.opt.nd_opt_len = 1; /* in units of 8 octets */
+	memcpy(pkt.opt_hwaddr, hwaddr, ETH_ALEN);
+
+	/* Pseudo header: addresses, upper-layer length and next header */
+	sum = csum_add(0, &pkt.ip6h.ip6_src, 2 * sizeof(struct in6_addr));
+	sum += htons(icmp_len);
+	sum += htons(IPPROTO_ICMPV6);
+	sum = csum_add(sum, &pkt.na, icmp_len);
+	pkt.na.nd_na_cksum = csum_fold(sum);
+
+	payload = pn_eth_put(frame->buf, pn_all_nodes_hwaddr, hwaddr, vlan,
+			     ETH_P_IPV6);
+	memcpy(payload, &pkt, sizeof(pkt));
+	frame->len = pn_eth_len(vlan) + sizeof(pkt);
+}
+
+/*
+ * Returns VLAN id of device in case it is one of configured VLANs on top
+ * of the team device, -1 for the team device itself and -2 otherwise.
+ */
+static int pn_ifname_vlan(struct teamd_peer_notify *pn, const char *ifname)
+{
+	struct vlan_ioctl_args args;
+	unsigned int i;
+
+	if (!strcmp(ifname, pn->ctx->team_devname))
+		return -1;
+	if (!pn->vlan_count)
+		return -2;
+
+	memset(&args, 0, sizeof(args));
+	args.cmd = GET_VLAN_REALDEV_NAME_CMD;
+	strncpy(args.device1, ifname, sizeof(args.device1) - 1);
+	if (ioctl(pn->sock, SIOCGIFVLAN, &args) ||
+	    strcmp(args.u.device2, pn->ctx->team_devname))
+		return -2;
+	args.cmd = GET_VLAN_VID_CMD;
+	if (ioctl(pn->sock, SIOCGIFVLAN, &args))
+		return -2;
+	for (i = 0; i < pn->vlan_count; i++)
+		if (pn->vlans[i] == args.u.VID)
+			return args.u.VID;
+	return -2;
+}
+
+static int pn_frames_build(struct teamd_peer_notify *pn, const char *hwaddr)
+{
+	struct ifaddrs *ifaddr;
+	struct ifaddrs *ifa;
+	struct pn_frame *frame;
+	int vlan;
+
+	/*
+	 * Addresses may change any time, so they are read on each failover.
+	 * getifaddrs() allocates, failover is rare enough for that.
+	 */
+	if (teamd_rt_alloc_allowed(getifaddrs(&ifaddr)) == -1) {
+		teamd_log_err("Failed to get interface addresses.");
+		return -errno;
+	}
+	pn->frame_count = 0;
+	for (ifa = ifaddr; ifa; ifa = ifa->ifa_next) {
+		if (!ifa->ifa_addr || (ifa->ifa_addr->sa_family != AF_INET &&
+				       ifa->ifa_addr->sa_family != AF_INET6))
+			continue;
+		vlan = pn_ifname_vlan(pn, ifa->ifa_name);
+		if (vlan < -1)
+			continue;
+		if (pn->frame_count == PN_MAX_FRAMES) {
+			teamd_log_warn("Too many addresses, not all peers will be notified.");
+			break;
+		}
+		frame = &pn->frames[pn->frame_count++];
+		if (ifa->ifa_addr->sa_family == AF_INET)
+			pn_garp_build(frame, hwaddr, vlan,
+				      &((struct sockaddr_in *)
+					ifa->ifa_addr)->sin_addr);
+		else
+			pn_na_build(frame, hwaddr, vlan,
+				    &((struct sockaddr_in6 *)
+				      ifa->ifa_addr)->sin6_addr);
+	}
+	freeifaddrs(ifaddr);
+	return 0;
+}
+
+static int pn_round_send(struct teamd_peer_notify *pn)
+{
+	unsigned int sent = 0;
+	int ret;
+
+	while (sent < pn->frame_count) {
+		ret = sendmmsg(pn->sock, &pn->mmsgs[sent],
+			       pn->frame_count - sent, 0);
+		if (ret != -1) {
+			sent += ret;
+			continue;
+		}
+		switch (errno) {
+		case EINTR:
+			continue;
+		case ENETDOWN:
+		case ENXIO:
+		case ENODEV: /* port may be gone already */
+			return 0;
+		default:
+			teamd_log_err("sendmmsg failed.");
+			return -errno;
+		}
+	}
+	return 0;
+}
+
+static int pn_round(struct teamd_peer_notify *pn)
+{
+	int err;
+
+	err = pn_round_send(pn);
+	if (err)
+		return err;
+	if (--pn->rounds_left)
+		teamd_workq_schedule_delayed(pn->ctx, &pn->round_workq,
+					     pn->interval);
+	return 0;
+}
+
+static int pn_round_work(struct teamd_context *ctx, struct teamd_workq *workq)
+{
+	struct teamd_peer_notify *pn;
+
+	pn = get_container(workq, struct teamd_peer_notify, round_workq);
+	return pn_round(pn);
+}
+
+int teamd_peer_notify_start(struct teamd_peer_notify *pn,
+			    struct teamd_port *tdport, const char *hwaddr)
+{
+	unsigned int i;
+	int err;
+
+	if (!pn->count)
+		return 0;
+	teamd_workq_cancel_work(pn->ctx, &pn->round_workq);
+	err = pn_frames_build(pn, hwaddr);
+	if (err)
+		return err;
+	if (!pn->frame_count)
+		return 0;
+	pn->ll_dst.sll_ifindex = tdport->ifindex;
+	for (i = 0; i < pn->frame_count; i++)
+		pn->iovs[i].iov_len = pn->frames[i].len;
+	teamd_log_dbg("%s: Notifying peers about %u addresses.",
+		      tdport->ifname, pn->frame_count);
+	pn->rounds_left = pn->count;
+	return pn_round(pn);
+}
+
+static int pn_load_config(struct teamd_context *ctx,
+			  struct teamd_peer_notify *pn)
+{
+	int err;
+	int tmp;
+	int i;
+
+	err = teamd_config_int_get(ctx, &tmp, "$.runner.peer_notify.count");
+	if (err) {
+		tmp = PN_DFLT_COUNT;
+	} else if (tmp < 0) {
+		teamd_log_err("\"peer_notify.count\" must not be negative number.");
+		return -EINVAL;
+	}
+	pn->count = tmp;
+
+	err = teamd_config_int_get(ctx, &tmp, "$.runner.peer_notify.interval");
+	if (err) {
+		tmp = PN_DFLT_INTERVAL;
+	} else if (tmp < 0) {
+		teamd_log_err("\"peer_notify.interval\" must not be negative number.");
+		return -EINVAL;
+	}
+	pn->interval = tmp;
+
+	teamd_config_for_each_arr_index(i, ctx, "$.runner.peer_notify.vlans") {
+		err = teamd_config_int_get(ctx, &tmp,
+					   "$.runner.peer_notify.vlans[%d]", i);
+		if (err || tmp < 1 || tmp > 4094) {
+			teamd_log_err("\"peer_notify.vlans\" must contain VLAN ids in range 1-4094.");
+			return -EINVAL;
+		}
+		if (pn->vlan_count == PN_MAX_VLANS) {
+			teamd_log_err("\"peer_notify.vlans\" may contain at most %d VLANs.",
+				      PN_MAX_VLANS);
+			return -EINVAL;
+		}
+		pn->vlans[pn->vlan_count++] = tmp;
+	}
+	teamd_log_dbg("Using peer_notify count \"%u\", interval \"%u\", %u VLANs.",
+		      pn->count, pn->interval, pn->vlan_count);
+	return 0;
+}
+
+int teamd_peer_notify_init(struct teamd_context *ctx,
+			   struct teamd_peer_notify **ppn)
+{
+	struct teamd_peer_notify *pn;
+	unsigned int i;
+	int err;
+
+	pn = myzalloc(sizeof(*pn));
+	if (!pn)
+		return -ENOMEM;
+	pn->ctx = ctx;
+	pn->sock = -1;
+	teamd_workq_init_work(&pn->round_workq, pn_round_work);
+	err = pn_load_config(ctx, pn);
+	if (err)
+		goto free_pn;
+
+	if (pn->count) {
+		/* Socket is used only for sending, so it is not bound */
+		pn->sock = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, 0);
+		if (pn->sock == -1) {
+			teamd_log_err("Failed to create peer notify socket.");
+			err = -errno;
+			goto free_pn;
+		}
+	}
+	pn->ll_dst.sll_family = AF_PACKET;
+	for (i = 0; i < PN_MAX_FRAMES; i++) {
+		pn->iovs[i].iov_base = pn->frames[i].buf;
+		pn->mmsgs[i].msg_hdr.msg_iov = &pn->iovs[i];
+		pn->mmsgs[i].msg_hdr.msg_iovlen = 1;
+		pn->mmsgs[i].msg_hdr.msg_name = &pn->ll_dst;
+		pn->mmsgs[i].msg_hdr.msg_namelen = sizeof(pn->ll_dst);
+	}
+	*ppn = pn;
+	return 0;
+
+free_pn:
+	free(pn);
+	return err;
+}
+
+void teamd_peer_notify_fini(struct teamd_peer_notify *pn)
+{
+	teamd_workq_cancel_work(pn->ctx, &pn->round_workq);
+	if (pn->sock != -1)
+		close(pn->sock);
+	free(pn);
+}
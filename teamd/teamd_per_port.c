@@ -27,6 +27,7 @@
 #include <team.h>
 
 #include "teamd.h"
+#include "teamd_realtime.h"
 
 struct port_priv_item {
 	struct list_item list;
@@ -446,8 +447,9 @@ int teamd_port_check_enable(struct teamd_context *ctx,
 
 	teamd_log_dbg("%s: %s port", tdport->ifname,
 		      new_enabled_state ? "Enabling": "Disabling");
-	err = team_set_port_enabled(ctx->th, tdport->ifindex,
-				    new_enabled_state);
+	err = teamd_rt_alloc_allowed(
+		team_set_port_enabled(ctx->th, tdport->ifindex,
+				      new_enabled_state));
 	if (err) {
 		teamd_log_err("%s: Failed to %s port.", tdport->ifname,
 			      new_enabled_state ? "enable": "disable");
@@ -0,0 +1,213 @@
+/*
+ *   teamd_realtime.c - Real-time mode support for teamd
+ *   Copyright (C) 2026 libteam contributors
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <malloc.h>
+#include <sys/mman.h>
+
+#include "teamd.h"
+#include "teamd_config.h"
+#include "teamd_realtime.h"
+
+/*
+ * Heap and stack are touched before memory gets locked so later link
+ * failure handling does not hit page faults.
+ */
+#define TEAMD_RT_HEAP_PREFAULT	(1024 * 1024)
+#define TEAMD_RT_STACK_PREFAULT	(64 * 1024)
+
+static int teamd_realtime_prefault_heap(void)
+{
+	volatile char *buf;
+	int pagesize = getpagesize();
+	int i;
+
+	/* Keep freed memory in process so it stays faulted in and locked */
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+
+	buf = malloc(TEAMD_RT_HEAP_PREFAULT);
+	if (!buf)
+		return -ENOMEM;
+	for (i = 0; i < TEAMD_RT_HEAP_PREFAULT; i += pagesize)
+		buf[i] = 0;
+	free((void *) buf);
+	return 0;
+}
+
+static void teamd_realtime_prefault_stack(void)
+{
+	char stack[TEAMD_RT_STACK_PREFAULT];
+	volatile char *ptr = stack;
+	int pagesize = getpagesize();
+	int i;
+
+	for (i = 0; i < TEAMD_RT_STACK_PREFAULT; i += pagesize)
+		ptr[i] = 0;
+}
+
+static int teamd_realtime_affinity_set(struct teamd_context *ctx)
+{
+	cpu_set_t cpuset;
+	size_t count;
+	int cpu;
+	int err;
+	int i;
+
+	count = teamd_config_arr_size(ctx, "$.realtime.cpus");
+	if (!count)
+		return 0;
+
+	CPU_ZERO(&cpuset);
+	for (i = 0; i < count; i++) {
+		err = teamd_config_int_get(ctx, &cpu, "$.realtime.cpus[%d]", i);
+		if (err || cpu < 0 || cpu >= CPU_SETSIZE) {
+			teamd_log_err("Invalid CPU number in \"realtime.cpus\".");
+			return -EINVAL;
+		}
+		CPU_SET(cpu, &cpuset);
+	}
+	if (sched_setaffinity(0, sizeof(cpuset), &cpuset)) {
+		teamd_log_err("Failed to set CPU affinity.");
+		return -errno;
+	}
+	return 0;
+}
+
+static int teamd_realtime_sched_set(struct teamd_context *ctx)
+{
+	struct sched_param param;
+	int min = sched_get_priority_min(SCHED_FIFO);
+	int max = sched_get_priority_max(SCHED_FIFO);
+	int prio;
+	int err;
+
+	err = teamd_config_int_get(ctx, &prio, "$.realtime.sched_priority");
+	if (err)
+		/* Scheduling class is changed only on request */
+		return 0;
+	if (prio < min || prio > max) {
+		teamd_log_err("\"realtime.sched_priority\" must be in range %d-%d.",
+			      min, max);
+		return -EINVAL;
+	}
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = prio;
+	if (sched_setscheduler(0, SCHED_FIFO, &param)) {
+		teamd_log_err("Failed to set SCHED_FIFO scheduling class.");
+		return -errno;
+	}
+	teamd_log_dbg("Using SCHED_FIFO scheduling class, priority %d.", prio);
+	return 0;
+}
+
+static bool teamd_realtime_enabled(struct teamd_context *ctx)
+{
+	bool enabled;
+	int err;
+
+	if (ctx->realtime)
+		return true;
+	err = teamd_config_bool_get(ctx, &enabled, "$.realtime.enabled");
+	return !err && enabled;
+}
+
+int teamd_realtime_init(struct teamd_context *ctx)
+{
+	int err;
+
+	if (!teamd_realtime_enabled(ctx))
+		return 0;
+	ctx->realtime = true;
+
+	err = teamd_realtime_affinity_set(ctx);
+	if (err)
+		return err;
+	err = teamd_realtime_prefault_heap();
+	if (err)
+		return err;
+	if (mlockall(MCL_CURRENT | MCL_FUTURE)) {
+		teamd_log_err("Failed to lock memory.");
+		return -errno;
+	}
+	teamd_realtime_prefault_stack();
+	err = teamd_realtime_sched_set(ctx);
+	if (err)
+		goto munlock;
+	teamd_log_info("Running in real-time mode.");
+	return 0;
+
+munlock:
+	munlockall();
+	return err;
+}
+
+void teamd_realtime_fini(struct teamd_context *ctx)
+{
+	if (!ctx->realtime)
+		return;
+	munlockall();
+}
+
+#ifdef ENABLE_RT_ALLOC_CHECK
+
+/*
+ * Heap allocation functions are interposed in this test build so any
+ * allocation inside no-alloc section is caught right where it happens.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+unsigned int teamd_rt_noalloc_depth;
+
+static void teamd_rt_alloc_check(const char *fn_name)
+{
+	if (!teamd_rt_noalloc_depth)
+		return;
+	/* Logging allocates too */
+	teamd_rt_noalloc_depth = 0;
+	teamd_log_err("BUG: %s() called in no-alloc section.", fn_name);
+	abort();
+}
+
+void *malloc(size_t size)
+{
+	teamd_rt_alloc_check("malloc");
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	teamd_rt_alloc_check("calloc");
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	teamd_rt_alloc_check("realloc");
+	return __libc_realloc(ptr, size);
+}
+
+#endif /* ENABLE_RT_ALLOC_CHECK */
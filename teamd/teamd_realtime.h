@@ -0,0 +1,94 @@
+/*
+ *   teamd_realtime.h - Real-time mode support for teamd
+ *   Copyright (C) 2026 libteam contributors
+ *
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _TEAMD_REALTIME_H_
+#define _TEAMD_REALTIME_H_
+
+#include "teamd.h"
+
+int teamd_realtime_init(struct teamd_context *ctx);
+void teamd_realtime_fini(struct teamd_context *ctx);
+
+/*
+ * Code between teamd_rt_noalloc_begin() and teamd_rt_noalloc_end() must not
+ * allocate from heap. Checked only in builds with --enable-rt-alloc-check,
+ * where any allocation in such section aborts teamd. Logging is exempt,
+ * libteam calls which send netlink messages are wrapped by
+ * teamd_rt_alloc_allowed().
+ */
+#ifdef ENABLE_RT_ALLOC_CHECK
+
+extern unsigned int teamd_rt_noalloc_depth;
+
+static inline void teamd_rt_noalloc_begin(void)
+{
+	teamd_rt_noalloc_depth++;
+}
+
+static inline void teamd_rt_noalloc_end(void)
+{
+	teamd_rt_noalloc_depth--;
+}
+
+/* For calls out of our control (logging, libteam) inside the section */
+static inline unsigned int teamd_rt_noalloc_suspend(void)
+{
+	unsigned int depth = teamd_rt_noalloc_depth;
+
+	teamd_rt_noalloc_depth = 0;
+	return depth;
+}
+
+static inline void teamd_rt_noalloc_resume(unsigned int depth)
+{
+	teamd_rt_noalloc_depth = depth;
+}
+
+#else
+
+static inline void teamd_rt_noalloc_begin(void)
+{
+}
+
+static inline void teamd_rt_noalloc_end(void)
+{
+}
+
+static inline unsigned int teamd_rt_noalloc_suspend(void)
+{
+	return 0;
+}
+
+static inline void teamd_rt_noalloc_resume(unsigned int depth)
+{
+}
+
+#endif /* ENABLE_RT_ALLOC_CHECK */
+
+/* Runs the call with check suspended, evaluates to what it returned */
+#define teamd_rt_alloc_allowed(call)					\
+	({								\
+		unsigned int __rt_depth = teamd_rt_noalloc_suspend();	\
+		typeof(call) __rt_ret = (call);				\
+									\
+		teamd_rt_noalloc_resume(__rt_depth);			\
+		__rt_ret;						\
+	})
+
+#endif /* _TEAMD_REALTIME_H_ */
@@ -22,15 +22,17 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 #include <sys/socket.h>
 #include <linux/netdevice.h>
-#include <limits.h>
 #include <private/misc.h>
+#include <private/list.h>
 #include <team.h>
 
 #include "teamd.h"
 #include "teamd_config.h"
 #include "teamd_state.h"
+#include "teamd_realtime.h"
 #include "teamd_workq.h"
 
 struct ab;
@@ -49,13 +51,40 @@ struct ab_hwaddr_policy {
 
 struct ab {
 	uint32_t active_ifindex;
+	uint32_t kernel_active_ifindex;
 	char active_orig_hwaddr[MAX_ADDR_LEN];
 	const struct ab_hwaddr_policy *hwaddr_policy;
 	struct teamd_workq link_watch_handler_workq;
+	struct teamd_peer_notify *peer_notify;
+	struct list_item rank_list; /* ports with link up, best first */
+	struct {
+		struct timespec down; /* when active port link went down */
+		unsigned int count;
+		unsigned int latency; /* in microseconds */
+		unsigned int latency_max;
+	} failover;
+	struct {
+		uint32_t ifindex; /* port waiting to preempt the active one */
+		struct timespec expires;
+		struct teamd_workq workq;
+	} preempt;
+	struct {
+		unsigned int coalesce_window;
+#define		AB_DFLT_COALESCE_WINDOW 0
+		unsigned int preempt_delay;
+#define		AB_DFLT_PREEMPT_DELAY 0
+	} cfg;
 };
 
 struct ab_port {
 	struct teamd_port *tdport;
+	struct list_item rank_list;
+	bool ranked;
+	bool link_up;
+	struct timespec up_since;
+	int prio;
+	uint32_t speed;
+	uint8_t duplex;
 	struct {
 		bool sticky;
 #define		AB_DFLT_PORT_STICKY false
@@ -77,6 +106,101 @@ static bool ab_is_port_sticky(struct ab *ab, struct teamd_port *tdport)
 	return ab_port_get(ab, tdport)->cfg.sticky;
 }
 
+/*
+ * Port ranking. Ports with link up are kept in ab->rank_list ordered by
+ * prio, speed and duplex, best one first. The list is updated only when
+ * the state of some port changes, so picking the best port is just taking
+ * the first one.
+ */
+static int ab_port_cmp(struct ab_port *ab_port1, struct ab_port *ab_port2)
+{
+	if (ab_port1->prio != ab_port2->prio)
+		return ab_port1->prio > ab_port2->prio ? 1 : -1;
+	if (ab_port1->speed != ab_port2->speed)
+		return ab_port1->speed > ab_port2->speed ? 1 : -1;
+	if (ab_port1->duplex != ab_port2->duplex)
+		return ab_port1->duplex > ab_port2->duplex ? 1 : -1;
+	return 0;
+}
+
+static void ab_port_unrank(struct ab_port *ab_port)
+{
+	if (!ab_port->ranked)
+		return;
+	list_del(&ab_port->rank_list);
+	ab_port->ranked = false;
+}
+
+static void ab_port_rank(struct ab *ab, struct ab_port *ab_port)
+{
+	struct ab_port *cur;
+
+	ab_port_unrank(ab_port);
+	if (!ab_port->link_up)
+		return;
+	/* Insert after ports of equal rank, so the older one stays first */
+	list_for_each_node_entry(cur, &ab->rank_list, rank_list)
+		if (ab_port_cmp(ab_port, cur) > 0)
+			break;
+	__list_add(&ab_port->rank_list, cur->rank_list.prev, &cur->rank_list);
+	ab_port->ranked = true;
+}
+
+static struct ab_port *ab_best_port_get(struct ab *ab)
+{
+	if (list_empty(&ab->rank_list))
+		return NULL;
+	return list_get_node_entry(ab->rank_list.next, struct ab_port,
+				   rank_list);
+}
+
+/* Returns true in case rank relevant port state changed */
+static bool ab_port_state_update(struct teamd_context *ctx,
+				 struct ab_port *ab_port)
+{
+	struct teamd_port *tdport = ab_port->tdport;
+	bool link_up = teamd_link_watch_port_up(ctx, tdport);
+	uint32_t speed = team_get_port_speed(tdport->team_port);
+	uint8_t duplex = team_get_port_duplex(tdport->team_port);
+
+	if (link_up == ab_port->link_up && speed == ab_port->speed &&
+	    duplex == ab_port->duplex)
+		return false;
+	if (link_up && !ab_port->link_up)
+		teamd_clock_gettime(ctx, &ab_port->up_since);
+	ab_port->link_up = link_up;
+	ab_port->speed = speed;
+	ab_port->duplex = duplex;
+	return true;
+}
+
+static void ab_failover_start(struct teamd_context *ctx, struct ab *ab)
+{
+	if (!timespec_is_zero(&ab->failover.down))
+		return;
+	teamd_clock_gettime(ctx, &ab->failover.down);
+}
+
+static void ab_failover_done(struct teamd_context *ctx, struct ab *ab)
+{
+	struct timespec now;
+	long long usec;
+
+	if (timespec_is_zero(&ab->failover.down))
+		return;
+	teamd_clock_gettime(ctx, &now);
+	usec = (now.tv_sec - ab->failover.down.tv_sec) * 1000000LL +
+	       (now.tv_nsec - ab->failover.down.tv_nsec) / 1000;
+	memset(&ab->failover.down, 0, sizeof(ab->failover.down));
+	if (usec < 0)
+		usec = 0;
+	ab->failover.count++;
+	ab->failover.latency = usec;
+	if (ab->failover.latency > ab->failover.latency_max)
+		ab->failover.latency_max = ab->failover.latency;
+	teamd_log_dbg("Failover took %u us.", ab->failover.latency);
+}
+
 static int ab_hwaddr_policy_same_all_hwaddr_changed(struct teamd_context *ctx,
 						    struct ab *ab)
 {
@@ -123,9 +247,10 @@ static int ab_hwaddr_policy_by_active_active_set(struct teamd_context *ctx,
 {
 	int err;
 
-	err = team_hwaddr_set(ctx->th, ctx->ifindex,
-			      team_get_ifinfo_hwaddr(tdport->team_ifinfo),
-			      ctx->hwaddr_len);
+	err = teamd_rt_alloc_allowed(
+		team_hwaddr_set(ctx->th, ctx->ifindex,
+				team_get_ifinfo_hwaddr(tdport->team_ifinfo),
+				ctx->hwaddr_len));
 	if (err) {
 		teamd_log_err("Failed to set team hardware address.");
 		return err;
@@ -166,8 +291,9 @@ static int ab_hwaddr_policy_only_active_active_set(struct teamd_context *ctx,
 	memcpy(ab->active_orig_hwaddr,
 	       team_get_ifinfo_hwaddr(tdport->team_ifinfo),
 	       ctx->hwaddr_len);
-	err = team_hwaddr_set(ctx->th, tdport->ifindex, ctx->hwaddr,
-			      ctx->hwaddr_len);
+	err = teamd_rt_alloc_allowed(
+		team_hwaddr_set(ctx->th, tdport->ifindex, ctx->hwaddr,
+				ctx->hwaddr_len));
 	if (err) {
 		teamd_log_err("%s: Failed to set port hardware address.",
 			      tdport->ifname);
@@ -182,9 +308,9 @@ static int ab_hwaddr_policy_only_active_active_clear(struct teamd_context *ctx,
 {
 	int err;
 
-	err = team_hwaddr_set(ctx->th, tdport->ifindex,
-			      ab->active_orig_hwaddr,
-			      ctx->hwaddr_len);
+	err = teamd_rt_alloc_allowed(
+		team_hwaddr_set(ctx->th, tdport->ifindex,
+				ab->active_orig_hwaddr, ctx->hwaddr_len));
 	if (err) {
 		teamd_log_err("%s: Failed to set port hardware address.",
 			      tdport->ifname);
@@ -234,7 +360,8 @@ static int ab_clear_active_port(struct teamd_context *ctx, struct ab *ab,
 		return 0;
 	teamd_log_dbg("Clearing active port \"%s\".", tdport->ifname);
 
-	err = team_set_port_enabled(ctx->th, tdport->ifindex, false);
+	err = teamd_rt_alloc_allowed(
+		team_set_port_enabled(ctx->th, tdport->ifindex, false));
 	if (err) {
 		teamd_log_err("%s: Failed to disable active port.",
 			      tdport->ifname);
@@ -251,67 +378,49 @@ static int ab_clear_active_port(struct teamd_context *ctx, struct ab *ab,
 static int ab_set_active_port(struct teamd_context *ctx, struct ab *ab,
 			      struct teamd_port *tdport)
 {
+	const char *hwaddr;
 	int err;
 
-	err = team_set_port_enabled(ctx->th, tdport->ifindex, true);
+	err = teamd_rt_alloc_allowed(
+		team_set_port_enabled(ctx->th, tdport->ifindex, true));
 	if (err) {
 		teamd_log_err("%s: Failed to enable active port.",
 			      tdport->ifname);
 		return err;
 	}
-	err = team_set_active_port(ctx->th, tdport->ifindex);
+	err = teamd_rt_alloc_allowed(
+		team_set_active_port(ctx->th, tdport->ifindex));
 	if (err) {
 		teamd_log_err("%s: Failed to set as active port.",
 			      tdport->ifname);
 		goto err_set_active_port;
 	}
+	ab->kernel_active_ifindex = tdport->ifindex;
 	if (ab->hwaddr_policy->active_set) {
 		err =  ab->hwaddr_policy->active_set(ctx, ab, tdport);
 		if (err)
 			goto err_hwaddr_policy_active_set;
 	}
 	ab->active_ifindex = tdport->ifindex;
+	ab_failover_done(ctx, ab);
 	teamd_log_info("Changed active port to \"%s\".", tdport->ifname);
+
+	/* Team device took over hardware address of the port in that case */
+	if (ab->hwaddr_policy == &ab_hwaddr_policy_by_active)
+		hwaddr = team_get_ifinfo_hwaddr(tdport->team_ifinfo);
+	else
+		hwaddr = ctx->hwaddr;
+	if (teamd_peer_notify_start(ab->peer_notify, tdport, hwaddr))
+		teamd_log_warn("%s: Failed to notify peers.", tdport->ifname);
 	return 0;
 
 err_set_active_port:
 err_hwaddr_policy_active_set:
-	team_set_port_enabled(ctx->th, tdport->ifindex, false);
+	teamd_rt_alloc_allowed(
+		team_set_port_enabled(ctx->th, tdport->ifindex, false));
 	return err;
 }
 
-struct ab_port_state_info {
-	struct teamd_port *tdport;
-	uint32_t speed;
-	uint8_t duplex;
-	int prio;
-};
-
-static void ab_best_port_check_set(struct teamd_context *ctx,
-				   struct ab_port_state_info *best,
-				   struct teamd_port *tdport)
-{
-	struct team_port *port = tdport->team_port;
-	uint32_t speed;
-	uint8_t duplex;
-	int prio;
-
-	if (!teamd_link_watch_port_up(ctx, tdport) || best->tdport == tdport)
-		return;
-
-	speed = team_get_port_speed(port);
-	duplex = team_get_port_duplex(port);
-	prio = teamd_port_prio(ctx, tdport);
-
-	if (!best->tdport || (prio > best->prio) || (speed > best->speed) ||
-	    (speed == best->speed && duplex > best->duplex)) {
-		best->tdport = tdport;
-		best->prio = prio;
-		best->speed = speed;
-		best->duplex = duplex;
-	}
-}
-
 static int ab_change_active_port(struct teamd_context *ctx, struct ab *ab,
 				 struct teamd_port *active_tdport,
 				 struct teamd_port *new_active_tdport)
@@ -332,61 +441,93 @@ static int ab_change_active_port(struct teamd_context *ctx, struct ab *ab,
 	return 0;
 }
 
+static int ab_preempt_remaining_ms(struct ab *ab, struct timespec *now)
+{
+	return (ab->preempt.expires.tv_sec - now->tv_sec) * 1000 +
+	       (ab->preempt.expires.tv_nsec - now->tv_nsec) / 1000000;
+}
+
+static void ab_preempt_clear(struct teamd_context *ctx, struct ab *ab)
+{
+	ab->preempt.ifindex = 0;
+	teamd_workq_cancel_work(ctx, &ab->preempt.workq);
+}
+
+/*
+ * Port which is better than the active one has to be up for preempt_delay
+ * before it takes over, so unstable port does not cause repeated
+ * switchovers. Returns true in case the preemption has to wait.
+ */
+static bool ab_preempt_hold(struct teamd_context *ctx, struct ab *ab,
+			    struct ab_port *best)
+{
+	struct timespec now;
+	struct timespec delay;
+	int remaining;
+
+	if (!ab->cfg.preempt_delay)
+		return false;
+	ms_to_timespec(&delay, ab->cfg.preempt_delay);
+	ab->preempt.expires = best->up_since;
+	timespec_add(&ab->preempt.expires, &delay);
+	teamd_clock_gettime(ctx, &now);
+	if (timespec_cmp(&now, &ab->preempt.expires) >= 0)
+		return false;
+	remaining = ab_preempt_remaining_ms(ab, &now);
+	teamd_log_dbg("Port \"%s\" will preempt active port in %d ms.",
+		      best->tdport->ifname, remaining);
+	ab->preempt.ifindex = best->tdport->ifindex;
+	teamd_workq_schedule_delayed(ctx, &ab->preempt.workq, remaining + 1);
+	return true;
+}
+
 static int ab_link_watch_handler(struct teamd_context *ctx, struct ab *ab)
 {
-	struct teamd_port *tdport;
 	struct teamd_port *active_tdport;
-	struct ab_port_state_info best;
+	struct ab_port *active_ab_port = NULL;
+	struct ab_port *best;
 	int err;
-	uint32_t active_ifindex;
-
-	memset(&best, 0, sizeof(best));
-	best.prio = INT_MIN;
 
+	ab_preempt_clear(ctx, ab);
 	active_tdport = teamd_get_port(ctx, ab->active_ifindex);
 	if (active_tdport) {
+		active_ab_port = ab_port_get(ab, active_tdport);
 		teamd_log_dbg("Current active port: \"%s\" (ifindex \"%d\", prio \"%d\").",
 			      active_tdport->ifname, active_tdport->ifindex,
-			      teamd_port_prio(ctx, active_tdport));
-
-		err = team_get_active_port(ctx->th, &active_ifindex);
-		if (err) {
-			teamd_log_err("Failed to get active port.");
-			return err;
-		}
+			      active_ab_port->prio);
 
 		/*
 		 * When active port went down or it is other than currently set,
 		 * clear it and proceed as if none was set in the first place.
 		 */
-		if (!teamd_link_watch_port_up(ctx, active_tdport) ||
-		    active_ifindex != active_tdport->ifindex) {
+		if (!active_ab_port->link_up ||
+		    ab->kernel_active_ifindex != active_tdport->ifindex) {
 			err = ab_clear_active_port(ctx, ab, active_tdport);
 			if (err)
 				return err;
 			active_tdport = NULL;
+			active_ab_port = NULL;
 		}
 	}
 
 	/*
-	 * Find the best port amond all ports. Prefer the currently active
-	 * port, if there's any. This is because other port might have the
-	 * same prio, speed and duplex. We do not want to change in that case
+	 * Prefer the currently active port, if there's any, unless the best
+	 * port is ranked strictly higher. Other port might have the same prio,
+	 * speed and duplex. We do not want to change in that case.
 	 */
-	if (active_tdport && teamd_port_present(ctx, active_tdport))
-		ab_best_port_check_set(ctx, &best, active_tdport);
-	teamd_for_each_tdport(tdport, ctx)
-		ab_best_port_check_set(ctx, &best, tdport);
-
-	if (!best.tdport || best.tdport == active_tdport)
+	best = ab_best_port_get(ab);
+	if (!best || best == active_ab_port ||
+	    (active_ab_port && ab_port_cmp(best, active_ab_port) <= 0))
 		return 0;
 
 	teamd_log_dbg("Found best port: \"%s\" (ifindex \"%d\", prio \"%d\").",
-		      best.tdport->ifname, best.tdport->ifindex, best.prio);
+		      best->tdport->ifname, best->tdport->ifindex, best->prio);
 
 	if (!active_tdport || !ab_is_port_sticky(ab, active_tdport)) {
+		if (active_tdport && ab_preempt_hold(ctx, ab, best))
+			return 0;
 		err = ab_change_active_port(ctx, ab, active_tdport,
-					    best.tdport);
+					    best->tdport);
 		if (err)
 			return err;
 	}
@@ -402,6 +543,15 @@ static int ab_link_watch_handler_work(struct teamd_context *ctx,
 	return ab_link_watch_handler(ctx, ab);
 }
 
+static int ab_preempt_work(struct teamd_context *ctx,
+			   struct teamd_workq *workq)
+{
+	struct ab *ab;
+
+	ab = get_container(workq, struct ab, preempt.workq);
+	return ab_link_watch_handler(ctx, ab);
+}
+
 static int ab_event_watch_hwaddr_changed(struct teamd_context *ctx, void *priv)
 {
 	struct ab *ab = priv;
@@ -440,6 +590,9 @@ static int ab_port_added(struct teamd_context *ctx,
 		teamd_log_err("Failed to load port config.");
 		return err;
 	}
+	ab_port->prio = teamd_port_prio(ctx, tdport);
+	ab_port_state_update(ctx, ab_port);
+	ab_port_rank(ab, ab_port);
 	/* Newly added ports are disabled */
 	err = team_set_port_enabled(ctx->th, tdport->ifindex, false);
 	if (err) {
@@ -456,8 +609,14 @@ static void ab_port_removed(struct teamd_context *ctx,
 			    struct teamd_port *tdport,
 			    void *priv, void *creator_priv)
 {
+	struct ab_port *ab_port = priv;
 	struct ab *ab = creator_priv;
 
+	ab_port_unrank(ab_port);
+	if (tdport->ifindex == ab->active_ifindex) {
+		ab_failover_start(ctx, ab);
+		ab_clear_active_port(ctx, ab, tdport);
+	}
 	ab_link_watch_handler(ctx, ab);
 }
 
@@ -475,31 +634,102 @@ static int ab_event_watch_port_added(struct teamd_context *ctx,
 	return teamd_port_priv_create(tdport, &ab_port_priv, ab);
 }
 
+/*
+ * With coalesce window set, changes are not handled right away. Best port
+ * is selected once the window passes, for all changes within it at once.
+ */
+static int ab_link_watch_handler_schedule(struct teamd_context *ctx,
+					  struct ab *ab)
+{
+	if (!ab->cfg.coalesce_window)
+		return ab_link_watch_handler(ctx, ab);
+	teamd_workq_schedule_delayed(ctx, &ab->link_watch_handler_workq,
+				     ab->cfg.coalesce_window);
+	return 0;
+}
+
+static int ab_port_state_changed(struct teamd_context *ctx, struct ab *ab,
+				 struct teamd_port *tdport)
+{
+	struct ab_port *ab_port = ab_port_get(ab, tdport);
+
+	/* Port priv is not created yet, state is read once it is */
+	if (!ab_port || !ab_port_state_update(ctx, ab_port))
+		return 0;
+	ab_port_rank(ab, ab_port);
+	if (!ab_port->link_up && tdport->ifindex == ab->active_ifindex)
+		ab_failover_start(ctx, ab);
+	return ab_link_watch_handler_schedule(ctx, ab);
+}
+
+static int ab_event_watch_port_changed(struct teamd_context *ctx,
+				       struct teamd_port *tdport,
+				       void *priv)
+{
+	return ab_port_state_changed(ctx, priv, tdport);
+}
+
 static int ab_event_watch_port_link_changed(struct teamd_context *ctx,
 					    struct teamd_port *tdport,
 					    void *priv)
 {
-	return ab_link_watch_handler(ctx, priv);
+	return ab_port_state_changed(ctx, priv, tdport);
 }
 
 static int ab_event_watch_prio_option_changed(struct teamd_context *ctx,
 					      struct team_option *option,
 					      void *priv)
 {
-	return ab_link_watch_handler(ctx, priv);
+	struct ab *ab = priv;
+	struct teamd_port *tdport;
+	struct ab_port *ab_port;
+
+	tdport = teamd_get_port(ctx, team_get_option_port_ifindex(option));
+	if (!tdport)
+		return 0;
+	ab_port = ab_port_get(ab, tdport);
+	if (!ab_port)
+		return 0;
+	ab_port->prio = team_get_option_value_s32(option);
+	ab_port_rank(ab, ab_port);
+	return ab_link_watch_handler_schedule(ctx, ab);
 }
 
 static const struct teamd_event_watch_ops ab_event_watch_ops = {
 	.hwaddr_changed = ab_event_watch_hwaddr_changed,
 	.port_added = ab_event_watch_port_added,
+	.port_changed = ab_event_watch_port_changed,
 	.port_link_changed = ab_event_watch_port_link_changed,
 	.option_changed = ab_event_watch_prio_option_changed,
 	.option_changed_match_name = "priority",
 };
 
+/*
+ * Active port in kernel is followed by option events, so the handler does
+ * not need to look it up every time it runs.
+ */
+static int ab_event_watch_activeport_option_changed(struct teamd_context *ctx,
+						    struct team_option *option,
+						    void *priv)
+{
+	struct ab *ab = priv;
+
+	ab->kernel_active_ifindex = team_get_option_value_u32(option);
+	if (!ab->active_ifindex ||
+	    ab->kernel_active_ifindex == ab->active_ifindex)
+		return 0;
+	return ab_link_watch_handler_schedule(ctx, ab);
+}
+
+static const struct teamd_event_watch_ops ab_activeport_event_watch_ops = {
+	.option_changed = ab_event_watch_activeport_option_changed,
+	.option_changed_match_name = "activeport",
+};
+
 static int ab_load_config(struct teamd_context *ctx, struct ab *ab)
 {
 	int err;
+	int tmp;
 	const char *hwaddr_policy_name;
 
 	err = teamd_config_string_get(ctx, &hwaddr_policy_name, "$.runner.hwaddr_policy");
@@ -512,6 +742,26 @@ static int ab_load_config(struct teamd_context *ctx, struct ab *ab)
 		return err;
 	}
 	teamd_log_dbg("Using hwaddr_policy \"%s\".", ab->hwaddr_policy->name);
+
+	err = teamd_config_int_get(ctx, &tmp, "$.runner.coalesce_window");
+	if (err) {
+		tmp = AB_DFLT_COALESCE_WINDOW;
+	} else if (tmp < 0) {
+		teamd_log_err("\"coalesce_window\" must not be negative number.");
+		return -EINVAL;
+	}
+	ab->cfg.coalesce_window = tmp;
+	teamd_log_dbg("Using coalesce_window \"%u\".", ab->cfg.coalesce_window);
+
+	err = teamd_config_int_get(ctx, &tmp, "$.runner.preempt_delay");
+	if (err) {
+		tmp = AB_DFLT_PREEMPT_DELAY;
+	} else if (tmp < 0) {
+		teamd_log_err("\"preempt_delay\" must not be negative number.");
+		return -EINVAL;
+	}
+	ab->cfg.preempt_delay = tmp;
+	teamd_log_dbg("Using preempt_delay \"%u\".", ab->cfg.preempt_delay);
 	return 0;
 }
 
@@ -527,6 +777,76 @@ static int ab_state_active_port_get(struct teamd_context *ctx,
 	return 0;
 }
 
+static int ab_state_reevaluations_merged_get(struct teamd_context *ctx,
+					     struct team_state_gsc *gsc,
+					     void *priv)
+{
+	struct ab *ab = priv;
+
+	gsc->data.int_val = ab->link_watch_handler_workq.merged_count;
+	return 0;
+}
+
+static int ab_state_preempt_port_get(struct teamd_context *ctx,
+				     struct team_state_gsc *gsc,
+				     void *priv)
+{
+	struct ab *ab = priv;
+	struct teamd_port *tdport;
+
+	tdport = teamd_get_port(ctx, ab->preempt.ifindex);
+	gsc->data.str_val.ptr = tdport ? tdport->ifname : "";
+	return 0;
+}
+
+static int ab_state_preempt_remaining_get(struct teamd_context *ctx,
+					  struct team_state_gsc *gsc,
+					  void *priv)
+{
+	struct ab *ab = priv;
+	struct timespec now;
+	int remaining = 0;
+
+	if (ab->preempt.ifindex) {
+		teamd_clock_gettime(ctx, &now);
+		remaining = ab_preempt_remaining_ms(ab, &now);
+		if (remaining < 0)
+			remaining = 0;
+	}
+	gsc->data.int_val = remaining;
+	return 0;
+}
+
+static int ab_state_failovers_get(struct teamd_context *ctx,
+				  struct team_state_gsc *gsc,
+				  void *priv)
+{
+	struct ab *ab = priv;
+
+	gsc->data.int_val = ab->failover.count;
+	return 0;
+}
+
+static int ab_state_failover_latency_get(struct teamd_context *ctx,
+					 struct team_state_gsc *gsc,
+					 void *priv)
+{
+	struct ab *ab = priv;
+
+	gsc->data.int_val = ab->failover.latency;
+	return 0;
+}
+
+static int ab_state_failover_latency_max_get(struct teamd_context *ctx,
+					     struct team_state_gsc *gsc,
+					     void *priv)
+{
+	struct ab *ab = priv;
+
+	gsc->data.int_val = ab->failover.latency_max;
+	return 0;
+}
+
 struct ab_active_port_set_info {
 	struct teamd_workq workq;
 	struct ab *ab;
@@ -582,6 +902,36 @@ static const struct teamd_state_val ab_state_vals[] = {
 		.getter = ab_state_active_port_get,
 		.setter = ab_state_active_port_set,
 	},
+	{
+		.subpath = "reevaluations_merged",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = ab_state_reevaluations_merged_get,
+	},
+	{
+		.subpath = "preempt_port",
+		.type = TEAMD_STATE_ITEM_TYPE_STRING,
+		.getter = ab_state_preempt_port_get,
+	},
+	{
+		.subpath = "preempt_remaining",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = ab_state_preempt_remaining_get,
+	},
+	{
+		.subpath = "failovers",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = ab_state_failovers_get,
+	},
+	{
+		.subpath = "failover_latency",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = ab_state_failover_latency_get,
+	},
+	{
+		.subpath = "failover_latency_max",
+		.type = TEAMD_STATE_ITEM_TYPE_INT,
+		.getter = ab_state_failover_latency_max_get,
+	},
 };
 
 static const struct teamd_state_val ab_state_vg = {
@@ -614,22 +964,39 @@ static int ab_init(struct teamd_context *ctx, void *priv)
 		teamd_log_err("Failed to load config values.");
 		return err;
 	}
+	list_init(&ab->rank_list);
+	teamd_workq_init_work(&ab->link_watch_handler_workq,
+			      ab_link_watch_handler_work);
+	teamd_workq_init_work(&ab->preempt.workq, ab_preempt_work);
+	err = teamd_peer_notify_init(ctx, &ab->peer_notify);
+	if (err) {
+		teamd_log_err("Failed to init peer notify.");
+		return err;
+	}
 	err = teamd_event_watch_register(ctx, &ab_event_watch_ops, ab);
 	if (err) {
 		teamd_log_err("Failed to register event watch.");
-		return err;
+		goto peer_notify_fini;
+	}
+	err = teamd_event_watch_register(ctx, &ab_activeport_event_watch_ops,
+					 ab);
+	if (err) {
+		teamd_log_err("Failed to register activeport event watch.");
+		goto event_watch_unregister;
 	}
 	err = teamd_state_val_register(ctx, &ab_state_vg, ab);
 	if (err) {
 		teamd_log_err("Failed to register state value group.");
-		goto event_watch_unregister;
+		goto activeport_event_watch_unregister;
 	}
-	teamd_workq_init_work(&ab->link_watch_handler_workq,
-			      ab_link_watch_handler_work);
 	return 0;
 
+activeport_event_watch_unregister:
+	teamd_event_watch_unregister(ctx, &ab_activeport_event_watch_ops, ab);
 event_watch_unregister:
 	teamd_event_watch_unregister(ctx, &ab_event_watch_ops, ab);
+peer_notify_fini:
+	teamd_peer_notify_fini(ab->peer_notify);
 	return err;
 }
 
@@ -637,8 +1004,12 @@ static void ab_fini(struct teamd_context *ctx, void *priv)
 {
 	struct ab *ab = priv;
 
+	teamd_workq_cancel_work(ctx, &ab->preempt.workq);
+	teamd_workq_cancel_work(ctx, &ab->link_watch_handler_workq);
 	teamd_state_val_unregister(ctx, &ab_state_vg, ab);
+	teamd_event_watch_unregister(ctx, &ab_activeport_event_watch_ops, ab);
 	teamd_event_watch_unregister(ctx, &ab_event_watch_ops, ab);
+	teamd_peer_notify_fini(ab->peer_notify);
 }
 
 const struct teamd_runner teamd_runner_activebackup = {
@@ -34,6 +34,7 @@
 #include "teamd.h"
 #include "teamd_config.h"
 #include "teamd_state.h"
+#include "teamd_realtime.h"
 #include "teamd_workq.h"
 
 /*
@@ -125,9 +126,37 @@ static const char *lacp_agg_select_policy_names_list[] = {
 
 struct lacp_port;
 
+/*
+ * Aggregator is identified by its leading port. Member ports, their count,
+ * bandwidth and number of sticky ones are kept up to date as ports are
+ * selected into and unselected from it, so aggregator selection walks
+ * aggregators only and does not need to look at every port.
+ */
+struct lacp_agg {
+	struct list_item list; /* in lacp->agg_list */
+	struct lacp *lacp;
+	struct lacp_port *lead;
+	struct list_item port_list;
+	unsigned int port_count;
+	uint32_t bandwidth;
+	unsigned int sticky_count;
+};
+
+/*
+ * Periodic LACPDUs of all ports are queued and sent by a single sendmmsg()
+ * on a socket which is not bound to any port, once protocol callbacks of
+ * the loop iteration are processed. Periodic timers are aligned to the
+ * interval, so ports with the same rate expire in the same loop iteration
+ * and end up in one syscall.
+ */
+#define LACP_TX_BATCH_MAX_MSGS 64
+
 struct lacp {
 	struct teamd_context *ctx;
-	struct lacp_port *selected_agg_lead; /* leading port of selected aggregator */
+	struct lacp_agg *selected_agg;
+	struct list_item agg_list;
+	struct list_item agg_free_list; /* one aggregator per port, see below */
+	unsigned int ports_enabled; /* ports enabled by lacp_port_update_enabled() */
 	bool carrier_up;
 	struct {
 		bool active;
@@ -138,10 +167,20 @@ struct lacp {
 #define		LACP_CFG_DFLT_FAST_RATE false
 		int min_ports;
 #define		LACP_CFG_DFLT_MIN_PORTS 1
+		unsigned int min_health;
+#define		LACP_CFG_DFLT_MIN_HEALTH 0
 		enum lacp_agg_select_policy agg_select_policy;
 #define		LACP_CFG_DFLT_AGG_SELECT_POLICY LACP_AGG_SELECT_LACP_PRIO
 	} cfg;
 	struct teamd_balancer *tb;
+	struct {
+		int sock;
+		unsigned int count;
+		struct lacp_port *ports[LACP_TX_BATCH_MAX_MSGS];
+		struct mmsghdr mmsgs[LACP_TX_BATCH_MAX_MSGS];
+		struct iovec iovs[LACP_TX_BATCH_MAX_MSGS];
+		struct teamd_workq flush_workq;
+	} tx_batch;
 };
 
 enum lacp_port_state {
@@ -163,12 +202,19 @@ struct lacp_port {
 	struct teamd_port *tdport;
 	struct lacp *lacp;
 	int sock;
+	struct sockaddr_ll ll_slow;
+	struct lacpdu lacpdu; /* prebuilt, patched on actor/partner change */
+	bool tx_queued;
 	struct lacpdu_info actor;
 	struct lacpdu_info partner;
 	struct lacpdu_info __partner_last; /* last state before update */
 	bool periodic_on;
-	struct lacp_port *agg_lead; /* leading port of aggregator.
-				     * NULL in case this port is not selected */
+	struct lacp_agg *agg; /* NULL in case this port is not selected */
+	struct list_item agg_list; /* in agg->port_list */
+	uint32_t agg_speed; /* speed accounted in agg->bandwidth */
+	bool enabled; /* accounted in lacp->ports_enabled */
+	bool healthy; /* health is at least min_health */
+	int prio; /* team port priority, followed by option events */
 	enum lacp_port_state state;
 	struct {
 		uint32_t speed;
@@ -196,29 +242,29 @@ static struct lacp_port *lacp_port_get(struct lacp *lacp,
 	return teamd_get_first_port_priv_by_creator(tdport, lacp);
 }
 
-static uint32_t lacp_agg_id(struct lacp_port *agg_lead)
+static uint32_t lacp_agg_id(struct lacp_agg *agg)
 {
-	return agg_lead ? agg_lead->tdport->ifindex : 0;
+	return agg ? agg->lead->tdport->ifindex : 0;
 }
 
-static bool lacp_agg_selected(struct lacp_port *agg_lead)
+static bool lacp_agg_selected(struct lacp_agg *agg)
 {
-	return agg_lead ? agg_lead == agg_lead->lacp->selected_agg_lead : false;
+	return agg ? agg == agg->lacp->selected_agg : false;
 }
 
 static uint32_t lacp_port_agg_id(struct lacp_port *lacp_port)
 {
-	return lacp_agg_id(lacp_port->agg_lead);
+	return lacp_agg_id(lacp_port->agg);
 }
 
 static uint32_t lacp_port_agg_selected(struct lacp_port *lacp_port)
 {
-	return lacp_agg_selected(lacp_port->agg_lead);
+	return lacp_agg_selected(lacp_port->agg);
 }
 
 static bool lacp_port_is_agg_lead(struct lacp_port *lacp_port)
 {
-	return lacp_port->agg_lead == lacp_port;
+	return lacp_port->agg && lacp_port->agg->lead == lacp_port;
 }
 
 static const char *lacp_get_agg_select_policy_name(struct lacp *lacp)
@@ -281,6 +327,17 @@ static int lacp_load_config(struct teamd_context *ctx, struct lacp *lacp)
 	}
 	teamd_log_dbg("Using min_ports \"%d\".", lacp->cfg.min_ports);
 
+	err = teamd_config_int_get(ctx, &tmp, "$.runner.min_health");
+	if (err) {
+		lacp->cfg.min_health = LACP_CFG_DFLT_MIN_HEALTH;
+	} else if (tmp < 0 || tmp > 100) {
+		teamd_log_err("\"min_health\" value is out of its limits.");
+		return -EINVAL;
+	} else {
+		lacp->cfg.min_health = tmp;
+	}
+	teamd_log_dbg("Using min_health \"%u\".", lacp->cfg.min_health);
+
 	err = teamd_config_string_get(ctx, &agg_select_policy_name, "$.runner.agg_select_policy");
 	if (err)
 		agg_select_policy_name = NULL;
@@ -295,6 +352,21 @@ static int lacp_load_config(struct teamd_context *ctx, struct lacp *lacp)
 	return 0;
 }
 
+/* Returns true in case the port got healthy or unhealthy */
+static bool lacp_port_healthy_update(struct lacp_port *lacp_port)
+{
+	unsigned int min_health = lacp_port->lacp->cfg.min_health;
+	bool healthy;
+
+	healthy = !min_health ||
+		  teamd_link_watch_port_health(lacp_port->ctx,
+					       lacp_port->tdport) >= min_health;
+	if (healthy == lacp_port->healthy)
+		return false;
+	lacp_port->healthy = healthy;
+	return true;
+}
+
 static bool lacp_port_selectable(struct lacp_port *lacp_port)
 {
 	if (!memcmp(lacp_port->actor.system,
@@ -303,6 +375,9 @@ static bool lacp_port_selectable(struct lacp_port *lacp_port)
 			       "team device.", lacp_port->tdport->ifname);
 		return false;
 	}
+	/* Partner stops using port not in sync, so no flow is black-holed */
+	if (!lacp_port->healthy)
+		return false;
 	if (lacp_port->state == PORT_STATE_CURRENT)
 		return true;
 	return false;
@@ -310,7 +385,7 @@ static bool lacp_port_selectable(struct lacp_port *lacp_port)
 
 static bool lacp_port_selected(struct lacp_port *lacp_port)
 {
-	return lacp_port->agg_lead;
+	return lacp_port->agg;
 }
 
 static int lacp_port_should_be_enabled(struct lacp_port *lacp_port)
@@ -318,7 +393,7 @@ static int lacp_port_should_be_enabled(struct lacp_port *lacp_port)
 	struct lacp *lacp = lacp_port->lacp;
 
 	if (lacp_port_selected(lacp_port) &&
-	    lacp_port->agg_lead == lacp->selected_agg_lead)
+	    lacp_port->agg == lacp->selected_agg)
 		return true;
 	return false;
 }
@@ -328,16 +403,34 @@ static int lacp_port_should_be_disabled(struct lacp_port *lacp_port)
 	struct lacp *lacp = lacp_port->lacp;
 
 	if (!lacp_port_selected(lacp_port) ||
-	    lacp_port->agg_lead != lacp->selected_agg_lead)
+	    lacp_port->agg != lacp->selected_agg)
 		return true;
 	return false;
 }
 
+static void lacp_port_enabled_set(struct lacp_port *lacp_port, bool enabled)
+{
+	if (lacp_port->enabled == enabled)
+		return;
+	lacp_port->enabled = enabled;
+	if (enabled)
+		lacp_port->lacp->ports_enabled++;
+	else
+		lacp_port->lacp->ports_enabled--;
+}
+
 static int lacp_port_update_enabled(struct lacp_port *lacp_port)
 {
-	return teamd_port_check_enable(lacp_port->ctx, lacp_port->tdport,
-				       lacp_port_should_be_enabled(lacp_port),
-				       lacp_port_should_be_disabled(lacp_port));
+	bool should_enable = lacp_port_should_be_enabled(lacp_port);
+	int err;
+
+	err = teamd_port_check_enable(lacp_port->ctx, lacp_port->tdport,
+				      should_enable,
+				      lacp_port_should_be_disabled(lacp_port));
+	if (err)
+		return err;
+	lacp_port_enabled_set(lacp_port, should_enable);
+	return 0;
 }
 
 static bool lacp_ports_aggregable(struct lacp_port *lacp_port1,
@@ -354,7 +447,6 @@ static bool lacp_ports_aggregable(struct lacp_port *lacp_port1,
 
 static bool lacp_port_correct_aggregation(struct lacp_port *checked_lacp_port)
 {
-	struct teamd_port *tdport;
 	struct lacp_port *lacp_port;
 
 	/* Find first port in same aggregator and see if checked port is
@@ -362,11 +454,9 @@ static bool lacp_port_correct_aggregation(struct lacp_port *checked_lacp_port)
 	 * in aggregator besides the checked one are aggregable with each other.
 	 */
 
-	teamd_for_each_tdport(tdport, checked_lacp_port->ctx) {
-		lacp_port = lacp_port_get(checked_lacp_port->lacp, tdport);
-		if (!lacp_port_selected(lacp_port) ||
-		    lacp_port->agg_lead != checked_lacp_port->agg_lead ||
-		    lacp_port == checked_lacp_port)
+	list_for_each_node_entry(lacp_port, &checked_lacp_port->agg->port_list,
+				 agg_list) {
+		if (lacp_port == checked_lacp_port)
 			continue;
 		return lacp_ports_aggregable(lacp_port, checked_lacp_port);
 	}
@@ -410,10 +500,7 @@ static bool lacp_port_better_by_lacp_prio(struct lacp_port *lacp_port1,
 static bool lacp_port_better_by_port_config(struct lacp_port *lacp_port1,
 					    struct lacp_port *lacp_port2)
 {
-	int prio1 = teamd_port_prio(lacp_port1->ctx, lacp_port1->tdport);
-	int prio2 = teamd_port_prio(lacp_port2->ctx, lacp_port2->tdport);
-
-	return prio1 > prio2;
+	return lacp_port1->prio > lacp_port2->prio;
 }
 
 static bool lacp_port_better(struct lacp_port *lacp_port1,
@@ -436,7 +523,8 @@ static int lacp_set_carrier(struct lacp *lacp, bool carrier_up)
 
 	if (lacp->carrier_up != carrier_up) {
 		lacp->carrier_up = carrier_up;
-		err = team_carrier_set(ctx->th, carrier_up);
+		err = teamd_rt_alloc_allowed(team_carrier_set(ctx->th,
+							      carrier_up));
 		if (err)
 			return err == -EOPNOTSUPP ? 0 : err;
 		teamd_log_info("carrier changed to %s",
@@ -448,209 +536,206 @@ static int lacp_set_carrier(struct lacp *lacp, bool carrier_up)
 
 static int lacp_update_carrier(struct lacp *lacp)
 {
-	struct teamd_port *tdport;
-	int ports_enabled;
-	bool state;
-	int err;
-
-	ports_enabled = 0;
-	teamd_for_each_tdport(tdport, lacp->ctx) {
-		err = teamd_port_enabled(lacp->ctx, tdport, &state);
-		if (err)
-			return err;
-		if (state && ++ports_enabled >= lacp->cfg.min_ports)
-			return lacp_set_carrier(lacp, true);
-	}
-
-	return lacp_set_carrier(lacp, false);
+	return lacp_set_carrier(lacp,
+				lacp->ports_enabled >= lacp->cfg.min_ports);
 }
 
-static uint32_t lacp_get_agg_bandwidth(struct lacp_port *agg_lead)
+static struct lacp_agg *lacp_get_best_agg_by_bandwidth(struct lacp *lacp)
 {
-	struct teamd_port *tdport;
-	struct lacp_port *lacp_port;
-	uint32_t speed = 0;
-
-	teamd_for_each_tdport(tdport, agg_lead->ctx) {
-		lacp_port = lacp_port_get(agg_lead->lacp, tdport);
-		if (lacp_port->agg_lead == agg_lead)
-			speed += team_get_port_speed(tdport->team_port);
-	}
-	return speed;
-}
-
-static struct lacp_port *lacp_get_best_agg_by_bandwidth(struct lacp *lacp)
-{
-	struct teamd_port *tdport;
-	struct lacp_port *lacp_port;
-	uint32_t speed;
+	struct lacp_agg *agg;
 	uint32_t best_speed = 0;
-	struct lacp_port *best_agg_lead = NULL;
+	struct lacp_agg *best_agg = NULL;
 
-	teamd_for_each_tdport(tdport, lacp->ctx) {
-		lacp_port = lacp_port_get(lacp, tdport);
-		if (!lacp_port_selected(lacp_port))
-			continue;
-		speed = lacp_get_agg_bandwidth(lacp_port->agg_lead);
-		if (speed > best_speed) {
-			best_speed = speed;
-			best_agg_lead = lacp_port->agg_lead;
+	list_for_each_node_entry(agg, &lacp->agg_list, list) {
+		if (agg->bandwidth > best_speed) {
+			best_speed = agg->bandwidth;
+			best_agg = agg;
 		}
 	}
-	return best_agg_lead;
+	return best_agg;
 }
 
-static unsigned int lacp_get_agg_port_count(struct lacp_port *agg_lead)
+static struct lacp_agg *lacp_get_best_agg_by_port_count(struct lacp *lacp)
 {
-	struct teamd_port *tdport;
-	struct lacp_port *lacp_port;
-	unsigned int port_count = 0;
-
-	teamd_for_each_tdport(tdport, agg_lead->ctx) {
-		lacp_port = lacp_port_get(agg_lead->lacp, tdport);
-		if (lacp_port->agg_lead == agg_lead)
-			port_count++;
-	}
-	return port_count;
-}
-
-static struct lacp_port *lacp_get_best_agg_by_port_count(struct lacp *lacp)
-{
-	struct teamd_port *tdport;
-	struct lacp_port *lacp_port;
-	unsigned int port_count;
+	struct lacp_agg *agg;
 	unsigned int best_port_count = 0;
-	struct lacp_port *best_agg_lead = NULL;
+	struct lacp_agg *best_agg = NULL;
 
-	teamd_for_each_tdport(tdport, lacp->ctx) {
-		lacp_port = lacp_port_get(lacp, tdport);
-		if (!lacp_port_selected(lacp_port))
-			continue;
-		port_count = lacp_get_agg_port_count(lacp_port->agg_lead);
-		if (port_count > best_port_count) {
-			best_port_count = port_count;
-			best_agg_lead = lacp_port->agg_lead;
+	list_for_each_node_entry(agg, &lacp->agg_list, list) {
+		if (agg->port_count > best_port_count) {
+			best_port_count = agg->port_count;
+			best_agg = agg;
 		}
 	}
-	return best_agg_lead;
+	return best_agg;
 }
 
-static struct lacp_port *lacp_get_best_agg_by_best_port(struct lacp *lacp)
+static struct lacp_agg *lacp_get_best_agg_by_best_port(struct lacp *lacp)
 {
-	struct teamd_port *tdport;
-	struct lacp_port *lacp_port;
-	struct lacp_port *best_agg_lead = NULL;
+	struct lacp_agg *agg;
+	struct lacp_agg *best_agg = NULL;
 
-	teamd_for_each_tdport(tdport, lacp->ctx) {
-		lacp_port = lacp_port_get(lacp, tdport);
-		if (!lacp_port_selected(lacp_port))
-			continue;
-		if (lacp_port_better(lacp_port->agg_lead, best_agg_lead))
-			best_agg_lead = lacp_port->agg_lead;
+	list_for_each_node_entry(agg, &lacp->agg_list, list) {
+		if (lacp_port_better(agg->lead, best_agg ? best_agg->lead : NULL))
+			best_agg = agg;
 	}
-	return best_agg_lead;
+	return best_agg;
 }
 
-static bool lacp_agg_sticky(struct lacp_port *agg_lead)
+static bool lacp_agg_sticky(struct lacp_agg *agg)
 {
-	struct teamd_port *tdport;
-	struct lacp_port *lacp_port;
-
-	teamd_for_each_tdport(tdport, agg_lead->ctx) {
-		lacp_port = lacp_port_get(agg_lead->lacp, tdport);
-		if (lacp_port->agg_lead == agg_lead &&
-		    lacp_port->cfg.sticky)
-			return true;
-	}
-	return false;
+	return agg->sticky_count;
 }
 
-static struct lacp_port *lacp_get_next_agg(struct lacp *lacp)
+static struct lacp_agg *lacp_get_next_agg(struct lacp *lacp)
 {
-	struct lacp_port *next_agg_lead = lacp->selected_agg_lead;
+	struct lacp_agg *next_agg = lacp->selected_agg;
 
 	switch (lacp->cfg.agg_select_policy) {
 	case LACP_AGG_SELECT_LACP_PRIO:
-		next_agg_lead = lacp_get_best_agg_by_best_port(lacp);
+		next_agg = lacp_get_best_agg_by_best_port(lacp);
 		break;
 	case LACP_AGG_SELECT_LACP_PRIO_STABLE:
-		if (!lacp->selected_agg_lead)
-			next_agg_lead = lacp_get_best_agg_by_best_port(lacp);
+		if (!lacp->selected_agg)
+			next_agg = lacp_get_best_agg_by_best_port(lacp);
 		break;
 	case LACP_AGG_SELECT_BANDWIDTH:
-		next_agg_lead = lacp_get_best_agg_by_bandwidth(lacp);
+		next_agg = lacp_get_best_agg_by_bandwidth(lacp);
 		break;
 	case LACP_AGG_SELECT_COUNT:
-		next_agg_lead = lacp_get_best_agg_by_port_count(lacp);
+		next_agg = lacp_get_best_agg_by_port_count(lacp);
 		break;
 	case LACP_AGG_SELECT_PORT_CONFIG:
-		if (!lacp->selected_agg_lead ||
-		    !lacp_agg_sticky(lacp->selected_agg_lead))
-			next_agg_lead = lacp_get_best_agg_by_best_port(lacp);
+		if (!lacp->selected_agg ||
+		    !lacp_agg_sticky(lacp->selected_agg))
+			next_agg = lacp_get_best_agg_by_best_port(lacp);
 		break;
 	}
-	return next_agg_lead;
+	return next_agg;
 }
 
-static struct lacp_port *lacp_get_agg_lead(struct lacp_port *for_lacp_port)
+/*
+ * Find other aggregator the port is aggregable with. As ports in one
+ * aggregator are all aggregable with each other, checking the leading
+ * port is enough.
+ */
+static struct lacp_agg *lacp_find_agg(struct lacp_port *for_lacp_port)
 {
-	struct lacp *lacp = for_lacp_port->lacp;
-	struct teamd_port *tdport;
-	struct lacp_port *lacp_port;
+	struct lacp_agg *agg;
 
-	teamd_for_each_tdport(tdport, lacp->ctx) {
-		lacp_port = lacp_port_get(lacp, tdport);
-		if (!lacp_port_selected(lacp_port) ||
-		    lacp_port == for_lacp_port)
+	list_for_each_node_entry(agg, &for_lacp_port->lacp->agg_list, list) {
+		if (agg == for_lacp_port->agg)
 			continue;
-		if (lacp_ports_aggregable(lacp_port, for_lacp_port))
-			return lacp_port->agg_lead;
+		if (lacp_ports_aggregable(agg->lead, for_lacp_port))
+			return agg;
 	}
-	/* If no suitable aggregator found, the port is self-lead. */
-	return for_lacp_port;
+	return NULL;
 }
 
-static void lacp_switch_agg_lead(struct lacp_port *agg_lead,
-				 struct lacp_port *new_agg_lead)
+/*
+ * There is never more aggregators than ports, so one is allocated along
+ * with each port and kept in free list. Aggregators are then created
+ * on link and LACPDU events without heap allocation.
+ */
+static struct lacp_agg *lacp_agg_create(struct lacp *lacp,
+					struct lacp_port *lead)
 {
-	struct lacp *lacp = agg_lead->lacp;
-	struct teamd_port *tdport;
-	struct lacp_port *lacp_port;
+	struct lacp_agg *agg;
+
+	if (list_empty(&lacp->agg_free_list))
+		return NULL;
+	agg = list_get_node_entry(lacp->agg_free_list.next, struct lacp_agg,
+				  list);
+	list_del(&agg->list);
+	memset(agg, 0, sizeof(*agg));
+	agg->lacp = lacp;
+	agg->lead = lead;
+	list_init(&agg->port_list);
+	list_add_tail(&lacp->agg_list, &agg->list);
+	teamd_log_dbg("Created aggregator %u", lacp_agg_id(agg));
+	return agg;
+}
+
+static void lacp_agg_destroy(struct lacp_agg *agg)
+{
+	struct lacp *lacp = agg->lacp;
 
+	teamd_log_dbg("Removing aggregator %u", lacp_agg_id(agg));
+	if (lacp->selected_agg == agg)
+		lacp->selected_agg = NULL;
+	list_del(&agg->list);
+	list_add(&lacp->agg_free_list, &agg->list);
+}
+
+static void lacp_agg_port_add(struct lacp_agg *agg,
+			      struct lacp_port *lacp_port)
+{
+	lacp_port->agg = agg;
+	lacp_port->agg_speed = team_get_port_speed(lacp_port->tdport->team_port);
+	list_add_tail(&agg->port_list, &lacp_port->agg_list);
+	agg->port_count++;
+	agg->bandwidth += lacp_port->agg_speed;
+	if (lacp_port->cfg.sticky)
+		agg->sticky_count++;
+}
+
+static void lacp_agg_port_del(struct lacp_port *lacp_port)
+{
+	struct lacp_agg *agg = lacp_port->agg;
+
+	list_del(&lacp_port->agg_list);
+	agg->port_count--;
+	agg->bandwidth -= lacp_port->agg_speed;
+	if (lacp_port->cfg.sticky)
+		agg->sticky_count--;
+	lacp_port->agg = NULL;
+}
+
+static void lacp_agg_port_speed_update(struct lacp_port *lacp_port,
+				       uint32_t speed)
+{
+	if (!lacp_port->agg)
+		return;
+	lacp_port->agg->bandwidth -= lacp_port->agg_speed;
+	lacp_port->agg->bandwidth += speed;
+	lacp_port->agg_speed = speed;
+}
+
+static void lacp_switch_agg_lead(struct lacp_agg *agg,
+				 struct lacp_port *new_agg_lead)
+{
 	teamd_log_dbg("Renaming aggregator %u to %u",
-		      lacp_agg_id(agg_lead), lacp_agg_id(new_agg_lead));
-	if (lacp->selected_agg_lead == agg_lead)
-		lacp->selected_agg_lead = new_agg_lead;
-	teamd_for_each_tdport(tdport, lacp->ctx) {
-		lacp_port = lacp_port_get(lacp, tdport);
-		if (lacp_port->agg_lead == agg_lead)
-			lacp_port->agg_lead = new_agg_lead;
-	}
+		      lacp_agg_id(agg), new_agg_lead->tdport->ifindex);
+	agg->lead = new_agg_lead;
 }
 
-static void lacp_port_agg_select(struct lacp_port *lacp_port)
+static int lacp_port_agg_select(struct lacp_port *lacp_port)
 {
-	struct lacp_port *agg_lead;
+	struct lacp_agg *agg;
 
 	teamd_log_dbg("%s: Selecting LACP port", lacp_port->tdport->ifname);
-	agg_lead = lacp_get_agg_lead(lacp_port);
-	lacp_port->agg_lead = agg_lead;
-	if (lacp_port_better(lacp_port, agg_lead))
-		lacp_switch_agg_lead(agg_lead, lacp_port);
+	agg = lacp_find_agg(lacp_port);
+	if (!agg) {
+		/* If no suitable aggregator found, the port is self-lead. */
+		agg = lacp_agg_create(lacp_port->lacp, lacp_port);
+		if (!agg)
+			return -ENOMEM;
+	}
+	lacp_agg_port_add(agg, lacp_port);
+	if (lacp_port_better(lacp_port, agg->lead))
+		lacp_switch_agg_lead(agg, lacp_port);
 	teamd_log_dbg("%s: LACP port selected into aggregator %u",
 		      lacp_port->tdport->ifname, lacp_port_agg_id(lacp_port));
+	return 0;
 }
 
-static struct lacp_port *lacp_find_new_agg_lead(struct lacp_port *old_agg_lead)
+static struct lacp_port *lacp_find_new_agg_lead(struct lacp_agg *agg)
 {
-	struct teamd_port *tdport;
 	struct lacp_port *lacp_port;
 	struct lacp_port *new_agg_lead = NULL;
 
-	teamd_for_each_tdport(tdport, old_agg_lead->ctx) {
-		lacp_port = lacp_port_get(old_agg_lead->lacp, tdport);
-		if (lacp_port->agg_lead == old_agg_lead &&
-		    lacp_port_better(lacp_port, new_agg_lead))
+	list_for_each_node_entry(lacp_port, &agg->port_list, agg_list) {
+		if (lacp_port_better(lacp_port, new_agg_lead))
 			new_agg_lead = lacp_port;
 	}
 	return new_agg_lead;
@@ -658,21 +743,21 @@ static struct lacp_port *lacp_find_new_agg_lead(struct lacp_port *old_agg_lead)
 
 static void lacp_port_agg_unselect(struct lacp_port *lacp_port)
 {
-	struct lacp_port *agg_lead = lacp_port->agg_lead;
+	struct lacp_agg *agg = lacp_port->agg;
+	struct lacp_port *new_agg_lead;
 
 	teamd_log_dbg("%s: Unselecting LACP port", lacp_port->tdport->ifname);
 	teamd_log_dbg("%s: LACP port unselected from aggregator %u",
 		      lacp_port->tdport->ifname, lacp_port_agg_id(lacp_port));
-	lacp_port->agg_lead = NULL;
-	if (lacp_port == agg_lead) {
-		/* In case currently unselected port is aggregator lead lead,
-		 * find new one.
-		 */
-		struct lacp_port *new_agg_lead;
-
-		new_agg_lead = lacp_find_new_agg_lead(agg_lead);
-		lacp_switch_agg_lead(agg_lead, new_agg_lead);
-	}
+	lacp_agg_port_del(lacp_port);
+	if (lacp_port != agg->lead)
+		return;
+	/* In case currently unselected port is aggregator lead, find new one */
+	new_agg_lead = lacp_find_new_agg_lead(agg);
+	if (new_agg_lead)
+		lacp_switch_agg_lead(agg, new_agg_lead);
+	else
+		lacp_agg_destroy(agg);
 }
 
 static int lacp_ports_update_enabled(struct lacp *lacp)
@@ -690,19 +775,27 @@ static int lacp_ports_update_enabled(struct lacp *lacp)
 	return 0;
 }
 
+/*
+ * In case selected aggregator stays the same, only the changed port may
+ * need to be enabled or disabled, so other ports are not touched.
+ */
 static int lacp_selected_agg_update(struct lacp *lacp,
-				    struct lacp_port *next_agg_lead)
+				    struct lacp_agg *next_agg,
+				    struct lacp_port *changed_lacp_port)
 {
 	int err;
 
-	if (!next_agg_lead)
-		next_agg_lead = lacp_get_next_agg(lacp);
-	if (lacp->selected_agg_lead != next_agg_lead)
-		teamd_log_dbg("Selecting aggregator %u",
-			      lacp_agg_id(next_agg_lead));
-	lacp->selected_agg_lead = next_agg_lead;
-
-	err = lacp_ports_update_enabled(lacp);
+	if (!next_agg)
+		next_agg = lacp_get_next_agg(lacp);
+	if (lacp->selected_agg != next_agg || !changed_lacp_port) {
+		if (lacp->selected_agg != next_agg)
+			teamd_log_dbg("Selecting aggregator %u",
+				      lacp_agg_id(next_agg));
+		lacp->selected_agg = next_agg;
+		err = lacp_ports_update_enabled(lacp);
+	} else {
+		err = lacp_port_update_enabled(changed_lacp_port);
+	}
 	if (err)
 		return err;
 	err = lacp_update_carrier(lacp);
@@ -717,12 +810,14 @@ static bool lacp_port_mergeable(struct lacp_port *lacp_port)
 	 * alone in aggragator and is aggregable with some other port.
 	 */
 	return lacp_port_is_agg_lead(lacp_port) &&
-	       lacp_get_agg_port_count(lacp_port) == 1 &&
-	       lacp_get_agg_lead(lacp_port) != lacp_port;
+	       lacp_port->agg->port_count == 1 &&
+	       lacp_find_agg(lacp_port);
 }
 
 static int lacp_port_agg_update(struct lacp_port *lacp_port)
 {
+	int err;
+
 	if (lacp_port_selected(lacp_port) &&
 	    (!lacp_port_selectable(lacp_port) ||
 	     !lacp_port_correct_aggregation(lacp_port) ||
@@ -730,10 +825,13 @@ static int lacp_port_agg_update(struct lacp_port *lacp_port)
 		lacp_port_agg_unselect(lacp_port);
 
 	if (!lacp_port_selected(lacp_port) &&
-	    lacp_port_selectable(lacp_port))
-		lacp_port_agg_select(lacp_port);
+	    lacp_port_selectable(lacp_port)) {
+		err = lacp_port_agg_select(lacp_port);
+		if (err)
+			return err;
+	}
 
-	return lacp_selected_agg_update(lacp_port->lacp, NULL);
+	return lacp_selected_agg_update(lacp_port->lacp, NULL, lacp_port);
 }
 
 static const char slow_addr[ETH_ALEN] = { 0x01, 0x80, 0xC2, 0x00, 0x00, 0x02 };
@@ -804,6 +902,9 @@ static int lacp_port_periodic_set(struct lacp_port *lacp_port)
 {
 	int err;
 	struct timespec ts;
+	struct timespec initial;
+	struct timespec now;
+	long long now_ms;
 	int ms;
 	int fast_on;
 
@@ -812,9 +913,13 @@ static int lacp_port_periodic_set(struct lacp_port *lacp_port)
 		      lacp_port->tdport->ifname, fast_on ? "fast": "slow");
 	ms = fast_on ? LACP_PERIODIC_SHORT: LACP_PERIODIC_LONG;
 	ms_to_timespec(&ts, ms);
+	/* Align to interval so timers of all ports expire together */
+	teamd_clock_gettime(lacp_port->ctx, &now);
+	now_ms = now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+	ms_to_timespec(&initial, ms - now_ms % ms);
 	err = teamd_loop_callback_timer_set(lacp_port->ctx,
 					    LACP_PERIODIC_CB_NAME,
-					    lacp_port, &ts, NULL);
+					    lacp_port, &ts, &initial);
 	if (err) {
 		teamd_log_err("Failed to set periodic timer.");
 		return err;
@@ -850,11 +955,18 @@ static void lacp_port_periodic_off(struct lacp_port *lacp_port)
 	lacp_port_periodic_cb_change_enabled(lacp_port);
 }
 
+static void lacp_port_lacpdu_update(struct lacp_port *lacp_port)
+{
+	lacp_port->lacpdu.actor = lacp_port->actor;
+	lacp_port->lacpdu.partner = lacp_port->partner;
+}
+
 static int lacp_port_partner_update(struct lacp_port *lacp_port)
 {
 	uint8_t state_changed;
 	int err;
 
+	lacp_port_lacpdu_update(lacp_port);
 	state_changed = lacp_port->partner.state ^
 			lacp_port->__partner_last.state;
 
@@ -879,6 +991,7 @@ static void lacp_port_actor_init(struct lacp_port *lacp_port)
         actor->key = htons(lacp_port->cfg.lacp_key);
         actor->port_priority = htons(lacp_port->cfg.lacp_prio);
 	actor->port = htons(lacp_port->tdport->ifindex);
+	lacp_port_lacpdu_update(lacp_port);
 }
 
 static int lacpdu_send(struct lacp_port *lacp_port);
@@ -903,6 +1016,7 @@ static int lacp_port_actor_update(struct lacp_port *lacp_port)
 	teamd_log_dbg("%s: lacp info state: 0x%02X.", lacp_port->tdport->ifname,
 						      state);
 	lacp_port->actor.state = state;
+	lacp_port_lacpdu_update(lacp_port);
 	return lacpdu_send(lacp_port);
 }
 
@@ -977,6 +1091,8 @@ static int lacp_port_link_update(struct lacp_port *lacp_port)
 	uint8_t duplex = team_get_port_duplex(team_port);
 	int err;
 
+	if (speed != lacp_port->__link_last.speed)
+		lacp_agg_port_speed_update(lacp_port, speed);
 	if (linkup != lacp_port->__link_last.up ||
 	    duplex != lacp_port->__link_last.duplex) {
 		/* If duplex is 0, meaning half-duplex, it should be set
@@ -1001,28 +1117,103 @@ static int lacp_port_link_update(struct lacp_port *lacp_port)
 
 static int lacpdu_send(struct lacp_port *lacp_port)
 {
-	struct lacpdu lacpdu;
-	struct sockaddr_ll ll_my;
-	struct sockaddr_ll ll_slow;
-	int err;
-
-	err = teamd_getsockname_hwaddr(lacp_port->sock, &ll_my, 0);
-	if (err)
-		return err;
-	ll_slow = ll_my;
-	memcpy(ll_slow.sll_addr, slow_addr, ll_slow.sll_halen);
+	return teamd_sendto(lacp_port->sock, &lacp_port->lacpdu,
+			    sizeof(lacp_port->lacpdu), 0,
+			    (struct sockaddr *) &lacp_port->ll_slow,
+			    sizeof(lacp_port->ll_slow));
+}
 
-	memcpy(lacp_port->actor.system, lacp_port->ctx->hwaddr, ETH_ALEN);
+static int lacp_tx_batch_flush(struct lacp *lacp)
+{
+	unsigned int count = lacp->tx_batch.count;
+	unsigned int sent = 0;
+	unsigned int i;
+	int ret;
+	int err = 0;
 
-	lacpdu_init(&lacpdu);
-	lacpdu.actor = lacp_port->actor;
-	lacpdu.partner = lacp_port->partner;
+	for (i = 0; i < count; i++) {
+		struct lacp_port *lacp_port = lacp->tx_batch.ports[i];
+		struct msghdr *msg_hdr = &lacp->tx_batch.mmsgs[i].msg_hdr;
+
+		lacp->tx_batch.iovs[i].iov_base = &lacp_port->lacpdu;
+		lacp->tx_batch.iovs[i].iov_len = sizeof(lacp_port->lacpdu);
+		msg_hdr->msg_name = &lacp_port->ll_slow;
+		msg_hdr->msg_namelen = sizeof(lacp_port->ll_slow);
+		msg_hdr->msg_iov = &lacp->tx_batch.iovs[i];
+		msg_hdr->msg_iovlen = 1;
+		lacp_port->tx_queued = false;
+	}
+	lacp->tx_batch.count = 0;
 
-	err = teamd_sendto(lacp_port->sock, &lacpdu, sizeof(lacpdu), 0,
-			   (struct sockaddr *) &ll_slow, sizeof(ll_slow));
+	while (sent < count) {
+		ret = sendmmsg(lacp->tx_batch.sock, &lacp->tx_batch.mmsgs[sent],
+			       count - sent, 0);
+		if (ret != -1) {
+			sent += ret;
+			continue;
+		}
+		/* Error always belongs to the first message not sent */
+		switch (errno) {
+		case EINTR:
+			continue;
+		case ENETDOWN:
+		case ENXIO:
+		case ENODEV: /* port may be gone already */
+			sent++;
+			continue;
+		default:
+			teamd_log_err("sendmmsg failed.");
+			err = -errno;
+			return err;
+		}
+	}
 	return err;
 }
 
+static int lacp_tx_batch_flush_work(struct teamd_context *ctx,
+				    struct teamd_workq *workq)
+{
+	struct lacp *lacp;
+
+	lacp = get_container(workq, struct lacp, tx_batch.flush_workq);
+	return lacp_tx_batch_flush(lacp);
+}
+
+static int lacpdu_queue(struct lacp_port *lacp_port)
+{
+	struct lacp *lacp = lacp_port->lacp;
+	int err;
+
+	if (lacp_port->tx_queued)
+		return 0;
+	if (lacp->tx_batch.count == LACP_TX_BATCH_MAX_MSGS) {
+		err = lacp_tx_batch_flush(lacp);
+		if (err)
+			return err;
+	}
+	lacp->tx_batch.ports[lacp->tx_batch.count++] = lacp_port;
+	lacp_port->tx_queued = true;
+	teamd_workq_schedule_after_dispatch(lacp->ctx,
+					    &lacp->tx_batch.flush_workq);
+	return 0;
+}
+
+static void lacpdu_dequeue(struct lacp_port *lacp_port)
+{
+	struct lacp *lacp = lacp_port->lacp;
+	unsigned int i;
+
+	if (!lacp_port->tx_queued)
+		return;
+	for (i = 0; i < lacp->tx_batch.count; i++)
+		if (lacp->tx_batch.ports[i] == lacp_port)
+			break;
+	lacp->tx_batch.count--;
+	memmove(&lacp->tx_batch.ports[i], &lacp->tx_batch.ports[i + 1],
+		(lacp->tx_batch.count - i) * sizeof(lacp->tx_batch.ports[0]));
+	lacp_port->tx_queued = false;
+}
+
 static int lacpdu_recv(struct lacp_port *lacp_port)
 {
 	struct lacpdu lacpdu;
@@ -1097,7 +1288,7 @@ static int lacp_callback_periodic(struct teamd_context *ctx, int events,
 {
 	struct lacp_port *lacp_port = priv;
 
-	return lacpdu_send(lacp_port);
+	return lacpdu_queue(lacp_port);
 }
 
 static int lacp_callback_socket(struct teamd_context *ctx, int events,
@@ -1173,11 +1364,14 @@ static int lacp_port_added(struct teamd_context *ctx,
 {
 	struct lacp_port *lacp_port = priv;
 	struct lacp *lacp = creator_priv;
+	struct lacp_agg *agg;
 	int err;
 
 	lacp_port->ctx = ctx;
 	lacp_port->tdport = tdport;
 	lacp_port->lacp = lacp;
+	lacp_port->prio = teamd_port_prio(ctx, tdport);
+	lacp_port_healthy_update(lacp_port);
 
 	err = lacp_port_load_config(ctx, lacp_port);
 	if (err) {
@@ -1185,11 +1379,23 @@ static int lacp_port_added(struct teamd_context *ctx,
 		return err;
 	}
 
+	agg = myzalloc(sizeof(*agg));
+	if (!agg)
+		return -ENOMEM;
+	list_add(&lacp->agg_free_list, &agg->list);
+
 	err = teamd_packet_sock_open(&lacp_port->sock,
 				     tdport->ifindex,
 				     htons(ETH_P_SLOW), NULL, NULL);
 	if (err)
-		return err;
+		goto free_agg;
+
+	err = teamd_getsockname_hwaddr(lacp_port->sock, &lacp_port->ll_slow, 0);
+	if (err)
+		goto close_sock;
+	memcpy(lacp_port->ll_slow.sll_addr, slow_addr,
+	       lacp_port->ll_slow.sll_halen);
+	lacpdu_init(&lacp_port->lacpdu);
 
 	err = slow_addr_add(lacp_port);
 	if (err)
@@ -1198,14 +1404,16 @@ static int lacp_port_added(struct teamd_context *ctx,
 	err = teamd_loop_callback_fd_add(ctx, LACP_SOCKET_CB_NAME, lacp_port,
 					 lacp_callback_socket,
 					 lacp_port->sock,
-					 TEAMD_LOOP_FD_EVENT_READ);
+					 TEAMD_LOOP_FD_EVENT_READ,
+					 TEAMD_LOOP_PRIO_PROTOCOL);
 	if (err) {
 		teamd_log_err("Failed add socket callback.");
 		goto slow_addr_del;
 	}
 
 	err = teamd_loop_callback_timer_add(ctx, LACP_PERIODIC_CB_NAME,
-					    lacp_port, lacp_callback_periodic);
+					    lacp_port, lacp_callback_periodic,
+					    TEAMD_LOOP_PRIO_PROTOCOL);
 	if (err) {
 		teamd_log_err("Failed add periodic callback timer");
 		goto socket_callback_del;
@@ -1215,7 +1423,8 @@ static int lacp_port_added(struct teamd_context *ctx,
 		goto periodic_callback_del;
 
 	err = teamd_loop_callback_timer_add(ctx, LACP_TIMEOUT_CB_NAME,
-					    lacp_port, lacp_callback_timeout);
+					    lacp_port, lacp_callback_timeout,
+					    TEAMD_LOOP_PRIO_PROTOCOL);
 	if (err) {
 		teamd_log_err("Failed add timeout callback timer");
 		goto periodic_callback_del;
@@ -1249,6 +1458,9 @@ slow_addr_del:
 	slow_addr_del(lacp_port);
 close_sock:
 	close(lacp_port->sock);
+free_agg:
+	list_del(&agg->list);
+	free(agg);
 	return err;
 }
 
@@ -1257,8 +1469,19 @@ static void lacp_port_removed(struct teamd_context *ctx,
 			      void *priv, void *creator_priv)
 {
 	struct lacp_port *lacp_port = priv;
+	struct lacp *lacp = lacp_port->lacp;
+	struct lacp_agg *agg;
 
 	lacp_port_set_state(lacp_port, PORT_STATE_DISABLED);
+	lacp_port_enabled_set(lacp_port, false);
+	/* Port is not selected now, so some aggregator is free for sure */
+	if (!list_empty(&lacp->agg_free_list)) {
+		agg = list_get_node_entry(lacp->agg_free_list.next,
+					  struct lacp_agg, list);
+		list_del(&agg->list);
+		free(agg);
+	}
+	lacpdu_dequeue(lacp_port);
 	teamd_loop_callback_del(ctx, LACP_TIMEOUT_CB_NAME, lacp_port);
 	teamd_loop_callback_del(ctx, LACP_PERIODIC_CB_NAME, lacp_port);
 	teamd_loop_callback_del(ctx, LACP_SOCKET_CB_NAME, lacp_port);
@@ -1301,10 +1524,70 @@ static int lacp_event_watch_port_changed(struct teamd_context *ctx,
 	return lacp_port_link_update(lacp_port);
 }
 
+/*
+ * Port health changes with link as well, link watches report both. Port is
+ * reselected only when its health crosses min_health.
+ */
+static int lacp_event_watch_port_health_changed(struct teamd_context *ctx,
+						struct teamd_port *tdport,
+						void *priv)
+{
+	struct lacp *lacp = priv;
+	struct lacp_port *lacp_port = lacp_port_get(lacp, tdport);
+	int err;
+
+	if (!lacp_port || !lacp_port_healthy_update(lacp_port))
+		return 0;
+	teamd_log_dbg("%s: Port health %s min_health.", tdport->ifname,
+		      lacp_port->healthy ? "reached" : "dropped below");
+	err = lacp_port_agg_update(lacp_port);
+	if (err)
+		return err;
+	return lacp_port_actor_update(lacp_port);
+}
+
+static int lacp_event_watch_hwaddr_changed(struct teamd_context *ctx,
+					   void *priv)
+{
+	struct lacp *lacp = priv;
+	struct teamd_port *tdport;
+	struct lacp_port *lacp_port;
+
+	teamd_for_each_tdport(tdport, ctx) {
+		lacp_port = lacp_port_get(lacp, tdport);
+		memcpy(lacp_port->actor.system, ctx->hwaddr, ETH_ALEN);
+		lacp_port_lacpdu_update(lacp_port);
+	}
+	return 0;
+}
+
+static int lacp_event_watch_prio_option_changed(struct teamd_context *ctx,
+						struct team_option *option,
+						void *priv)
+{
+	struct lacp *lacp = priv;
+	struct teamd_port *tdport;
+	struct lacp_port *lacp_port;
+
+	tdport = teamd_get_port(ctx, team_get_option_port_ifindex(option));
+	if (!tdport)
+		return 0;
+	lacp_port = lacp_port_get(lacp, tdport);
+	if (!lacp_port)
+		return 0;
+	lacp_port->prio = team_get_option_value_s32(option);
+	return 0;
+}
+
 static const struct teamd_event_watch_ops lacp_port_watch_ops = {
+	.hwaddr_changed = lacp_event_watch_hwaddr_changed,
 	.port_added = lacp_event_watch_port_added,
 	.port_removed = lacp_event_watch_port_removed,
 	.port_changed = lacp_event_watch_port_changed,
+	.port_link_changed = lacp_event_watch_port_health_changed,
+	.port_health_changed = lacp_event_watch_port_health_changed,
+	.option_changed = lacp_event_watch_prio_option_changed,
+	.option_changed_match_name = "priority",
 };
 
 static int lacp_carrier_init(struct teamd_context *ctx, struct lacp *lacp)
@@ -1649,7 +1932,7 @@ static int lacp_port_aggregator_select_work(struct teamd_context *ctx,
 	lacp_port = lacp_port_get(lacp, tdport);
 	if (!lacp_port_selected(lacp_port))
 		return 0;
-	return lacp_selected_agg_update(lacp_port->lacp, lacp_port->agg_lead);
+	return lacp_selected_agg_update(lacp_port->lacp, lacp_port->agg, NULL);
 }
 
 static int lacp_port_state_aggregator_selected_set(struct teamd_context *ctx,
@@ -1772,6 +2055,8 @@ static int lacp_init(struct teamd_context *ctx, void *priv)
 	}
 
 	lacp->ctx = ctx;
+	list_init(&lacp->agg_list);
+	list_init(&lacp->agg_free_list);
 	err = teamd_hash_func_set(ctx);
 	if (err)
 		return err;
@@ -1785,10 +2070,18 @@ static int lacp_init(struct teamd_context *ctx, void *priv)
 		teamd_log_err("Failed to initialize carrier.");
 		return err;
 	}
+	/* Socket is used only for sending, so it is not bound */
+	lacp->tx_batch.sock = socket(PF_PACKET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (lacp->tx_batch.sock == -1) {
+		teamd_log_err("Failed to create LACPDU batch socket.");
+		return -errno;
+	}
+	teamd_workq_init_work(&lacp->tx_batch.flush_workq,
+			      lacp_tx_batch_flush_work);
 	err = teamd_event_watch_register(ctx, &lacp_port_watch_ops, lacp);
 	if (err) {
 		teamd_log_err("Failed to register event watch.");
-		return err;
+		goto close_tx_batch_sock;
 	}
 	err = teamd_balancer_init(ctx, &lacp->tb);
 	if (err) {
@@ -1806,6 +2099,8 @@ balancer_fini:
 	teamd_balancer_fini(lacp->tb);
 event_watch_unregister:
 	teamd_event_watch_unregister(ctx, &lacp_port_watch_ops, lacp);
+close_tx_batch_sock:
+	close(lacp->tx_batch.sock);
 	return err;
 }
 
@@ -1816,6 +2111,8 @@ static void lacp_fini(struct teamd_context *ctx, void *priv)
 	teamd_state_val_unregister(ctx, &lacp_state_vg, lacp);
 	teamd_balancer_fini(lacp->tb);
 	teamd_event_watch_unregister(ctx, &lacp_port_watch_ops, lacp);
+	teamd_workq_cancel_work(ctx, &lacp->tx_batch.flush_workq);
+	close(lacp->tx_batch.sock);
 	lacp_carrier_fini(ctx, lacp);
 }
 
@@ -275,6 +275,7 @@ static int teamd_state_vals_dump(struct teamd_context *ctx,
 							   tdport, item);
 				if (err)
 					return err;
+				teamd_run_loop_yield(ctx);
 			}
 		} else {
 			err = teamd_state_val_dump(ctx, root_json_obj,
@@ -282,6 +283,7 @@ static int teamd_state_vals_dump(struct teamd_context *ctx,
 			if (err)
 				return err;
 		}
+		teamd_run_loop_yield(ctx);
 	}
 	return 0;
 }
@@ -237,7 +237,8 @@ static int acc_conn_create(struct teamd_context *ctx, int sock)
 	err = teamd_loop_callback_fd_add(ctx, USOCK_ACC_CONN_CB_NAME, acc_conn,
 					 callback_usock_acc_conn,
 					 acc_conn->sock,
-					 TEAMD_LOOP_FD_EVENT_READ);
+					 TEAMD_LOOP_FD_EVENT_READ,
+					 TEAMD_LOOP_PRIO_CONTROL);
 	if (err)
 		goto free_acc_conn;
 	teamd_loop_callback_enable(ctx, USOCK_ACC_CONN_CB_NAME, acc_conn);
@@ -358,7 +359,8 @@ int teamd_usock_init(struct teamd_context *ctx)
 		return err;
 	err = teamd_loop_callback_fd_add(ctx, USOCK_CB_NAME, ctx,
 					 callback_usock, ctx->usock.sock,
-					 TEAMD_LOOP_FD_EVENT_READ);
+					 TEAMD_LOOP_FD_EVENT_READ,
+					 TEAMD_LOOP_PRIO_CONTROL);
 	if (err)
 		goto sock_close;
 	teamd_loop_callback_enable(ctx, USOCK_CB_NAME, ctx);
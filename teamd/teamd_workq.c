@@ -18,26 +18,28 @@
  */
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <unistd.h>
-#include <fcntl.h>
 #include <errno.h>
+#include <sys/eventfd.h>
 #include <private/misc.h>
 
 #include "teamd_workq.h"
 
 #define WORKQ_CB_NAME "workq"
+#define WORKQ_DELAYED_CB_NAME "workq_delayed"
 
 static int teamd_workq_callback_socket(struct teamd_context *ctx, int events,
 				       void *priv)
 {
 	struct teamd_workq *workq;
-	struct teamd_workq *tmp;
-	char bytes[16];
+	uint64_t count;
 	int ret;
 	int err;
 
 again:
-	ret = read(ctx->workq.pipe_r, bytes, sizeof(bytes));
+	ret = read(ctx->workq.efd, &count, sizeof(count));
 	if (ret == -1) {
 		if (errno == EINTR)
 			goto again;
@@ -45,9 +47,12 @@ again:
 			return -errno;
 	}
 
-	teamd_loop_callback_disable(ctx, WORKQ_CB_NAME, ctx);
-
-	list_for_each_node_entry_safe(workq, tmp, &ctx->workq.work_list, list) {
+	/* Pop works one by one as the work func may cancel or reschedule
+	 * any other work, including the one which would be next in list.
+	 */
+	while (!list_empty(&ctx->workq.work_list)) {
+		workq = list_get_node_entry(ctx->workq.work_list.next,
+					    struct teamd_workq, list);
 		list_del(&workq->list);
 		list_init(&workq->list);
 		err = workq->func(ctx, workq);
@@ -57,32 +62,121 @@ again:
 	return 0;
 }
 
+static void teamd_workq_set_for_process(struct teamd_context *ctx)
+{
+	const uint64_t one = 1;
+	int err;
+
+retry:
+	err = write(ctx->workq.efd, &one, sizeof(one));
+	if (err == -1 && errno == EINTR)
+		goto retry;
+}
+
+/*
+ * Timer is set only in case the head of delayed list changed since it
+ * was armed last time, so scheduling or cancelling work which expires
+ * later does not touch the loop at all.
+ */
+static void teamd_workq_delayed_timer_arm(struct teamd_context *ctx)
+{
+	struct teamd_workq *first = NULL;
+	struct timespec now;
+	struct timespec delay;
+
+	first = list_get_next_node_entry(&ctx->workq.delayed_list, first, list);
+	if (!first) {
+		if (!ctx->workq.timer_armed)
+			return;
+		ctx->workq.timer_armed = false;
+		teamd_loop_callback_disable(ctx, WORKQ_DELAYED_CB_NAME, ctx);
+		return;
+	}
+	if (ctx->workq.timer_armed &&
+	    !timespec_cmp(&first->expires, &ctx->workq.timer_expires))
+		return;
+	ctx->workq.timer_armed = true;
+	ctx->workq.timer_expires = first->expires;
+	teamd_clock_gettime(ctx, &now);
+	if (timespec_cmp(&first->expires, &now) > 0) {
+		delay.tv_sec = first->expires.tv_sec - now.tv_sec;
+		delay.tv_nsec = first->expires.tv_nsec - now.tv_nsec;
+		if (delay.tv_nsec < 0) {
+			delay.tv_sec--;
+			delay.tv_nsec += 1000000000;
+		}
+	} else {
+		delay.tv_sec = 0;
+		delay.tv_nsec = 1;
+	}
+	teamd_loop_callback_timer_set(ctx, WORKQ_DELAYED_CB_NAME, ctx,
+				      NULL, &delay);
+	teamd_loop_callback_enable(ctx, WORKQ_DELAYED_CB_NAME, ctx);
+}
+
+static int teamd_workq_callback_delayed(struct teamd_context *ctx, int events,
+					void *priv)
+{
+	struct teamd_workq *workq;
+	struct teamd_workq *tmp;
+	struct timespec now;
+	bool queued = false;
+
+	/* Timer is one-shot, it is not armed anymore */
+	ctx->workq.timer_armed = false;
+	teamd_clock_gettime(ctx, &now);
+	list_for_each_node_entry_safe(workq, tmp, &ctx->workq.delayed_list,
+				      list) {
+		if (timespec_cmp(&workq->expires, &now) > 0)
+			break;
+		list_del(&workq->list);
+		workq->delayed = false;
+		list_add_tail(&ctx->workq.work_list, &workq->list);
+		queued = true;
+	}
+	if (queued)
+		teamd_workq_set_for_process(ctx);
+	teamd_workq_delayed_timer_arm(ctx);
+	return 0;
+}
+
 int teamd_workq_init(struct teamd_context *ctx)
 {
-	int fds[2];
 	int err;
 
 	list_init(&ctx->workq.work_list);
-	err = pipe2(fds, O_NONBLOCK);
-	if (err)
+	list_init(&ctx->workq.delayed_list);
+	list_init(&ctx->workq.after_dispatch_list);
+	ctx->workq.timer_armed = false;
+	ctx->workq.efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ctx->workq.efd == -1)
 		return -errno;
-	ctx->workq.pipe_r = fds[0];
-	ctx->workq.pipe_w = fds[1];
 
 	err = teamd_loop_callback_fd_add_tail(ctx, WORKQ_CB_NAME, ctx,
 					      teamd_workq_callback_socket,
-					      ctx->workq.pipe_r,
-					      TEAMD_LOOP_FD_EVENT_READ);
+					      ctx->workq.efd,
+					      TEAMD_LOOP_FD_EVENT_READ,
+					      TEAMD_LOOP_PRIO_BACKGROUND);
 	if (err) {
 		teamd_log_err("Failed add workq callback.");
-		goto close_pipe;
+		goto close_efd;
 	}
-	return 0;
 
-close_pipe:
-	close(ctx->workq.pipe_r);
-	close(ctx->workq.pipe_w);
+	err = teamd_loop_callback_timer_add(ctx, WORKQ_DELAYED_CB_NAME, ctx,
+					    teamd_workq_callback_delayed,
+					    TEAMD_LOOP_PRIO_BACKGROUND);
+	if (err) {
+		teamd_log_err("Failed add workq delayed callback.");
+		goto callback_del;
+	}
+	teamd_loop_callback_enable(ctx, WORKQ_CB_NAME, ctx);
 	return 0;
+
+callback_del:
+	teamd_loop_callback_del(ctx, WORKQ_CB_NAME, ctx);
+close_efd:
+	close(ctx->workq.efd);
+	return err;
 }
 
 void teamd_workq_fini(struct teamd_context *ctx)
@@ -90,38 +184,132 @@ void teamd_workq_fini(struct teamd_context *ctx)
 	struct teamd_workq *workq;
 	struct teamd_workq *tmp;
 
+	teamd_loop_callback_del(ctx, WORKQ_DELAYED_CB_NAME, ctx);
 	teamd_loop_callback_del(ctx, WORKQ_CB_NAME, ctx);
-	close(ctx->workq.pipe_r);
-	close(ctx->workq.pipe_w);
+	close(ctx->workq.efd);
 	list_for_each_node_entry_safe(workq, tmp, &ctx->workq.work_list, list) {
 		list_del(&workq->list);
 		list_init(&workq->list);
 	}
+	list_for_each_node_entry_safe(workq, tmp, &ctx->workq.delayed_list,
+				      list) {
+		list_del(&workq->list);
+		list_init(&workq->list);
+		workq->delayed = false;
+	}
+	list_for_each_node_entry_safe(workq, tmp,
+				      &ctx->workq.after_dispatch_list, list) {
+		list_del(&workq->list);
+		list_init(&workq->list);
+	}
 }
 
-static void teamd_workq_set_for_process(struct teamd_context *ctx)
+void teamd_workq_schedule_work(struct teamd_context *ctx,
+			       struct teamd_workq *workq)
+{
+	if (!list_empty(&workq->list)) {
+		workq->merged_count++;
+		if (!workq->delayed)
+			return;
+		/* Pending delayed work is to be run right away now */
+		list_del(&workq->list);
+		workq->delayed = false;
+		teamd_workq_delayed_timer_arm(ctx);
+	}
+	list_add_tail(&ctx->workq.work_list, &workq->list);
+	teamd_workq_set_for_process(ctx);
+}
+
+/*
+ * Work is run once delay_ms passes. All schedules of the same work until
+ * then are merged into that single run, so delay_ms is the window
+ * in which repeated events are coalesced.
+ */
+void teamd_workq_schedule_delayed(struct teamd_context *ctx,
+				  struct teamd_workq *workq,
+				  unsigned int delay_ms)
+{
+	struct teamd_workq *cur;
+	struct timespec delay;
+
+	if (!delay_ms) {
+		teamd_workq_schedule_work(ctx, workq);
+		return;
+	}
+	if (!list_empty(&workq->list)) {
+		workq->merged_count++;
+		return;
+	}
+	ms_to_timespec(&delay, delay_ms);
+	teamd_clock_gettime(ctx, &workq->expires);
+	timespec_add(&workq->expires, &delay);
+	workq->delayed = true;
+
+	/* Keep delayed list sorted by expiration */
+	list_for_each_node_entry(cur, &ctx->workq.delayed_list, list) {
+		if (timespec_cmp(&workq->expires, &cur->expires) < 0)
+			break;
+	}
+	list_add_tail(&cur->list, &workq->list);
+	teamd_workq_delayed_timer_arm(ctx);
+}
+
+/*
+ * Work is run by the loop once protocol and link watch callbacks ready in
+ * this iteration are processed, before control ones and before waiting
+ * again. Used to send out what these callbacks queued without waiting for
+ * background priority. Pending work of other kind is moved here, so it
+ * is run sooner.
+ */
+void teamd_workq_schedule_after_dispatch(struct teamd_context *ctx,
+					 struct teamd_workq *workq)
+{
+	if (!list_empty(&workq->list)) {
+		workq->merged_count++;
+		list_del(&workq->list);
+		if (workq->delayed) {
+			workq->delayed = false;
+			teamd_workq_delayed_timer_arm(ctx);
+		}
+	}
+	list_add_tail(&ctx->workq.after_dispatch_list, &workq->list);
+}
+
+void teamd_workq_run_after_dispatch(struct teamd_context *ctx)
 {
+	struct teamd_workq *workq;
 	int err;
-	const char byte = 0;
 
-retry:
-	err = write(ctx->workq.pipe_w, &byte, 1);
-	if (err == -1 && errno == EINTR)
-		goto retry;
-	teamd_loop_callback_enable(ctx, WORKQ_CB_NAME, ctx);
+	/* Same as in teamd_workq_callback_socket() */
+	while (!list_empty(&ctx->workq.after_dispatch_list)) {
+		workq = list_get_node_entry(ctx->workq.after_dispatch_list.next,
+					    struct teamd_workq, list);
+		list_del(&workq->list);
+		list_init(&workq->list);
+		err = workq->func(ctx, workq);
+		if (err)
+			teamd_log_warn("After dispatch work failed with: %s",
+				       strerror(-err));
+	}
 }
 
-void teamd_workq_schedule_work(struct teamd_context *ctx,
-			       struct teamd_workq *workq)
+void teamd_workq_cancel_work(struct teamd_context *ctx,
+			     struct teamd_workq *workq)
 {
-	if (!list_empty(&workq->list))
+	if (list_empty(&workq->list))
 		return;
-	list_add_tail(&ctx->workq.work_list, &workq->list);
-	teamd_workq_set_for_process(ctx);
+	list_del(&workq->list);
+	list_init(&workq->list);
+	if (workq->delayed) {
+		workq->delayed = false;
+		teamd_workq_delayed_timer_arm(ctx);
+	}
 }
 
 void teamd_workq_init_work(struct teamd_workq *workq, teamd_workq_func_t func)
 {
 	workq->func = func;
+	workq->delayed = false;
+	workq->merged_count = 0;
 	list_init(&workq->list);
 }
@@ -28,12 +28,23 @@ typedef int (*teamd_workq_func_t)(struct teamd_context *ctx,
 struct teamd_workq {
 	struct list_item list;
 	teamd_workq_func_t func;
+	struct timespec expires; /* valid for delayed work only */
+	bool delayed;
+	unsigned int merged_count; /* schedules merged into pending run */
 };
 
 int teamd_workq_init(struct teamd_context *ctx);
 void teamd_workq_fini(struct teamd_context *ctx);
 void teamd_workq_schedule_work(struct teamd_context *ctx,
 			       struct teamd_workq *workq);
+void teamd_workq_schedule_delayed(struct teamd_context *ctx,
+				  struct teamd_workq *workq,
+				  unsigned int delay_ms);
+void teamd_workq_schedule_after_dispatch(struct teamd_context *ctx,
+					 struct teamd_workq *workq);
+void teamd_workq_run_after_dispatch(struct teamd_context *ctx);
+void teamd_workq_cancel_work(struct teamd_context *ctx,
+			     struct teamd_workq *workq);
 void teamd_workq_init_work(struct teamd_workq *workq, teamd_workq_func_t func);
 
 #endif /* _TEAMD_WORKQ_H_ */
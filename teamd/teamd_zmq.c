@@ -273,7 +273,8 @@ int teamd_zmq_init(struct teamd_context *ctx)
 	zmq_getsockopt(ctx->zmq.sock, ZMQ_FD, &fd, &fd_size);
 
 	err = teamd_loop_callback_fd_add(ctx, ZMQ_CB_NAME, ctx, callback_zmq,
-					 fd, TEAMD_LOOP_FD_EVENT_READ);
+					 fd, TEAMD_LOOP_FD_EVENT_READ,
+					 TEAMD_LOOP_PRIO_CONTROL);
 	if (err)
 		goto sock_close;
 	teamd_loop_callback_enable(ctx, ZMQ_CB_NAME, ctx);